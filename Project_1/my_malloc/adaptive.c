@@ -0,0 +1,97 @@
+#include "my_malloc.h"
+#include "adaptive.h"
+
+extern heap_info_t heap_info;
+
+struct AdaptivePolicy adaptivePolicy = { .policy = MY_MALLOC_FIRST_FIT, .probeLimit = 0 };
+
+MemoryBlock * findBoundedBestFit(MemoryBlock * curr, size_t size, size_t probeLimit, size_t * visited) {
+  MemoryBlock * bestFit = NULL;
+  size_t probes = 0;
+  size_t steps = 0;
+  for (; curr != NULL; curr = curr->next) {
+    steps++;
+    if (curr->dataSize < size) {
+      continue;
+    }
+    if (bestFit == NULL || curr->dataSize < bestFit->dataSize) {
+      bestFit = curr;
+    }
+    if (curr->dataSize == size || ++probes == probeLimit) {
+      break;
+    }
+  }
+  *visited += steps;
+  return bestFit;
+}
+
+static void switchPolicy(enum my_malloc_policy policy, size_t search) {
+  if (policy == MY_MALLOC_BEST_FIT) {
+    /* A retry given up before it settled: wait longer before the next. */
+    if (adaptivePolicy.retrying && adaptivePolicy.epochsSinceSwitch <= ADAPTIVE_DWELL) {
+      adaptivePolicy.retryEpochs = adaptivePolicy.retryEpochs * 2 > ADAPTIVE_MAX_RETRY
+        ? ADAPTIVE_MAX_RETRY : adaptivePolicy.retryEpochs * 2;
+    } else {
+      adaptivePolicy.retryEpochs = ADAPTIVE_RETRY;
+    }
+    adaptivePolicy.firstFitSearch = search;
+  } else {
+    adaptivePolicy.bestFitSearch = search;
+  }
+  adaptivePolicy.retrying = false;
+  adaptivePolicy.policy = policy;
+  adaptivePolicy.probeLimit = 0;
+  adaptivePolicy.epochsSinceSwitch = 0;
+  heap_stats.policySwitches++;
+}
+
+static void endEpoch() {
+  double fragmentation = heap_info.totalAllocated == 0 ? 0.0
+    : (double)heap_info.totalFreed / (double)heap_info.totalAllocated;
+  size_t search = adaptivePolicy.visited / adaptivePolicy.calls;
+  bool settled = ++adaptivePolicy.epochsSinceSwitch >= ADAPTIVE_DWELL;
+  adaptivePolicy.calls = 0;
+  adaptivePolicy.visited = 0;
+
+  if (adaptivePolicy.policy == MY_MALLOC_FIRST_FIT) {
+    size_t bestFitSearch = adaptivePolicy.bestFitSearch;
+    bool searchTooLong = search > ADAPTIVE_SEARCH_HIGH && search > bestFitSearch + bestFitSearch / 4;
+    if (settled && (fragmentation > ADAPTIVE_FRAG_HIGH || searchTooLong)) {
+      switchPolicy(MY_MALLOC_BEST_FIT, search);
+    }
+    return;
+  }
+  size_t firstFitSearch = adaptivePolicy.firstFitSearch;
+  if (search > firstFitSearch + firstFitSearch / 4) {
+    if (adaptivePolicy.probeLimit == 0) {
+      adaptivePolicy.probeLimit = ADAPTIVE_MAX_PROBES;
+    } else if (adaptivePolicy.probeLimit > ADAPTIVE_MIN_PROBES) {
+      adaptivePolicy.probeLimit /= 2;
+    } else if (settled && fragmentation <= ADAPTIVE_FRAG_HIGH) {
+      switchPolicy(MY_MALLOC_FIRST_FIT, search);
+    }
+  } else if (search < firstFitSearch && adaptivePolicy.probeLimit != 0) {
+    adaptivePolicy.probeLimit *= 2;
+    if (adaptivePolicy.probeLimit > ADAPTIVE_MAX_PROBES) {
+      adaptivePolicy.probeLimit = 0;
+    }
+  } else if (fragmentation < ADAPTIVE_FRAG_LOW && adaptivePolicy.epochsSinceSwitch >= adaptivePolicy.retryEpochs) {
+    switchPolicy(MY_MALLOC_FIRST_FIT, search);
+    adaptivePolicy.retrying = true;
+  }
+}
+
+MemoryBlock * adaptiveFindFit(FreeList * list, size_t size) {
+#ifdef USE_FREE_INDEX
+  MemoryBlock * block = adaptivePolicy.policy == MY_MALLOC_FIRST_FIT
+    ? freeIndexFirstFit(&list->index, size, &adaptivePolicy.visited)
+    : freeIndexBestFit(&list->index, size, &adaptivePolicy.visited);
+#else
+  size_t probeLimit = adaptivePolicy.policy == MY_MALLOC_FIRST_FIT ? 1 : adaptivePolicy.probeLimit;
+  MemoryBlock * block = findBoundedBestFit(list->head, size, probeLimit, &adaptivePolicy.visited);
+#endif
+  if (++adaptivePolicy.calls == ADAPTIVE_EPOCH) {
+    endEpoch();
+  }
+  return block;
+}
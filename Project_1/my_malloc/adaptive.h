@@ -0,0 +1,95 @@
+#ifndef __MY_MALLOC_ADAPTIVE__
+#define __MY_MALLOC_ADAPTIVE__
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Self-tuning fit policy for ad_malloc().
+ *
+ * First fit and best fit are the two ends of one search: walk the
+ * address-ordered free list and, after the first block that fits, keep
+ * comparing up to probeLimit - 1 further fitting blocks (or stop at an
+ * exact fit). A limit of 1 is first fit, 0 is unbounded best fit.
+ *
+ * Every ADAPTIVE_EPOCH calls the controller looks at the mean number of
+ * free blocks visited per call and at the free-space ratio of the data
+ * segment (the fragmentation figure the test programs report):
+ *  - first fit moves to best fit once fragmentation exceeds
+ *    ADAPTIVE_FRAG_HIGH, or once its search exceeds ADAPTIVE_SEARCH_HIGH
+ *    and is more than 25% longer than best fit's when that was last left
+ *    (small leftovers piling up at the head of the list, which best fit
+ *    avoids creating);
+ *  - under best fit, a search more than 25% longer than first fit's when
+ *    it was left tightens the probe limit (unbounded, ADAPTIVE_MAX_PROBES,
+ *    then halving to ADAPTIVE_MIN_PROBES) and, at the minimum, returns to
+ *    first fit unless fragmentation is above ADAPTIVE_FRAG_HIGH; a shorter
+ *    search loosens it again;
+ *  - with fragmentation below ADAPTIVE_FRAG_LOW, best fit retries first
+ *    fit every ADAPTIVE_RETRY epochs in case the workload has changed. A
+ *    retry that is abandoned within ADAPTIVE_DWELL epochs doubles the wait
+ *    before the next one.
+ * No policy change is made within ADAPTIVE_DWELL epochs of the previous
+ * one, so the policy cannot oscillate faster than that.
+ *
+ * With -DUSE_FREE_INDEX the searches go through the free index instead and
+ * the search length is the number of index entries examined. Best fit
+ * there always scans the whole index (unless it meets an exact fit) and
+ * ignores the probe limit, so tightening the limit only counts down the
+ * epochs before it returns to first fit.
+ *
+ * The current policy, probe limit and number of switches are reported by
+ * my_malloc_stats().
+ */
+
+enum my_malloc_policy {
+  MY_MALLOC_FIRST_FIT,
+  MY_MALLOC_BEST_FIT
+};
+
+#ifndef ADAPTIVE_EPOCH
+#define ADAPTIVE_EPOCH        4096   /* ad_malloc calls between decisions */
+#endif
+#define ADAPTIVE_FRAG_HIGH    0.30
+#define ADAPTIVE_FRAG_LOW     0.10
+#define ADAPTIVE_SEARCH_HIGH  256    /* mean free blocks visited per call */
+#define ADAPTIVE_MIN_PROBES   4
+#define ADAPTIVE_MAX_PROBES   256
+#define ADAPTIVE_DWELL        4      /* epochs */
+#define ADAPTIVE_RETRY        64     /* epochs; doubled up to 1024 on failed retries */
+#define ADAPTIVE_MAX_RETRY    1024
+
+struct AdaptivePolicy {
+  enum my_malloc_policy policy;
+  size_t probeLimit;            /* under best fit; 0 means the whole list */
+  size_t calls;                 /* in the current epoch */
+  size_t visited;               /* free blocks visited in the current epoch */
+  size_t firstFitSearch;        /* mean search of first fit when it was last left */
+  size_t bestFitSearch;         /* likewise for best fit; 0 until it has run */
+  unsigned epochsSinceSwitch;
+  unsigned retryEpochs;
+  bool retrying;                /* back on first fit to re-measure it */
+};
+
+extern struct AdaptivePolicy adaptivePolicy;
+
+struct MemoryBlock;
+struct FreeList;
+
+/*
+ * @brief Searches the free list from curr, keeping the smallest of the first
+ * probeLimit blocks that fit.
+ * @param probeLimit: Fitting blocks to compare; 1 is first fit, 0 best fit.
+ * @param visited: Incremented by the number of blocks walked.
+ * @return The chosen block, or NULL if none fits.
+ */
+struct MemoryBlock * findBoundedBestFit(struct MemoryBlock * curr, size_t size, size_t probeLimit,
+                                        size_t * visited);
+
+/*
+ * @brief Finds a free block for ad_malloc under the current policy and runs
+ * the controller at the end of each epoch.
+ * @return The chosen block, or NULL if the heap has to grow.
+ */
+struct MemoryBlock * adaptiveFindFit(struct FreeList * list, size_t size);
+
+#endif
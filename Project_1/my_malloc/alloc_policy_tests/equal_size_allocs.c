@@ -15,6 +15,10 @@
 #define MALLOC(sz) bf_malloc(sz)
 #define FREE(p)    bf_free(p)
 #endif 
+#ifdef AD
+#define MALLOC(sz) ad_malloc(sz)
+#define FREE(p)    ad_free(p)
+#endif
     
        
 double calc_time(struct timespec start, struct timespec end) {
@@ -0,0 +1,122 @@
+#include "my_malloc.h"
+#include "async_free.h"
+#include <stdatomic.h>
+#include <time.h>
+
+extern FreeList freeList;
+extern FreeList longLivedList;
+
+bool asyncFreeRunning = false;
+pthread_mutex_t heapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic(MemoryBlock *) pendingFrees = NULL;   /* linked through next */
+static atomic_bool stopping = false;
+static pthread_t drainer;
+
+void asyncFreePush(MemoryBlock * block) {
+  MemoryBlock * head = atomic_load_explicit(&pendingFrees, memory_order_relaxed);
+  do {
+    block->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&pendingFrees, &head, block,
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+/*
+ * @brief Merges two address-ordered lists linked through next.
+ */
+static MemoryBlock * mergeByAddress(MemoryBlock * left, MemoryBlock * right) {
+  MemoryBlock * head = NULL;
+  MemoryBlock ** tail = &head;
+  while (left != NULL && right != NULL) {
+    MemoryBlock ** lower = left < right ? &left : &right;
+    *tail = *lower;
+    tail = &(*lower)->next;
+    *lower = (*lower)->next;
+  }
+  *tail = left != NULL ? left : right;
+  return head;
+}
+
+/*
+ * @brief Sorts a list linked through next by address (merge sort).
+ */
+static MemoryBlock * sortByAddress(MemoryBlock * list) {
+  if (list == NULL || list->next == NULL) {
+    return list;
+  }
+  MemoryBlock * slow = list;
+  MemoryBlock * fast = list->next;
+  while (fast != NULL && fast->next != NULL) {
+    slow = slow->next;
+    fast = fast->next->next;
+  }
+  MemoryBlock * second = slow->next;
+  slow->next = NULL;
+  return mergeByAddress(sortByAddress(list), sortByAddress(second));
+}
+
+/*
+ * @brief Frees every pending block. Sorted, each block's place in its
+ * region's free list is found by walking on from where the previous one
+ * went, so the batch costs one pass up the list rather than one per block.
+ */
+static void drainPending() {
+  MemoryBlock * batch = atomic_exchange_explicit(&pendingFrees, NULL, memory_order_acquire);
+  if (batch == NULL) {
+    return;
+  }
+  batch = sortByAddress(batch);
+  pthread_mutex_lock(&heapMutex);
+  MemoryBlock * below[2] = {NULL, NULL};   /* per region */
+  while (batch != NULL) {
+    MemoryBlock * block = batch;
+    batch = batch->next;
+    heap_stats.freeCalls++;
+    if (block->sampled) {
+      profileFreed(block + 1);
+    }
+    below[block->region] = insertFreedBlock(block, below[block->region]);
+  }
+  trimHeap(&freeList);
+  trimHeap(&longLivedList);
+  pthread_mutex_unlock(&heapMutex);
+}
+
+static void * drainLoop(void * unused) {
+  (void)unused;
+  struct timespec interval = {
+    .tv_sec = ASYNC_FREE_INTERVAL_US / 1000000,
+    .tv_nsec = ASYNC_FREE_INTERVAL_US % 1000000 * 1000
+  };
+  while (!atomic_load(&stopping)) {
+    nanosleep(&interval, NULL);
+    drainPending();
+  }
+  return NULL;
+}
+
+int my_malloc_async_free_start() {
+  if (asyncFreeRunning) {
+    return 0;
+  }
+  atomic_store(&stopping, false);
+  if (pthread_create(&drainer, NULL, drainLoop, NULL) != 0) {
+    return -1;
+  }
+  asyncFreeRunning = true;
+  return 0;
+}
+
+void my_malloc_async_free_stop() {
+  if (!asyncFreeRunning) {
+    return;
+  }
+  atomic_store(&stopping, true);
+  pthread_join(drainer, NULL);
+  drainPending();
+  asyncFreeRunning = false;
+}
+
+void my_malloc_async_free_flush() {
+  drainPending();
+}
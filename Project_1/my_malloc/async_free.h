@@ -0,0 +1,79 @@
+#ifndef __MY_MALLOC_ASYNC_FREE__
+#define __MY_MALLOC_ASYNC_FREE__
+#include <pthread.h>
+#include <stdbool.h>
+
+struct MemoryBlock;
+
+/*
+ * Asynchronous free.
+ *
+ * Freeing a block means finding its place in the address-ordered free
+ * list, coalescing it and maybe trimming the heap, all on the caller's
+ * time. Between my_malloc_async_free_start() and
+ * my_malloc_async_free_stop(), ff_free (and so bf_free, ad_free and hfree)
+ * only marks the block free and pushes it onto a lock-free stack, linked
+ * through the block's own next pointer: one compare-and-swap. A
+ * background thread wakes every ASYNC_FREE_INTERVAL_US, takes the whole
+ * stack with one exchange, sorts it by address and frees the batch in
+ * one pass up each region's free list, coalescing as it goes, then trims
+ * the heap once.
+ *
+ * The drainer and the allocating thread share the free lists, so while
+ * async free is on, every entry point that reads or changes them (the
+ * malloc functions, malloc_hint, hcompact, my_malloc_reserve,
+ * my_malloc_stats and my_malloc_snapshot) takes heapMutex. Uncontended,
+ * that is one atomic operation per call. Blocks freed since the last
+ * pass are not reusable yet, so the heap can grow by up to an interval's
+ * worth of frees more than it would otherwise; my_malloc_async_free_flush()
+ * frees them right away.
+ *
+ * The allocator is still meant to be called from one thread; the
+ * background thread is the only other one.
+ */
+
+#ifndef ASYNC_FREE_INTERVAL_US
+#define ASYNC_FREE_INTERVAL_US 1000   /* between drains of the pending frees */
+#endif
+
+/*
+ * @brief Starts the background thread; frees are asynchronous from here on.
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+int my_malloc_async_free_start();
+
+/*
+ * @brief Frees everything pending and stops the background thread.
+ */
+void my_malloc_async_free_stop();
+
+/*
+ * @brief Frees everything pending now, on the calling thread.
+ */
+void my_malloc_async_free_flush();
+
+/*
+ * Internal bookkeeping shared with my_malloc.c, handles.c, snapshot.c and
+ * stats.c.
+ */
+extern bool asyncFreeRunning;
+extern pthread_mutex_t heapMutex;
+
+/*
+ * @brief Pushes an allocated block onto the pending stack.
+ */
+void asyncFreePush(struct MemoryBlock * block);
+
+static inline void asyncFreeLock() {
+  if (asyncFreeRunning) {
+    pthread_mutex_lock(&heapMutex);
+  }
+}
+
+static inline void asyncFreeUnlock() {
+  if (asyncFreeRunning) {
+    pthread_mutex_unlock(&heapMutex);
+  }
+}
+
+#endif
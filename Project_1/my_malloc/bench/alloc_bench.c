@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "my_malloc.h"
+#include "workload.h"
+#include "perf_counters.h"
+
+/*
+ * Parameterized allocator benchmark.
+ *
+ *     alloc_bench [-a ff|bf|ad|ts_lock|ts_nolock|glibc] [-d dist] [-l live]
+ *                 [-i iters] [-t trials] [-w warmup] [-r seed] [-R bytes]
+ *                 [-A] [-p] [-q]
+ *
+ * The workload is the alloc_policy_tests churn: fill a live set of -l
+ * objects, then per iteration free a random live object and allocate a
+ * replacement. Sizes come from -d, any distribution workload.h parses;
+ * the default, chunks:32:4:16, is small_range_rand_allocs' distribution.
+ *
+ * After -w untimed warm-up trials, -t trials of -i iterations each are
+ * timed call by call. The output is CSV, one row per operation (malloc,
+ * free) plus one for both:
+ *
+ *     policy,dist,live,iters,trials,seed,op,mean_ns,median_ns,p99_ns,
+ *     trial_sd_ns,ci95_ns,peak_segment,fragmentation
+ *
+ * mean/median/p99 are over every timed call with the clock's own read cost
+ * subtracted. trial_sd_ns is the standard deviation of the per-trial means
+ * and ci95_ns the half-width of a 95% confidence interval on the mean.
+ * peak_segment and fragmentation (free space / segment) follow the
+ * alloc_policy_tests definitions; for glibc the segment is mallinfo2's
+ * arena + hblkhd. -q leaves out the header line so runs can be appended to
+ * one file.
+ *
+ * -R grows and prefaults the heap by that many bytes with
+ * my_malloc_reserve() before the live set is filled (ff, bf and ad only),
+ * so the first trials do not pay for page faults; compare it with -w 0.
+ *
+ * -A frees asynchronously (async_free.h; ff, bf and ad only): free only
+ * queues the block and a background thread does the list work.
+ *
+ * -p adds hardware counters (perf_counters.h), counted over the timed
+ * trials and reported per operation on the "all" row:
+ *
+ *     cycles,instructions,l1d_misses,llc_misses,dtlb_misses,branch_misses,
+ *     page_faults
+ *
+ * The counts of the same loop run with do-nothing malloc/free are
+ * subtracted, so the clock reads and bookkeeping do not show up. Counters
+ * the host cannot open are left empty; with none at all the run falls back
+ * to timing only.
+ */
+
+void * ad_malloc(size_t size) __attribute__((weak));
+void ad_free(void * ptr) __attribute__((weak));
+void * ts_malloc_lock(size_t size) __attribute__((weak));
+void ts_free_lock(void * ptr) __attribute__((weak));
+void * ts_malloc_nolock(size_t size) __attribute__((weak));
+void ts_free_nolock(void * ptr) __attribute__((weak));
+int my_malloc_reserve(size_t bytes, bool populate) __attribute__((weak));
+int my_malloc_async_free_start() __attribute__((weak));
+void my_malloc_async_free_flush() __attribute__((weak));
+
+typedef void * (*mallocFuncPtr)(size_t);
+typedef void (*freeFuncPtr)(void *);
+
+struct Allocator {
+  const char * name;
+  mallocFuncPtr allocate;
+  freeFuncPtr release;
+};
+
+struct Summary {
+  double mean;
+  double median;
+  double p99;
+  double trialSd;
+  double ci95;
+};
+
+static uint64_t rngState;
+
+static uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * @brief Median cost of one clock read, subtracted from every sample.
+ */
+static uint64_t timerOverhead() {
+  uint64_t best[101];
+  for (int i = 0; i < 101; i++) {
+    uint64_t start = nowNs();
+    uint64_t end = nowNs();
+    best[i] = end - start;
+  }
+  for (int i = 1; i < 101; i++) {
+    for (int j = i; j > 0 && best[j - 1] > best[j]; j--) {
+      uint64_t tmp = best[j];
+      best[j] = best[j - 1];
+      best[j - 1] = tmp;
+    }
+  }
+  return best[50];
+}
+
+static int compareSamples(const void * a, const void * b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void * mapArray(size_t bytes) {
+  void * memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+/*
+ * @brief Sorts samples in place and summarizes them together with the
+ * per-trial means.
+ */
+static struct Summary summarize(uint32_t * samples, size_t count, const double * trialMeans, int trials) {
+  struct Summary summary;
+  double sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  qsort(samples, count, sizeof(uint32_t), compareSamples);
+  summary.mean = sum / count;
+  summary.median = samples[count / 2];
+  summary.p99 = samples[(size_t)(count * 0.99)];
+  double trialSum = 0, trialSquares = 0;
+  for (int t = 0; t < trials; t++) {
+    trialSum += trialMeans[t];
+  }
+  for (int t = 0; t < trials; t++) {
+    double delta = trialMeans[t] - trialSum / trials;
+    trialSquares += delta * delta;
+  }
+  summary.trialSd = trials > 1 ? sqrt(trialSquares / (trials - 1)) : 0;
+  summary.ci95 = trials > 1 ? 1.96 * summary.trialSd / sqrt(trials) : 0;
+  return summary;
+}
+
+static void * nullAllocate(size_t size) {
+  return NULL;
+}
+
+static void nullRelease(void * ptr) {
+}
+
+/*
+ * @brief One trial: iters replacements of a random live object, each free
+ * and malloc timed separately.
+ */
+static void churn(const struct Allocator * allocator, void ** objects, size_t live, size_t iters,
+                  const struct SizeDist * dist, uint64_t overhead,
+                  uint32_t * mallocTrial, uint32_t * freeTrial, double * mallocSum, double * freeSum) {
+  *mallocSum = 0;
+  *freeSum = 0;
+  for (size_t i = 0; i < iters; i++) {
+    size_t slot = workloadRandom(&rngState) % live;
+    size_t size = drawSize(dist, &rngState);
+    uint64_t start = nowNs();
+    allocator->release(objects[slot]);
+    uint64_t middle = nowNs();
+    objects[slot] = allocator->allocate(size);
+    uint64_t end = nowNs();
+    uint64_t freeNs = middle - start > overhead ? middle - start - overhead : 0;
+    uint64_t mallocNs = end - middle > overhead ? end - middle - overhead : 0;
+    freeTrial[i] = freeNs > UINT32_MAX ? UINT32_MAX : (uint32_t)freeNs;
+    mallocTrial[i] = mallocNs > UINT32_MAX ? UINT32_MAX : (uint32_t)mallocNs;
+    *freeSum += freeTrial[i];
+    *mallocSum += mallocTrial[i];
+  }
+}
+
+/*
+ * @brief Adds the counts of the current start/stop window to totals.
+ */
+static void accumulateCounters(struct PerfCounters * counters, uint64_t totals[PERF_NUM_COUNTERS],
+                               int available[PERF_NUM_COUNTERS]) {
+  uint64_t values[PERF_NUM_COUNTERS];
+  perfCountersRead(counters, values, available);
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+    totals[c] += values[c];
+  }
+}
+
+static void segmentUsage(int glibc, size_t * segment, size_t * freeSpace) {
+  if (glibc) {
+    struct mallinfo2 info = mallinfo2();
+    *segment = info.arena + info.hblkhd;
+    *freeSpace = info.fordblks;
+  } else {
+    if (my_malloc_async_free_flush != NULL) {
+      my_malloc_async_free_flush();   /* count frees still queued as free space */
+    }
+    *segment = get_data_segment_size();
+    *freeSpace = get_data_segment_free_space_size();
+  }
+}
+
+static void usage(const char * program) {
+  fprintf(stderr, "usage: %s [-a ff|bf|ad|ts_lock|ts_nolock|glibc] [-d dist] [-l live] [-i iters] "
+                  "[-t trials] [-w warmup] [-r seed] [-R bytes] [-A] [-p] [-q]\n", program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  struct Allocator allocators[] = {
+    {"ff", ff_malloc, ff_free},
+    {"bf", bf_malloc, bf_free},
+    {"ad", ad_malloc, ad_free},
+    {"ts_lock", ts_malloc_lock, ts_free_lock},
+    {"ts_nolock", ts_malloc_nolock, ts_free_nolock},
+    {"glibc", malloc, free},
+  };
+  const char * name = "ff";
+  const char * distSpec = "chunks:32:4:16";
+  size_t live = 10000;
+  size_t iters = 1000000;
+  int trials = 10;
+  int warmup = 2;
+  uint64_t seed = 1;
+  size_t reserve = 0;
+  int asynchronous = 0;
+  int header = 1;
+  int counting = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:d:l:i:t:w:r:R:Apq")) != -1) {
+    switch (opt) {
+      case 'a': name = optarg; break;
+      case 'd': distSpec = optarg; break;
+      case 'l': live = strtoul(optarg, NULL, 10); break;
+      case 'i': iters = strtoul(optarg, NULL, 10); break;
+      case 't': trials = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'r': seed = strtoull(optarg, NULL, 10); break;
+      case 'R': reserve = strtoul(optarg, NULL, 10); break;
+      case 'A': asynchronous = 1; break;
+      case 'p': counting = 1; break;
+      case 'q': header = 0; break;
+      default: usage(argv[0]);
+    }
+  }
+  struct SizeDist dist;
+  if (optind != argc || !parseSizeDist(distSpec, &dist) || live == 0 || iters == 0 || trials < 1 || warmup < 0) {
+    usage(argv[0]);
+  }
+  struct Allocator * allocator = NULL;
+  for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+    if (strcmp(allocators[i].name, name) == 0) {
+      allocator = &allocators[i];
+    }
+  }
+  if (allocator == NULL) {
+    usage(argv[0]);
+  }
+  if (allocator->allocate == NULL || allocator->release == NULL) {
+    fprintf(stderr, "%s: this build's library has no %s entry points\n", argv[0], name);
+    return EXIT_FAILURE;
+  }
+  int glibc = allocator->allocate == malloc;
+  int singleThreaded = allocator->allocate == ff_malloc || allocator->allocate == bf_malloc
+                       || allocator->allocate == ad_malloc;
+  if (reserve > 0 && (!singleThreaded || my_malloc_reserve == NULL || my_malloc_reserve(reserve, true) != 0)) {
+    fprintf(stderr, "%s: cannot reserve %zu bytes for %s\n", argv[0], reserve, name);
+    return EXIT_FAILURE;
+  }
+  if (asynchronous && (!singleThreaded || my_malloc_async_free_start == NULL || my_malloc_async_free_start() != 0)) {
+    fprintf(stderr, "%s: cannot free asynchronously with %s\n", argv[0], name);
+    return EXIT_FAILURE;
+  }
+  rngState = seed != 0 ? seed : 1;
+
+  /* Bookkeeping lives outside the heap being measured. */
+  void ** objects = mapArray(live * sizeof(void *));
+  uint32_t * mallocSamples = mapArray(iters * trials * sizeof(uint32_t));
+  uint32_t * freeSamples = mapArray(iters * trials * sizeof(uint32_t));
+  uint32_t * allSamples = mapArray(2 * iters * trials * sizeof(uint32_t));
+  double * mallocMeans = mapArray(trials * sizeof(double));
+  double * freeMeans = mapArray(trials * sizeof(double));
+  double * allMeans = mapArray(trials * sizeof(double));
+  uint64_t overhead = timerOverhead();
+
+  for (size_t i = 0; i < live; i++) {
+    objects[i] = allocator->allocate(drawSize(&dist, &rngState));
+  }
+  struct PerfCounters counters;
+  uint64_t counts[PERF_NUM_COUNTERS] = {0}, nullCounts[PERF_NUM_COUNTERS] = {0};
+  int available[PERF_NUM_COUNTERS] = {0};
+  if (counting && perfCountersOpen(&counters) == 0) {
+    fprintf(stderr, "%s: perf events unavailable, timing only\n", argv[0]);
+    counting = 0;
+  }
+
+  size_t peakSegment = 0, segment = 0, freeSpace = 0;
+  for (int t = -warmup; t < trials; t++) {
+    double mallocSum, freeSum;
+    if (counting && t >= 0) {
+      perfCountersStart(&counters);
+    }
+    churn(allocator, objects, live, iters, &dist, overhead,
+          mallocSamples + (t >= 0 ? t : 0) * iters, freeSamples + (t >= 0 ? t : 0) * iters,
+          &mallocSum, &freeSum);
+    if (counting && t >= 0) {
+      perfCountersStop(&counters);
+      accumulateCounters(&counters, counts, available);
+    }
+    segmentUsage(glibc, &segment, &freeSpace);
+    if (segment > peakSegment) {
+      peakSegment = segment;
+    }
+    if (t >= 0) {
+      mallocMeans[t] = mallocSum / iters;
+      freeMeans[t] = freeSum / iters;
+      allMeans[t] = (mallocSum + freeSum) / (2 * iters);
+    }
+  }
+  double fragmentation = segment > 0 ? (double)freeSpace / segment : 0;
+
+  size_t count = iters * trials;
+  if (counting) {
+    /* Same loop, same bookkeeping, no allocator: the baseline to subtract. */
+    struct Allocator none = {"none", nullAllocate, nullRelease};
+    void ** scratch = mapArray(live * sizeof(void *));
+    for (int t = 0; t < trials; t++) {
+      double mallocSum, freeSum;
+      perfCountersStart(&counters);
+      churn(&none, scratch, live, iters, &dist, overhead, allSamples, allSamples + iters, &mallocSum, &freeSum);
+      perfCountersStop(&counters);
+      accumulateCounters(&counters, nullCounts, available);
+    }
+    perfCountersClose(&counters);
+  }
+
+  memcpy(allSamples, mallocSamples, count * sizeof(uint32_t));
+  memcpy(allSamples + count, freeSamples, count * sizeof(uint32_t));
+  struct Summary rows[3] = {
+    summarize(mallocSamples, count, mallocMeans, trials),
+    summarize(freeSamples, count, freeMeans, trials),
+    summarize(allSamples, 2 * count, allMeans, trials),
+  };
+  const char * ops[3] = {"malloc", "free", "all"};
+  if (header) {
+    printf("policy,dist,live,iters,trials,seed,op,mean_ns,median_ns,p99_ns,trial_sd_ns,ci95_ns,peak_segment,fragmentation");
+    for (int c = 0; counting && c < PERF_NUM_COUNTERS; c++) {
+      printf(",%s", perfCounterNames[c]);
+    }
+    printf("\n");
+  }
+  for (int r = 0; r < 3; r++) {
+    printf("%s,%s,%zu,%zu,%d,%lu,%s,%.1f,%.1f,%.1f,%.2f,%.2f,%zu,%.4f",
+           name, distSpec, live, iters, trials, (unsigned long)seed, ops[r],
+           rows[r].mean, rows[r].median, rows[r].p99, rows[r].trialSd, rows[r].ci95,
+           peakSegment, fragmentation);
+    for (int c = 0; counting && c < PERF_NUM_COUNTERS; c++) {
+      if (r == 2 && available[c]) {
+        double net = counts[c] > nullCounts[c] ? (double)(counts[c] - nullCounts[c]) : 0;
+        printf(",%.3f", net / (2 * count));
+      } else {
+        printf(",");
+      }
+    }
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
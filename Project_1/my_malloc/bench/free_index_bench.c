@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "my_malloc.h"
+
+/*
+ * Compares fit searches over a pointer-linked free list against the dense
+ * FreeIndex size scan kernels, for free lists of 10^3 to 10^6 blocks.
+ *
+ * The linked list is laid out the way the heap lays it out: blocks in address
+ * order, each separated from the next by its payload, so every hop touches a
+ * new cache line. The requested size is larger than every free block, which
+ * forces a full scan in both policies (the worst case malloc pays before
+ * falling back to sbrk).
+ */
+
+#define NODE_STRIDE  128
+#define MIN_SIZE     32
+#define MAX_SIZE     65536
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+volatile size_t sink;
+
+typedef size_t (*scan_fn)(const size_t * sizes, size_t count, size_t size);
+
+double time_kernel(scan_fn fn, const size_t * sizes, size_t count, size_t size, int reps) {
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (int r = 0; r < reps; r++) {
+    sink = fn(sizes, count, size);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / reps;
+}
+
+double time_list(MemoryBlock * head, size_t size, int reps, bool best) {
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (int r = 0; r < reps; r++) {
+    sink = (size_t)(best ? findBestFit(head, size) : findFirstFit(head, size));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / reps;
+}
+
+/*
+ * Checks every vector kernel against the scalar one on random size arrays,
+ * for random requests and the edges of the signed lane compare (requests of
+ * 2^63 bytes and more must fit nothing), and checks that ff_malloc and
+ * bf_malloc turn such a request down even with a free block available.
+ * @return The number of mismatches.
+ */
+int check_kernels(bool have_sse42, bool have_avx2) {
+  size_t edges[] = { 0, 1, MIN_SIZE, MAX_SIZE, MAX_SIZE + 1, (size_t)INT64_MAX,
+                     (size_t)INT64_MAX + 1, ((size_t)1 << 63) + 5, SIZE_MAX };
+  size_t nedges = sizeof(edges) / sizeof(edges[0]);
+  size_t sizes[1000];
+  int failures = 0;
+
+  for (int trial = 0; trial < 200; trial++) {
+    size_t count = (size_t)(rand() % 1000);
+    for (size_t i = 0; i < count; i++) {
+      sizes[i] = rand() % 8 == 0 ? 0 : ((rand() % ((MAX_SIZE - MIN_SIZE) / 32 + 1)) * 32) + MIN_SIZE;
+    }
+    for (size_t e = 0; e < nedges + 16; e++) {
+      size_t request = e < nedges ? edges[e] : (size_t)(rand() % (MAX_SIZE + 64));
+      for (int best = 0; best <= 1; best++) {
+        scan_fn kernels[] = { best ? scanBestFitSse42 : scanFirstFitSse42, best ? scanBestFitAvx2 : scanFirstFitAvx2 };
+        bool have[] = { have_sse42, have_avx2 };
+        size_t expected = (best ? scanBestFitScalar : scanFirstFitScalar)(sizes, count, request);
+        for (int k = 0; k < 2; k++) {
+          if (have[k] && kernels[k](sizes, count, request) != expected) {
+            printf("kernel %d %s disagrees with scalar for request %zu over %zu blocks\n",
+                   k, best ? "BF" : "FF", request, count);
+            failures++;
+          }
+        }
+      }
+    }
+  }
+
+  void * free_block = ff_malloc(100);
+  ff_free(free_block);
+  if (ff_malloc(((size_t)1 << 63) + 5) != NULL || bf_malloc(((size_t)1 << 63) + 5) != NULL) {
+    printf("a request of 2^63 + 5 bytes was satisfied\n");
+    failures++;
+  }
+  return failures;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t counts[] = { 1000, 10000, 100000, 1000000 };
+  bool have_sse42 = __builtin_cpu_supports("sse4.2");
+  bool have_avx2 = __builtin_cpu_supports("avx2");
+
+  srand(0);
+  printf("kernel selected by dispatcher: %s\n", freeIndexKernelName());
+  if (check_kernels(have_sse42, have_avx2) != 0) {
+    printf("kernel check failed\n");
+    return EXIT_FAILURE;
+  }
+  printf("kernels agree with the scalar scan\n");
+  printf("%-8s %-6s %12s %12s %12s %12s\n", "blocks", "policy", "list(ns)", "scalar(ns)", "sse4.2(ns)", "avx2(ns)");
+
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    size_t count = counts[c];
+    int reps = count >= 1000000 ? 5 : (int)(50000000 / count);
+    char * arena = malloc(count * NODE_STRIDE);
+    size_t * sizes = malloc(count * sizeof(size_t));
+    if (arena == NULL || sizes == NULL) {
+      fprintf(stderr, "out of memory for %zu blocks\n", count);
+      return EXIT_FAILURE;
+    }
+
+    MemoryBlock * prev = NULL;
+    for (size_t i = 0; i < count; i++) {
+      MemoryBlock * block = (MemoryBlock *)(arena + i * NODE_STRIDE);
+      sizes[i] = ((rand() % ((MAX_SIZE - MIN_SIZE) / 32 + 1)) * 32) + MIN_SIZE;
+      block->dataSize = sizes[i];
+      block->allocated = false;
+      block->prev = prev;
+      block->next = NULL;
+      if (prev != NULL) {
+        prev->next = block;
+      }
+      prev = block;
+    }
+    MemoryBlock * head = (MemoryBlock *)arena;
+    size_t request = MAX_SIZE + 1;
+
+    for (int best = 0; best <= 1; best++) {
+      double list_ns = time_list(head, request, reps, best);
+      double scalar_ns = time_kernel(best ? scanBestFitScalar : scanFirstFitScalar, sizes, count, request, reps);
+      double sse_ns = have_sse42 ? time_kernel(best ? scanBestFitSse42 : scanFirstFitSse42, sizes, count, request, reps) : 0;
+      double avx_ns = have_avx2 ? time_kernel(best ? scanBestFitAvx2 : scanFirstFitAvx2, sizes, count, request, reps) : 0;
+      printf("%-8zu %-6s %12.0f %12.0f %12.0f %12.0f\n", count, best ? "BF" : "FF", list_ns, scalar_ns, sse_ns, avx_ns);
+    }
+
+    free(sizes);
+    free(arena);
+  }
+
+  return 0;
+}
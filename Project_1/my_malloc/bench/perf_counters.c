@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+const char * perfCounterNames[PERF_NUM_COUNTERS] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses", "page_faults"
+};
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[PERF_NUM_COUNTERS] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+int perfCountersOpen(struct PerfCounters * counters) {
+  int opened = 0;
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counters->fds[i] >= 0) {
+      opened++;
+    }
+  }
+  return opened;
+}
+
+void perfCountersStart(struct PerfCounters * counters) {
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+    if (counters->fds[i] >= 0) {
+      ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void perfCountersStop(struct PerfCounters * counters) {
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+    if (counters->fds[i] >= 0) {
+      ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+void perfCountersRead(struct PerfCounters * counters, uint64_t values[PERF_NUM_COUNTERS],
+                      int available[PERF_NUM_COUNTERS]) {
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+    uint64_t data[3];   /* value, time enabled, time running */
+    values[i] = 0;
+    available[i] = 0;
+    if (counters->fds[i] < 0 || read(counters->fds[i], data, sizeof(data)) != sizeof(data)) {
+      continue;
+    }
+    available[i] = 1;
+    if (data[2] > 0 && data[2] < data[1]) {
+      values[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+    } else {
+      values[i] = data[0];
+    }
+  }
+}
+
+void perfCountersClose(struct PerfCounters * counters) {
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+    if (counters->fds[i] >= 0) {
+      close(counters->fds[i]);
+      counters->fds[i] = -1;
+    }
+  }
+}
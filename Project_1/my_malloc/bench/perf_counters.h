@@ -0,0 +1,57 @@
+#ifndef __MY_MALLOC_PERF_COUNTERS__
+#define __MY_MALLOC_PERF_COUNTERS__
+#include <stdint.h>
+
+/*
+ * Thin wrapper over perf_event_open(2) for the benchmarks.
+ *
+ * Each counter is opened on its own rather than as a group, so a counter
+ * the host does not support (common in VMs and containers, or with
+ * perf_event_paranoid > 2) is simply marked unavailable while the others
+ * still count. Counts are user-space only and scaled for multiplexing.
+ */
+
+enum perfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_PAGE_FAULTS,
+  PERF_NUM_COUNTERS
+};
+
+struct PerfCounters {
+  int fds[PERF_NUM_COUNTERS];   /* -1 where the counter could not be opened */
+};
+
+extern const char * perfCounterNames[PERF_NUM_COUNTERS];
+
+/*
+ * @brief Opens every counter the host allows, disabled.
+ * @return Number of counters opened; 0 means timing only.
+ */
+int perfCountersOpen(struct PerfCounters * counters);
+
+/*
+ * @brief Resets and enables the open counters.
+ */
+void perfCountersStart(struct PerfCounters * counters);
+
+/*
+ * @brief Disables the open counters.
+ */
+void perfCountersStop(struct PerfCounters * counters);
+
+/*
+ * @brief Reads the counts since the last start.
+ * @param values: Filled with one count per counter; unavailable ones read 0.
+ * @param available: Set to 1 for counters that are open, 0 otherwise.
+ */
+void perfCountersRead(struct PerfCounters * counters, uint64_t values[PERF_NUM_COUNTERS],
+                      int available[PERF_NUM_COUNTERS]);
+
+void perfCountersClose(struct PerfCounters * counters);
+
+#endif
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "my_malloc.h"
+
+/*
+ * Message passing between two processes, copied versus handed off.
+ *
+ *     shm_bench [-n messages] [-s size] [-H heap]
+ *
+ * A producer sends -n messages of -s bytes to a consumer it forks, which
+ * reads every byte of each one. "copy" writes the payload through a Unix
+ * socket, the way the services do today. "shm" allocates the payload in a
+ * shared heap of -H bytes (shm_heap.h), which the consumer attaches to on
+ * its own (so at a different address), and sends only the 8-byte offset;
+ * the consumer reads the payload in place and frees it. Both fill the
+ * payload once in the producer and sum it once in the consumer, so the
+ * difference is the copy through the kernel.
+ *
+ * Prints one line per mode: seconds, messages/s and payload GB/s.
+ */
+
+static double nowSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void writeAll(int fd, const void * buffer, size_t bytes) {
+  const char * p = buffer;
+  while (bytes > 0) {
+    ssize_t n = write(fd, p, bytes);
+    if (n <= 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    p += n;
+    bytes -= n;
+  }
+}
+
+static int readAll(int fd, void * buffer, size_t bytes) {
+  char * p = buffer;
+  while (bytes > 0) {
+    ssize_t n = read(fd, p, bytes);
+    if (n <= 0) {
+      return 0;
+    }
+    p += n;
+    bytes -= n;
+  }
+  return 1;
+}
+
+static void fill(void * payload, size_t size, uint64_t seq) {
+  uint64_t * words = payload;
+  for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+    words[i] = seq + i;
+  }
+}
+
+static uint64_t sum(const void * payload, size_t size) {
+  const uint64_t * words = payload;
+  uint64_t total = 0;
+  for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+    total += words[i];
+  }
+  return total;
+}
+
+static uint64_t consumeCopies(int sock, size_t size) {
+  void * buffer = malloc(size);
+  uint64_t total = 0;
+  while (readAll(sock, buffer, size)) {
+    total += sum(buffer, size);
+  }
+  free(buffer);
+  return total;
+}
+
+static uint64_t consumeHandoffs(int sock, int heapFd, size_t size) {
+  shm_heap_t heap;
+  if (shm_heap_attach_fd(&heap, heapFd) != 0) {
+    perror("shm_heap_attach_fd");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t total = 0;
+  uint64_t offset;
+  while (readAll(sock, &offset, sizeof(offset))) {
+    void * payload = shm_heap_pointer(&heap, offset);
+    total += sum(payload, size);
+    shm_heap_free(&heap, payload);
+  }
+  shm_heap_detach(&heap);
+  return total;
+}
+
+static void run(const char * mode, unsigned long messages, size_t size, size_t heapSize) {
+  int socks[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) != 0) {
+    perror("socketpair");
+    exit(EXIT_FAILURE);
+  }
+  int handoff = strcmp(mode, "shm") == 0;
+  shm_heap_t heap;
+  if (handoff && shm_heap_create(&heap, NULL, heapSize) != 0) {
+    perror("shm_heap_create");
+    exit(EXIT_FAILURE);
+  }
+
+  double start = nowSeconds();
+  pid_t child = fork();
+  if (child == 0) {
+    close(socks[0]);
+    uint64_t total = handoff ? consumeHandoffs(socks[1], heap.fd, size) : consumeCopies(socks[1], size);
+    writeAll(socks[1], &total, sizeof(total));
+    _exit(0);
+  }
+  close(socks[1]);
+
+  void * buffer = handoff ? NULL : malloc(size);
+  uint64_t expected = 0;
+  for (unsigned long seq = 0; seq < messages; seq++) {
+    void * payload = buffer;
+    if (handoff) {
+      while ((payload = shm_heap_malloc(&heap, size)) == NULL) {
+        sched_yield();   /* the heap is full of messages not consumed yet */
+      }
+    }
+    fill(payload, size, seq);
+    expected += sum(payload, size);
+    if (handoff) {
+      uint64_t offset = shm_heap_offset(&heap, payload);
+      writeAll(socks[0], &offset, sizeof(offset));
+    } else {
+      writeAll(socks[0], payload, size);
+    }
+  }
+  shutdown(socks[0], SHUT_WR);
+  uint64_t total = 0;
+  readAll(socks[0], &total, sizeof(total));
+  waitpid(child, NULL, 0);
+  double elapsed = nowSeconds() - start;
+
+  printf("%-4s messages = %lu, size = %zu, time = %f seconds, %.0f messages/s, %.2f GB/s%s\n",
+         mode, messages, size, elapsed, messages / elapsed, messages * (double)size / elapsed / 1e9,
+         total == expected ? "" : " (checksum mismatch)");
+  close(socks[0]);
+  free(buffer);
+  if (handoff) {
+    shm_heap_detach(&heap);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long messages = 20000;
+  size_t size = 1 << 20;
+  size_t heapSize = 64 << 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:H:")) != -1) {
+    switch (opt) {
+    case 'n': messages = strtoul(optarg, NULL, 10); break;
+    case 's': size = strtoul(optarg, NULL, 10); break;
+    case 'H': heapSize = strtoul(optarg, NULL, 10); break;
+    default:
+      fprintf(stderr, "usage: %s [-n messages] [-s size] [-H heap]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (size < sizeof(uint64_t) || size + 256 > heapSize) {
+    fprintf(stderr, "size must be at least 8 bytes and fit in the heap\n");
+    return EXIT_FAILURE;
+  }
+  run("copy", messages, size, heapSize);
+  run("shm", messages, size, heapSize);
+  return 0;
+}
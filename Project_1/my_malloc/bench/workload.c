@@ -0,0 +1,389 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "workload.h"
+
+static void * mapBytes(size_t bytes) {
+  void * memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? NULL : memory;
+}
+
+uint64_t workloadRandom(uint64_t * state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+/*
+ * @brief Uniform double in (0, 1].
+ */
+static double randomUnit(uint64_t * rng) {
+  return ((workloadRandom(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * @brief Turns weights[0..count) into a normalized CDF in place.
+ */
+static int normalize(double * weights, size_t count) {
+  double total = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (weights[i] < 0) {
+      return 0;
+    }
+    total += weights[i];
+    weights[i] = total;
+  }
+  if (total <= 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < count; i++) {
+    weights[i] /= total;
+  }
+  weights[count - 1] = 1.0;
+  return 1;
+}
+
+/*
+ * @brief Index of the first CDF entry at or above u.
+ */
+static size_t searchCumulative(const double * cumulative, size_t count, double u) {
+  size_t low = 0, high = count - 1;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (cumulative[mid] < u) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static int parseHistogramPairs(FILE * in, const char * text, struct SizeDist * dist) {
+  size_t capacity = 64;
+  size_t * sizes = mapBytes(capacity * sizeof(size_t));
+  double * weights = mapBytes(capacity * sizeof(double));
+  size_t count = 0;
+  const char * cursor = text;
+  while (sizes != NULL && weights != NULL) {
+    size_t size;
+    double weight;
+    if (in != NULL) {
+      if (fscanf(in, "%zu %lf", &size, &weight) != 2) {
+        break;
+      }
+    } else {
+      char * end;
+      size = strtoul(cursor, &end, 10);
+      if (end == cursor || *end != '=') {
+        return 0;
+      }
+      cursor = end + 1;
+      weight = strtod(cursor, &end);
+      if (end == cursor || (*end != '/' && *end != '\0')) {
+        return 0;
+      }
+      cursor = *end == '/' ? end + 1 : end;
+    }
+    if (size == 0) {
+      return 0;
+    }
+    if (count == capacity) {
+      size_t * moreSizes = mapBytes(2 * capacity * sizeof(size_t));
+      double * moreWeights = mapBytes(2 * capacity * sizeof(double));
+      if (moreSizes == NULL || moreWeights == NULL) {
+        return 0;
+      }
+      memcpy(moreSizes, sizes, capacity * sizeof(size_t));
+      memcpy(moreWeights, weights, capacity * sizeof(double));
+      munmap(sizes, capacity * sizeof(size_t));
+      munmap(weights, capacity * sizeof(double));
+      sizes = moreSizes;
+      weights = moreWeights;
+      capacity *= 2;
+    }
+    sizes[count] = size;
+    weights[count] = weight;
+    count++;
+    if (in == NULL && *cursor == '\0') {
+      break;
+    }
+  }
+  if (count == 0 || !normalize(weights, count)) {
+    return 0;
+  }
+  dist->kind = SIZE_EMPIRICAL;
+  dist->count = count;
+  dist->sizes = sizes;
+  dist->cumulative = weights;
+  return 1;
+}
+
+int parseSizeDist(const char * spec, struct SizeDist * dist) {
+  memset(dist, 0, sizeof(*dist));
+  double exponent;
+  if (sscanf(spec, "fixed:%zu", &dist->min) == 1) {
+    dist->kind = SIZE_FIXED;
+    return dist->min > 0;
+  }
+  if (sscanf(spec, "uniform:%zu:%zu", &dist->min, &dist->max) == 2) {
+    dist->kind = SIZE_UNIFORM;
+    return dist->min > 0 && dist->min <= dist->max;
+  }
+  if (sscanf(spec, "chunks:%zu:%zu:%zu", &dist->unit, &dist->min, &dist->max) == 3) {
+    dist->kind = SIZE_CHUNKS;
+    return dist->unit > 0 && dist->min > 0 && dist->min <= dist->max;
+  }
+  if (sscanf(spec, "zipf:%lf:%zu:%zu", &exponent, &dist->count, &dist->unit) == 3) {
+    if (exponent <= 0 || dist->count == 0 || dist->unit == 0) {
+      return 0;
+    }
+    dist->kind = SIZE_ZIPF;
+    dist->cumulative = mapBytes(dist->count * sizeof(double));
+    if (dist->cumulative == NULL) {
+      return 0;
+    }
+    for (size_t k = 0; k < dist->count; k++) {
+      dist->cumulative[k] = pow((double)(k + 1), -exponent);
+    }
+    return normalize(dist->cumulative, dist->count);
+  }
+  if (sscanf(spec, "lognormal:%lf:%lf:%zu", &dist->mu, &dist->sigma, &dist->max) == 3) {
+    dist->kind = SIZE_LOGNORMAL;
+    return dist->sigma >= 0 && dist->max > 0;
+  }
+  if (strncmp(spec, "hist:@", 6) == 0) {
+    FILE * in = fopen(spec + 6, "r");
+    if (in == NULL) {
+      return 0;
+    }
+    int parsed = parseHistogramPairs(in, NULL, dist);
+    fclose(in);
+    return parsed;
+  }
+  if (strncmp(spec, "hist:", 5) == 0) {
+    return parseHistogramPairs(NULL, spec + 5, dist);
+  }
+  return 0;
+}
+
+int parseLifetime(const char * spec, struct Lifetime * lifetime) {
+  lifetime->cohortFraction = 0;
+  if (strcmp(spec, "lifo") == 0) {
+    lifetime->kind = LIFETIME_LIFO;
+  } else if (strcmp(spec, "fifo") == 0) {
+    lifetime->kind = LIFETIME_FIFO;
+  } else if (strcmp(spec, "random") == 0) {
+    lifetime->kind = LIFETIME_RANDOM;
+  } else if (sscanf(spec, "cohort:%lf", &lifetime->cohortFraction) == 1) {
+    lifetime->kind = LIFETIME_COHORT;
+    return lifetime->cohortFraction >= 0 && lifetime->cohortFraction <= 1;
+  } else if (sscanf(spec, "pinned:%lf", &lifetime->cohortFraction) == 1) {
+    lifetime->kind = LIFETIME_PINNED;
+    return lifetime->cohortFraction >= 0 && lifetime->cohortFraction <= 1;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+int parsePhase(const char * spec, struct WorkloadPhase * phase) {
+  char buffer[1024];
+  if (strlen(spec) >= sizeof(buffer)) {
+    return 0;
+  }
+  strcpy(buffer, spec);
+  phase->ops = 1000000;
+  phase->live = 10000;
+  if (!parseSizeDist("chunks:32:4:16", &phase->size) || !parseLifetime("random", &phase->lifetime)) {
+    return 0;
+  }
+  for (char * field = strtok(buffer, ","); field != NULL; field = strtok(NULL, ",")) {
+    char * value = strchr(field, '=');
+    if (value == NULL) {
+      return 0;
+    }
+    *value++ = '\0';
+    if (strcmp(field, "ops") == 0) {
+      phase->ops = strtoul(value, NULL, 10);
+    } else if (strcmp(field, "live") == 0) {
+      phase->live = strtoul(value, NULL, 10);
+    } else if (strcmp(field, "size") == 0) {
+      if (!parseSizeDist(value, &phase->size)) {
+        return 0;
+      }
+    } else if (strcmp(field, "life") == 0) {
+      if (!parseLifetime(value, &phase->lifetime)) {
+        return 0;
+      }
+    } else {
+      return 0;
+    }
+  }
+  return phase->live > 0;
+}
+
+size_t drawSize(const struct SizeDist * dist, uint64_t * rng) {
+  switch (dist->kind) {
+    case SIZE_FIXED:
+      return dist->min;
+    case SIZE_UNIFORM:
+      return dist->min + workloadRandom(rng) % (dist->max - dist->min + 1);
+    case SIZE_CHUNKS:
+      return dist->unit * (dist->min + workloadRandom(rng) % (dist->max - dist->min + 1));
+    case SIZE_ZIPF:
+      return dist->unit * (searchCumulative(dist->cumulative, dist->count, randomUnit(rng)) + 1);
+    case SIZE_LOGNORMAL: {
+      double normal = sqrt(-2.0 * log(randomUnit(rng))) * cos(2.0 * M_PI * randomUnit(rng));
+      double size = exp(dist->mu + dist->sigma * normal);
+      if (size < 1) {
+        return 1;
+      }
+      return size >= (double)dist->max ? dist->max : (size_t)size;
+    }
+    case SIZE_EMPIRICAL:
+      return dist->sizes[searchCumulative(dist->cumulative, dist->count, randomUnit(rng))];
+  }
+  return 1;
+}
+
+int workloadInit(struct Workload * workload, uint64_t seed) {
+  /* Room for the largest live set plus everything earlier phases pinned. */
+  size_t capacity = 1;
+  size_t pinned = 0;
+  for (unsigned i = 0; i < workload->numPhases; i++) {
+    if (pinned + workload->phases[i].live + 1 > capacity) {
+      capacity = pinned + workload->phases[i].live + 1;
+    }
+    if (workload->phases[i].lifetime.kind == LIFETIME_PINNED) {
+      pinned += workload->phases[i].live;
+    }
+  }
+  workload->phase = 0;
+  workload->opsInPhase = 0;
+  workload->rng = seed != 0 ? seed : 1;
+  workload->capacity = capacity;
+  workload->ring = mapBytes(4 * capacity * sizeof(size_t));
+  if (workload->ring == NULL) {
+    return 0;
+  }
+  workload->cohort = workload->ring + capacity;
+  workload->pinned = workload->cohort + capacity;
+  workload->freeSlots = workload->pinned + capacity;
+  workload->ringStart = 0;
+  workload->ringCount = 0;
+  workload->cohortCount = 0;
+  workload->pinnedCount = 0;
+  workload->pinnedInPhase = 0;
+  for (size_t i = 0; i < capacity; i++) {
+    workload->freeSlots[i] = capacity - 1 - i;
+  }
+  workload->freeSlotCount = capacity;
+  return 1;
+}
+
+void workloadDestroy(struct Workload * workload) {
+  if (workload->ring != NULL) {
+    munmap(workload->ring, 4 * workload->capacity * sizeof(size_t));
+    workload->ring = NULL;
+  }
+}
+
+/*
+ * @brief Removes a short-lived slot chosen by the lifetime policy. Cohort
+ * and pinned phases free their short-lived objects at random.
+ */
+static size_t takeShortLived(struct Workload * workload, enum lifetimeKind kind) {
+  size_t capacity = workload->capacity;
+  size_t back = (workload->ringStart + workload->ringCount - 1) % capacity;
+  size_t slot;
+  if (kind == LIFETIME_LIFO) {
+    slot = workload->ring[back];
+  } else if (kind == LIFETIME_FIFO) {
+    slot = workload->ring[workload->ringStart];
+    workload->ringStart = (workload->ringStart + 1) % capacity;
+  } else {
+    size_t index = (workload->ringStart + workloadRandom(&workload->rng) % workload->ringCount) % capacity;
+    slot = workload->ring[index];
+    workload->ring[index] = workload->ring[back];
+  }
+  workload->ringCount--;
+  return slot;
+}
+
+static void emitFree(struct Workload * workload, struct WorkloadOp * op, size_t slot, unsigned phase, int draining) {
+  workload->freeSlots[workload->freeSlotCount++] = slot;
+  op->kind = WORKLOAD_FREE;
+  op->slot = slot;
+  op->size = 0;
+  op->phase = phase;
+  op->draining = draining;
+  op->longLived = 0;
+}
+
+int workloadNext(struct Workload * workload, struct WorkloadOp * op) {
+  while (workload->phase < workload->numPhases &&
+         workload->opsInPhase == workload->phases[workload->phase].ops) {
+    if (workload->cohortCount > 0) {
+      emitFree(workload, op, workload->cohort[--workload->cohortCount], workload->phase, 1);
+      return 1;
+    }
+    workload->phase++;
+    workload->opsInPhase = 0;
+    workload->pinnedInPhase = 0;
+  }
+  if (workload->phase == workload->numPhases) {
+    unsigned last = workload->numPhases > 0 ? workload->numPhases - 1 : 0;
+    if (workload->ringCount > 0) {
+      emitFree(workload, op, takeShortLived(workload, LIFETIME_FIFO), last, 1);
+      return 1;
+    }
+    if (workload->pinnedCount > 0) {
+      emitFree(workload, op, workload->pinned[--workload->pinnedCount], last, 1);
+      return 1;
+    }
+    return 0;
+  }
+
+  const struct WorkloadPhase * phase = &workload->phases[workload->phase];
+  workload->opsInPhase++;
+  if (workload->ringCount + workload->cohortCount + workload->pinnedInPhase < phase->live) {
+    size_t slot = workload->freeSlots[--workload->freeSlotCount];
+    op->kind = WORKLOAD_MALLOC;
+    op->slot = slot;
+    op->size = drawSize(&phase->size, &workload->rng);
+    op->phase = workload->phase;
+    op->draining = 0;
+    op->longLived = 0;
+    int longLived = (phase->lifetime.kind == LIFETIME_COHORT || phase->lifetime.kind == LIFETIME_PINNED) &&
+                    randomUnit(&workload->rng) <= phase->lifetime.cohortFraction;
+    if (longLived && phase->lifetime.kind == LIFETIME_PINNED) {
+      workload->pinned[workload->pinnedCount++] = slot;
+      workload->pinnedInPhase++;
+      op->longLived = 1;
+    } else if (longLived) {
+      workload->cohort[workload->cohortCount++] = slot;
+      op->longLived = 1;
+    } else {
+      workload->ring[(workload->ringStart + workload->ringCount) % workload->capacity] = slot;
+      workload->ringCount++;
+    }
+    return 1;
+  }
+  size_t slot;
+  if (workload->ringCount > 0) {
+    slot = takeShortLived(workload, phase->lifetime.kind);
+  } else if (workload->cohortCount > 0) {
+    slot = workload->cohort[--workload->cohortCount];
+  } else {
+    slot = workload->pinned[--workload->pinnedCount];
+    workload->pinnedInPhase--;
+  }
+  emitFree(workload, op, slot, workload->phase, 0);
+  return 1;
+}
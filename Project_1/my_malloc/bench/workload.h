@@ -0,0 +1,171 @@
+#ifndef __MY_MALLOC_WORKLOAD__
+#define __MY_MALLOC_WORKLOAD__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Synthetic allocation workloads.
+ *
+ * A workload is a sequence of phases. Each phase draws request sizes from
+ * one distribution and picks which live object to free from one lifetime
+ * policy, holding the live set near a target size: below the target it
+ * allocates, at or above it frees. The generator only produces operations
+ * on numbered slots; callers own the memory and apply each operation with
+ * whatever allocator they are measuring.
+ *
+ * Size distributions, as parsed by parseSizeDist():
+ *
+ *     fixed:N                  every request is N bytes
+ *     uniform:MIN:MAX          uniform in [MIN, MAX]
+ *     chunks:C:MIN:MAX         C * uniform[MIN, MAX]
+ *     zipf:S:N:UNIT            k * UNIT with P(k) ~ 1/k^S, k in [1, N]
+ *     lognormal:MU:SIGMA:MAX   exp(MU + SIGMA * normal), clamped to [1, MAX]
+ *     hist:SIZE=W/SIZE=W/...   empirical: SIZE with relative weight W
+ *     hist:@FILE               the same, one "SIZE WEIGHT" pair per line
+ *
+ * Lifetime policies, as parsed by parseLifetime():
+ *
+ *     lifo        free the most recent allocation
+ *     fifo        free the oldest allocation
+ *     random      free a uniformly chosen live object
+ *     cohort:P    each allocation joins a long-lived cohort with
+ *                 probability P; the others are freed at random. The
+ *                 cohort is only freed, all at once, when the phase ends.
+ *     pinned:P    like cohort, but the long-lived objects outlive their
+ *                 phase and are freed when the whole workload ends,
+ *                 pinning whatever heap they were placed in. They are only
+ *                 freed early if the phase has nothing else to free.
+ */
+
+#define WORKLOAD_MAX_PHASES 16
+
+enum sizeDistKind {
+  SIZE_FIXED,
+  SIZE_UNIFORM,
+  SIZE_CHUNKS,
+  SIZE_ZIPF,
+  SIZE_LOGNORMAL,
+  SIZE_EMPIRICAL
+};
+
+struct SizeDist {
+  enum sizeDistKind kind;
+  size_t min;
+  size_t max;
+  size_t unit;
+  double mu;
+  double sigma;
+  size_t count;          /* zipf/empirical: number of entries */
+  size_t * sizes;        /* empirical: entry sizes */
+  double * cumulative;   /* zipf/empirical: CDF over entries */
+};
+
+enum lifetimeKind {
+  LIFETIME_LIFO,
+  LIFETIME_FIFO,
+  LIFETIME_RANDOM,
+  LIFETIME_COHORT,
+  LIFETIME_PINNED
+};
+
+struct Lifetime {
+  enum lifetimeKind kind;
+  double cohortFraction; /* cohort and pinned: probability of joining */
+};
+
+struct WorkloadPhase {
+  size_t ops;            /* operations before the phase ends */
+  size_t live;           /* target live-set size */
+  struct SizeDist size;
+  struct Lifetime lifetime;
+};
+
+enum workloadOpKind {
+  WORKLOAD_MALLOC,
+  WORKLOAD_FREE
+};
+
+struct WorkloadOp {
+  enum workloadOpKind kind;
+  size_t slot;           /* object to allocate into or free */
+  size_t size;           /* bytes, for WORKLOAD_MALLOC */
+  unsigned phase;        /* index of the phase producing the op */
+  int draining;          /* frees a finished phase's cohort, or everything after the last phase */
+  int longLived;         /* allocates a cohort or pinned object */
+};
+
+/*
+ * Generator state. Short-lived objects sit in a ring so the LIFO, FIFO and
+ * random policies are all O(1); cohort members are kept apart until their
+ * phase ends, and pinned objects until the workload ends.
+ */
+struct Workload {
+  struct WorkloadPhase phases[WORKLOAD_MAX_PHASES];
+  unsigned numPhases;
+  unsigned phase;
+  size_t opsInPhase;
+  uint64_t rng;
+  size_t * ring;         /* short-lived slots, oldest first */
+  size_t ringStart;
+  size_t ringCount;
+  size_t * cohort;       /* long-lived slots of the current phase */
+  size_t cohortCount;
+  size_t * pinned;       /* pinned slots of every phase so far */
+  size_t pinnedCount;
+  size_t pinnedInPhase;  /* pinned by the current phase, counted in its live set */
+  size_t * freeSlots;    /* unused slot numbers */
+  size_t freeSlotCount;
+  size_t capacity;       /* slots; every slot number is below this */
+};
+
+/*
+ * @brief Parses a size distribution spec into dist.
+ * @return 1 on success, 0 on a malformed spec.
+ */
+int parseSizeDist(const char * spec, struct SizeDist * dist);
+
+/*
+ * @brief Parses a lifetime policy spec into lifetime.
+ * @return 1 on success, 0 on a malformed spec.
+ */
+int parseLifetime(const char * spec, struct Lifetime * lifetime);
+
+/*
+ * @brief Parses "ops=N,live=N,size=SPEC,life=SPEC" into phase.
+ * @return 1 on success, 0 on a malformed spec.
+ */
+int parsePhase(const char * spec, struct WorkloadPhase * phase);
+
+/*
+ * @brief Advances a xorshift64 state.
+ * @return The next pseudo-random value.
+ */
+uint64_t workloadRandom(uint64_t * state);
+
+/*
+ * @brief Draws one request size.
+ */
+size_t drawSize(const struct SizeDist * dist, uint64_t * rng);
+
+/*
+ * @brief Prepares a generator for the phases already stored in workload.
+ * Bookkeeping is mmap'd so it stays out of the heap under test.
+ * @param workload: Generator with phases and numPhases filled in.
+ * @param seed: Nonzero seed; equal seeds give equal operation streams.
+ * @return 1 on success, 0 if the bookkeeping could not be mapped.
+ */
+int workloadInit(struct Workload * workload, uint64_t seed);
+
+/*
+ * @brief Produces the next operation. After the last phase every remaining
+ * object is freed.
+ * @return 1 with *op filled in, or 0 when the workload is finished.
+ */
+int workloadNext(struct Workload * workload, struct WorkloadOp * op);
+
+/*
+ * @brief Releases the generator's bookkeeping.
+ */
+void workloadDestroy(struct Workload * workload);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "my_malloc.h"
+#include "workload.h"
+
+/*
+ * Runs a phased synthetic workload (see workload.h) through the MALLOC/FREE
+ * macros, built like the alloc_policy_tests with MALLOC_VERSION=FF or BF.
+ *
+ *     workload_allocs [-r seed] [PHASE ...]
+ *
+ * MALLOC_VERSION=HINT allocates with malloc_hint(), passing LIFETIME_LONG
+ * for the members of a long-lived cohort and LIFETIME_SHORT otherwise.
+ * MALLOC_VERSION=HANDLE allocates with halloc() and frees with hfree(),
+ * leaving the incremental compactor to run from hfree().
+ *
+ * Each PHASE is "ops=N,live=N,size=SPEC,life=SPEC". With no phases the
+ * default scenario runs: heavy-tailed small objects with a long-lived
+ * cohort pinned between them, then a switch to larger log-normal requests
+ * that have to fit around whatever the cohort left behind, then LIFO
+ * churn of the same small objects as in the first phase.
+ *
+ * Prints the segment size, free space and fragmentation as each phase
+ * finishes its operations (before its cohort is released), then the last
+ * phase's figures and the total time in the alloc_policy_tests format.
+ */
+
+#ifdef FF
+#define MALLOC(sz) ff_malloc(sz)
+#define FREE(p)    ff_free(p)
+#endif
+#ifdef BF
+#define MALLOC(sz) bf_malloc(sz)
+#define FREE(p)    bf_free(p)
+#endif
+#ifdef AD
+#define MALLOC(sz) ad_malloc(sz)
+#define FREE(p)    ad_free(p)
+#endif
+#ifdef HINT
+#define MALLOC(sz)      malloc_hint(sz, LIFETIME_SHORT)
+#define MALLOC_LONG(sz) malloc_hint(sz, LIFETIME_LONG)
+#define FREE(p)         ff_free(p)
+#endif
+#ifdef HANDLE
+#define MALLOC(sz) ((void *)(uintptr_t)halloc(sz))
+#define FREE(p)    hfree((my_handle_t)(uintptr_t)(p))
+#endif
+#ifndef MALLOC_LONG
+#define MALLOC_LONG(sz) MALLOC(sz)
+#endif
+
+static const char * defaultPhases[] = {
+  "ops=2000000,live=20000,size=zipf:1.2:64:16,life=cohort:0.1",
+  "ops=2000000,live=5000,size=lognormal:7:1:65536,life=random",
+  "ops=2000000,live=20000,size=zipf:1.2:64:16,life=lifo",
+};
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+struct PhaseStats {
+  unsigned long data_segment_size;
+  unsigned long data_segment_free_space;
+};
+
+static struct PhaseStats snapshot() {
+  struct PhaseStats stats = {get_data_segment_size(), get_data_segment_free_space_size()};
+  return stats;
+}
+
+static void printPhase(unsigned phase, double elapsed_ns, struct PhaseStats stats) {
+  printf("phase %u: time = %f seconds, data_segment_size = %lu, data_segment_free_space = %lu, fragmentation = %f\n",
+         phase, elapsed_ns / 1e9, stats.data_segment_size, stats.data_segment_free_space,
+         stats.data_segment_size > 0 ? (float)stats.data_segment_free_space/(float)stats.data_segment_size : 0);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct Workload workload;
+  unsigned long seed = 1;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+    seed = strtoul(argv[2], NULL, 10);
+    first = 3;
+  }
+  const char ** specs = (const char **)argv + first;
+  int numSpecs = argc - first;
+  if (numSpecs == 0) {
+    specs = defaultPhases;
+    numSpecs = sizeof(defaultPhases) / sizeof(defaultPhases[0]);
+  }
+  if (numSpecs > WORKLOAD_MAX_PHASES) {
+    fprintf(stderr, "at most %d phases\n", WORKLOAD_MAX_PHASES);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < numSpecs; i++) {
+    if (!parsePhase(specs[i], &workload.phases[i])) {
+      fprintf(stderr, "bad phase: %s\n", specs[i]);
+      return EXIT_FAILURE;
+    }
+    printf("phase %d: %s\n", i, specs[i]);
+  }
+  workload.numPhases = numSpecs;
+  if (!workloadInit(&workload, seed)) {
+    perror("workloadInit");
+    return EXIT_FAILURE;
+  }
+
+  void ** objects = calloc(workload.capacity, sizeof(void *));
+  struct timespec start_time, end_time, phase_start;
+  struct WorkloadOp op;
+  struct PhaseStats stats;
+  unsigned phase = 0;
+  int measured = 0;
+  double elapsed_ns = 0;
+
+  //Start Time
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  phase_start = start_time;
+  while (workloadNext(&workload, &op)) {
+    if (!measured && (op.draining || op.phase != phase)) {
+      stats = snapshot();
+      measured = 1;
+    }
+    if (op.phase != phase) {
+      clock_gettime(CLOCK_MONOTONIC, &end_time);
+      elapsed_ns += calc_time(phase_start, end_time);
+      printPhase(phase, calc_time(phase_start, end_time), stats);
+      phase = op.phase;
+      measured = 0;
+      clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    }
+    if (op.kind == WORKLOAD_MALLOC) {
+      objects[op.slot] = op.longLived ? MALLOC_LONG(op.size) : MALLOC(op.size);
+    } else {
+      FREE(objects[op.slot]);
+      objects[op.slot] = NULL;
+    }
+  }
+  //Stop Time
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  if (!measured) {
+    stats = snapshot();
+  }
+  elapsed_ns += calc_time(phase_start, end_time);
+  printPhase(phase, calc_time(phase_start, end_time), stats);
+
+  printf("data_segment_size = %lu, data_segment_free_space = %lu\n", stats.data_segment_size, stats.data_segment_free_space);
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Fragmentation  = %f\n", (float)stats.data_segment_free_space/(float)stats.data_segment_size);
+
+  free(objects);
+  workloadDestroy(&workload);
+  return 0;
+}
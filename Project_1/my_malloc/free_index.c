@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include "free_index.h"
+#include <sys/mman.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FREE_INDEX_X86 1
+#endif
+
+#define FREE_INDEX_INITIAL_CAPACITY 4096
+#define FREE_INDEX_MIN_HOLES 64
+
+static sizeScanFuncPtr firstFitKernel = NULL;
+static sizeScanFuncPtr bestFitKernel = NULL;
+static const char * kernelName = "scalar";
+
+static void selectKernels() {
+  firstFitKernel = scanFirstFitScalar;
+  bestFitKernel = scanBestFitScalar;
+#ifdef FREE_INDEX_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    firstFitKernel = scanFirstFitAvx2;
+    bestFitKernel = scanBestFitAvx2;
+    kernelName = "avx2";
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    firstFitKernel = scanFirstFitSse42;
+    bestFitKernel = scanBestFitSse42;
+    kernelName = "sse4.2";
+  }
+#endif
+}
+
+const char * freeIndexKernelName() {
+  if (firstFitKernel == NULL) {
+    selectKernels();
+  }
+  return kernelName;
+}
+
+static void growFreeIndex(FreeIndex * index) {
+  size_t newCapacity = index->capacity ? index->capacity * 2 : FREE_INDEX_INITIAL_CAPACITY;
+  size_t sizesBytes = newCapacity * sizeof(size_t);
+  size_t blocksBytes = newCapacity * sizeof(MemoryBlock *);
+  size_t * sizes;
+  MemoryBlock ** blocks;
+
+  if (index->capacity == 0) {
+    sizes = mmap(NULL, sizesBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    blocks = mmap(NULL, blocksBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    sizes = mremap(index->sizes, index->capacity * sizeof(size_t), sizesBytes, MREMAP_MAYMOVE);
+    blocks = mremap(index->blocks, index->capacity * sizeof(MemoryBlock *), blocksBytes, MREMAP_MAYMOVE);
+  }
+  if (sizes == MAP_FAILED || blocks == MAP_FAILED) {
+    fprintf(stderr, "free index failed to grow to %zu entries\n", newCapacity);
+    abort();
+  }
+  heap_stats.mmapCalls += 2;
+  index->sizes = sizes;
+  index->blocks = blocks;
+  index->capacity = newCapacity;
+}
+
+/*
+ * @brief Binary search for the first entry whose block address is >= block.
+ */
+static size_t lowerBound(FreeIndex * index, MemoryBlock * block) {
+  size_t lo = index->start;
+  size_t hi = index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->blocks[mid] < block) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/*
+ * @brief Squeezes the holes out of the index once they make up half of it.
+ */
+static void compactFreeIndex(FreeIndex * index) {
+  size_t live = 0;
+  for (size_t i = index->start; i < index->count; i++) {
+    if (index->sizes[i] != FREE_INDEX_HOLE) {
+      index->sizes[live] = index->sizes[i];
+      index->blocks[live] = index->blocks[i];
+      live++;
+    }
+  }
+  index->count = live;
+  index->holes = 0;
+  index->start = 0;
+}
+
+void freeIndexInsert(FreeIndex * index, MemoryBlock * block) {
+  size_t pos = index->count;
+  if (pos > index->start && index->blocks[pos - 1] > block) {
+    pos = lowerBound(index, block);
+    if (index->sizes[pos] == FREE_INDEX_HOLE) {
+      //blocks[pos - 1] < block <= blocks[pos]: the hole can take the block in place
+      index->holes--;
+    } else {
+      //Walk outward to the nearest free slot (a hole, the slot before start, or
+      //the slot at count) and shift the entries in between over by one
+      size_t floor = index->start > 0 ? index->start - 1 : 0;
+      for (size_t distance = 0; ; distance++) {
+        size_t right = pos + distance;
+        if (right == index->count || index->sizes[right] == FREE_INDEX_HOLE) {
+          if (right == index->count) {
+            if (index->count == index->capacity) {
+              growFreeIndex(index);
+            }
+            index->count++;
+          } else {
+            index->holes--;
+          }
+          memmove(&index->sizes[pos + 1], &index->sizes[pos], distance * sizeof(size_t));
+          memmove(&index->blocks[pos + 1], &index->blocks[pos], distance * sizeof(MemoryBlock *));
+          break;
+        }
+        if (pos >= distance + 1 && pos - 1 - distance >= floor) {
+          size_t left = pos - 1 - distance;
+          if (left + 1 == index->start || index->sizes[left] == FREE_INDEX_HOLE) {
+            if (left + 1 == index->start) {
+              index->start--;
+            } else {
+              index->holes--;
+            }
+            memmove(&index->sizes[left], &index->sizes[left + 1], distance * sizeof(size_t));
+            memmove(&index->blocks[left], &index->blocks[left + 1], distance * sizeof(MemoryBlock *));
+            pos--;
+            break;
+          }
+        }
+      }
+    }
+  } else {
+    //Blocks are most often appended at the tail (fresh sbrk space, split remainders of the last block)
+    if (index->count == index->capacity) {
+      growFreeIndex(index);
+    }
+    index->count++;
+  }
+  index->sizes[pos] = block->dataSize;
+  index->blocks[pos] = block;
+}
+
+void freeIndexRemove(FreeIndex * index, MemoryBlock * block) {
+  size_t pos = lowerBound(index, block);
+  if (pos == index->count || index->blocks[pos] != block || index->sizes[pos] == FREE_INDEX_HOLE) {
+    fprintf(stderr, "Can't remove a block missing from the free index\n");
+    return;
+  }
+  if (pos == index->count - 1) {
+    index->count--;
+    while (index->count > index->start && index->sizes[index->count - 1] == FREE_INDEX_HOLE) {
+      index->count--;
+      index->holes--;
+    }
+    return;
+  }
+  if (pos == index->start) {
+    index->start++;
+    while (index->start < index->count && index->sizes[index->start] == FREE_INDEX_HOLE) {
+      index->start++;
+      index->holes--;
+    }
+    return;
+  }
+  index->sizes[pos] = FREE_INDEX_HOLE;
+  index->holes++;
+  if (index->holes > FREE_INDEX_MIN_HOLES && index->holes * 2 > index->count - index->start) {
+    compactFreeIndex(index);
+  }
+}
+
+void freeIndexUpdate(FreeIndex * index, MemoryBlock * block) {
+  size_t pos = lowerBound(index, block);
+  if (pos < index->count && index->blocks[pos] == block && index->sizes[pos] != FREE_INDEX_HOLE) {
+    index->sizes[pos] = block->dataSize;
+  }
+}
+
+MemoryBlock * freeIndexPredecessor(FreeIndex * index, MemoryBlock * block) {
+  size_t pos = lowerBound(index, block);
+  while (pos > index->start && index->sizes[pos - 1] == FREE_INDEX_HOLE) {
+    pos--;
+  }
+  return pos == index->start ? NULL : index->blocks[pos - 1];
+}
+
+MemoryBlock * freeIndexFirstFit(FreeIndex * index, size_t size, size_t * scanned) {
+  if (firstFitKernel == NULL) {
+    selectKernels();
+  }
+  size_t live = index->count - index->start;
+  size_t pos = firstFitKernel(index->sizes + index->start, live, size);
+  if (scanned != NULL) {
+    *scanned += pos == live ? live : pos + 1;
+  }
+  return pos == live ? NULL : index->blocks[index->start + pos];
+}
+
+MemoryBlock * freeIndexBestFit(FreeIndex * index, size_t size, size_t * scanned) {
+  if (bestFitKernel == NULL) {
+    selectKernels();
+  }
+  size_t live = index->count - index->start;
+  size_t pos = bestFitKernel(index->sizes + index->start, live, size);
+  if (scanned != NULL) {
+    //The kernels stop early only on an exact fit
+    bool exact = pos != live && index->sizes[index->start + pos] == size;
+    *scanned += exact ? pos + 1 : live;
+  }
+  return pos == live ? NULL : index->blocks[index->start + pos];
+}
+
+size_t scanFirstFitScalar(const size_t * sizes, size_t count, size_t size) {
+  for (size_t i = 0; i < count; i++) {
+    if (sizes[i] >= size) {
+      return i;
+    }
+  }
+  return count;
+}
+
+size_t scanBestFitScalar(const size_t * sizes, size_t count, size_t size) {
+  size_t best = count;
+  for (size_t i = 0; i < count; i++) {
+    if (sizes[i] == size) {
+      return i;
+    }
+    if (sizes[i] > size && (best == count || sizes[i] < sizes[best])) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+#ifdef FREE_INDEX_X86
+
+__attribute__((target("sse4.2")))
+size_t scanFirstFitSse42(const size_t * sizes, size_t count, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (size >= INT64_MAX) {
+    return scanFirstFitScalar(sizes, count, size);
+  }
+  //sizes[i] >= size  <=>  sizes[i] > size - 1, as signed lanes once size - 1 < 2^63
+  const __m128i threshold = _mm_set1_epi64x((long long)(size - 1));
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i a = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i *)&sizes[i]), threshold);
+    __m128i b = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i *)&sizes[i + 2]), threshold);
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(a)) | (_mm_movemask_pd(_mm_castsi128_pd(b)) << 2);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + scanFirstFitScalar(sizes + i, count - i, size);
+}
+
+__attribute__((target("avx2")))
+size_t scanFirstFitAvx2(const size_t * sizes, size_t count, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (size >= INT64_MAX) {
+    return scanFirstFitScalar(sizes, count, size);
+  }
+  const __m256i threshold = _mm256_set1_epi64x((long long)(size - 1));
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i]), threshold);
+    __m256i b = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i + 4]), threshold);
+    __m256i c = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i + 8]), threshold);
+    __m256i d = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i + 12]), threshold);
+    __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+    if (!_mm256_testz_si256(any, any)) {
+      unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(a))
+        | ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4)
+        | ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(c)) << 8)
+        | ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(d)) << 12);
+      return i + __builtin_ctz(mask);
+    }
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m256i a = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i]), threshold);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(a));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + scanFirstFitScalar(sizes + i, count - i, size);
+}
+
+/*
+ * The vector best-fit kernels run in two passes. The first computes the
+ * smallest fitting size with independent per-lane minima (stopping early once
+ * an exact fit has been seen); the second is an equality scan for the first
+ * block holding that size, which preserves the lowest-address tie-break of
+ * findBestFit.
+ */
+
+__attribute__((target("sse4.2")))
+static size_t scanEqualSse42(const size_t * sizes, size_t count, size_t value) {
+  const __m128i target = _mm_set1_epi64x((long long)value);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i a = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)&sizes[i]), target);
+    __m128i b = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)&sizes[i + 2]), target);
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(a)) | (_mm_movemask_pd(_mm_castsi128_pd(b)) << 2);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  for (; i < count && sizes[i] != value; i++) {
+  }
+  return i;
+}
+
+__attribute__((target("sse4.2")))
+size_t scanBestFitSse42(const size_t * sizes, size_t count, size_t size) {
+  if (size == 0 || size >= INT64_MAX) {
+    return scanBestFitScalar(sizes, count, size);
+  }
+  const __m128i threshold = _mm_set1_epi64x((long long)(size - 1));
+  const __m128i exact = _mm_set1_epi64x((long long)size);
+  const __m128i none = _mm_set1_epi64x(INT64_MAX);
+  __m128i best0 = none, best1 = none;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&sizes[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&sizes[i + 2]);
+    a = _mm_blendv_epi8(none, a, _mm_cmpgt_epi64(a, threshold));
+    b = _mm_blendv_epi8(none, b, _mm_cmpgt_epi64(b, threshold));
+    best0 = _mm_blendv_epi8(best0, a, _mm_cmpgt_epi64(best0, a));
+    best1 = _mm_blendv_epi8(best1, b, _mm_cmpgt_epi64(best1, b));
+    if ((i & 63) == 0) {
+      __m128i hit = _mm_or_si128(_mm_cmpeq_epi64(best0, exact), _mm_cmpeq_epi64(best1, exact));
+      if (!_mm_testz_si128(hit, hit)) {
+        return scanEqualSse42(sizes, i + 4, size);
+      }
+    }
+  }
+  best0 = _mm_blendv_epi8(best0, best1, _mm_cmpgt_epi64(best0, best1));
+  long long lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, best0);
+  size_t minimum = (size_t)(lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+  for (; i < count; i++) {
+    if (sizes[i] >= size && sizes[i] < minimum) {
+      minimum = sizes[i];
+    }
+  }
+  return minimum == (size_t)INT64_MAX ? count : scanEqualSse42(sizes, count, minimum);
+}
+
+__attribute__((target("avx2")))
+static size_t scanEqualAvx2(const size_t * sizes, size_t count, size_t value) {
+  const __m256i target = _mm256_set1_epi64x((long long)value);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i a = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i]), target);
+    __m256i b = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)&sizes[i + 4]), target);
+    unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(a))
+      | ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  for (; i < count && sizes[i] != value; i++) {
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+size_t scanBestFitAvx2(const size_t * sizes, size_t count, size_t size) {
+  if (size == 0 || size >= INT64_MAX) {
+    return scanBestFitScalar(sizes, count, size);
+  }
+  const __m256i threshold = _mm256_set1_epi64x((long long)(size - 1));
+  const __m256i exact = _mm256_set1_epi64x((long long)size);
+  const __m256i none = _mm256_set1_epi64x(INT64_MAX);
+  __m256i best0 = none, best1 = none;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)&sizes[i]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)&sizes[i + 4]);
+    a = _mm256_blendv_epi8(none, a, _mm256_cmpgt_epi64(a, threshold));
+    b = _mm256_blendv_epi8(none, b, _mm256_cmpgt_epi64(b, threshold));
+    best0 = _mm256_blendv_epi8(best0, a, _mm256_cmpgt_epi64(best0, a));
+    best1 = _mm256_blendv_epi8(best1, b, _mm256_cmpgt_epi64(best1, b));
+    if ((i & 127) == 0) {
+      __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi64(best0, exact), _mm256_cmpeq_epi64(best1, exact));
+      if (!_mm256_testz_si256(hit, hit)) {
+        return scanEqualAvx2(sizes, i + 8, size);
+      }
+    }
+  }
+  best0 = _mm256_blendv_epi8(best0, best1, _mm256_cmpgt_epi64(best0, best1));
+  long long lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, best0);
+  size_t minimum = (size_t)INT64_MAX;
+  for (int lane = 0; lane < 4; lane++) {
+    if ((size_t)lanes[lane] < minimum) {
+      minimum = (size_t)lanes[lane];
+    }
+  }
+  for (; i < count; i++) {
+    if (sizes[i] >= size && sizes[i] < minimum) {
+      minimum = sizes[i];
+    }
+  }
+  return minimum == (size_t)INT64_MAX ? count : scanEqualAvx2(sizes, count, minimum);
+}
+
+#else
+
+size_t scanFirstFitSse42(const size_t * sizes, size_t count, size_t size) {
+  return scanFirstFitScalar(sizes, count, size);
+}
+
+size_t scanFirstFitAvx2(const size_t * sizes, size_t count, size_t size) {
+  return scanFirstFitScalar(sizes, count, size);
+}
+
+size_t scanBestFitSse42(const size_t * sizes, size_t count, size_t size) {
+  return scanBestFitScalar(sizes, count, size);
+}
+
+size_t scanBestFitAvx2(const size_t * sizes, size_t count, size_t size) {
+  return scanBestFitScalar(sizes, count, size);
+}
+
+#endif
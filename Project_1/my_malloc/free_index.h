@@ -0,0 +1,118 @@
+#ifndef __FREE_INDEX__
+#define __FREE_INDEX__
+#include <stdbool.h>
+#include <stddef.h>
+
+struct MemoryBlock;
+
+/**
+ * Dense side index over the free list.
+ *
+ * The FreeIndex mirrors the address-ordered free list as two parallel arrays:
+ * the data size of every free block and the block itself. Both arrays are kept
+ * sorted by block address so that position i in the index is the i-th block of
+ * the free list. Fit searches then scan the contiguous sizes array instead of
+ * chasing next pointers through the heap, and address-ordered inserts find
+ * their neighbours with a binary search.
+ *
+ * Removing a block leaves a hole (a zero size, which never satisfies a
+ * request) rather than shifting the arrays; inserts reuse an adjacent hole or
+ * shift entries only as far as the nearest one, and the arrays are compacted
+ * once half of the entries are holes. Holes at either end are trimmed off
+ * immediately, so a first-fit workload consuming the front of the list does
+ * not leave a run of dead entries for every later scan to skip. The arrays live in their own mmap'd
+ * region so the index never competes with the heap it describes.
+ */
+struct FreeIndex {
+  size_t * sizes;                 /**< Data size of each free block, in address order. */
+  struct MemoryBlock ** blocks;   /**< Free blocks, in address order. */
+  size_t start;                   /**< First entry in use; slots before it were trimmed off the front. */
+  size_t count;                   /**< One past the last entry in use. */
+  size_t holes;                   /**< Number of entries in [start, count) vacated by removals. */
+  size_t capacity;                /**< Number of entries the arrays can hold. */
+};
+typedef struct FreeIndex FreeIndex;
+
+#define FREE_INDEX_HOLE 0
+
+/*
+ * @brief Signature shared by the size scan kernels.
+ * @param sizes: Array of block sizes to scan.
+ * @param count: Number of entries in sizes.
+ * @param size: Size of the data needed.
+ * @return Position of the selected entry, or count if no entry fits.
+ */
+typedef size_t (*sizeScanFuncPtr) (const size_t * sizes, size_t count, size_t size);
+
+/*
+ * @brief Inserts a free block into the index at its address-ordered position.
+ * @param index: Pointer to the index.
+ * @param block: Pointer to the free block.
+ */
+void freeIndexInsert(FreeIndex * index, struct MemoryBlock * block);
+
+/*
+ * @brief Removes a block from the index.
+ * @param index: Pointer to the index.
+ * @param block: Pointer to the block to be removed.
+ */
+void freeIndexRemove(FreeIndex * index, struct MemoryBlock * block);
+
+/*
+ * @brief Refreshes the cached size of a block whose dataSize changed in place
+ * (coalescing, splitting).
+ * @param index: Pointer to the index.
+ * @param block: Pointer to the resized block.
+ */
+void freeIndexUpdate(FreeIndex * index, struct MemoryBlock * block);
+
+/*
+ * @brief Finds the free block that immediately precedes an address.
+ * @param index: Pointer to the index.
+ * @param block: Address being inserted into the free list.
+ * @return The highest-addressed free block below 'block', or NULL if none.
+ */
+struct MemoryBlock * freeIndexPredecessor(FreeIndex * index, struct MemoryBlock * block);
+
+/*
+ * @brief First-fit search over the index.
+ * @param index: Pointer to the index.
+ * @param size: Size of the data needed.
+ * @param scanned: If not NULL, incremented by the number of entries examined.
+ * @return Lowest-addressed free block with dataSize >= size, or NULL.
+ */
+struct MemoryBlock * freeIndexFirstFit(FreeIndex * index, size_t size, size_t * scanned);
+
+/*
+ * @brief Best-fit search over the index.
+ * @param index: Pointer to the index.
+ * @param size: Size of the data needed.
+ * @param scanned: If not NULL, incremented by the number of entries examined
+ * (the whole index unless the search stopped at an exact fit).
+ * @return Smallest free block with dataSize >= size (lowest address on ties), or NULL.
+ */
+struct MemoryBlock * freeIndexBestFit(FreeIndex * index, size_t size, size_t * scanned);
+
+/*
+ * Size scan kernels. Each family has a scalar reference implementation and
+ * SSE4.2/AVX2 versions built with per-function target attributes; the
+ * dispatching entry points pick the widest kernel the CPU supports the first
+ * time they are called. Sizes are compared as signed 64-bit lanes, which is
+ * exact for any size the heap can actually hold (< 2^63); the vector kernels
+ * hand requests of INT64_MAX bytes or more (which would overflow the
+ * threshold or match the best-fit "no fit" sentinel) to the scalar scan.
+ */
+size_t scanFirstFitScalar(const size_t * sizes, size_t count, size_t size);
+size_t scanFirstFitSse42(const size_t * sizes, size_t count, size_t size);
+size_t scanFirstFitAvx2(const size_t * sizes, size_t count, size_t size);
+size_t scanBestFitScalar(const size_t * sizes, size_t count, size_t size);
+size_t scanBestFitSse42(const size_t * sizes, size_t count, size_t size);
+size_t scanBestFitAvx2(const size_t * sizes, size_t count, size_t size);
+
+/*
+ * @brief Reports which kernel family the dispatcher selected.
+ * @return "avx2", "sse4.2" or "scalar".
+ */
+const char * freeIndexKernelName();
+
+#endif
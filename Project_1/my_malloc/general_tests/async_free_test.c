@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "my_malloc.h"
+#include "async_free.h"
+
+#ifdef FF
+#define MALLOC(sz) ff_malloc(sz)
+#define FREE(p)    ff_free(p)
+#endif
+#ifdef BF
+#define MALLOC(sz) bf_malloc(sz)
+#define FREE(p)    bf_free(p)
+#endif
+#ifdef AD
+#define MALLOC(sz) ad_malloc(sz)
+#define FREE(p)    ad_free(p)
+#endif
+
+#define NUM_ROUNDS 8
+#define SMALL_SIZE 64
+#define LARGE_SIZE 128
+
+//Checks that blocks freed asynchronously go back to their own region.
+//Each round frees one main-heap block and two long-lived blocks in one
+//pending batch, flushes, and then allocates from both regions again,
+//asking the main heap for a larger block than the one it got back so
+//its search has to look past it: every block must come from the region
+//it was asked for and must not overlap another live block.
+
+static int region_of(void *p) {
+  return ((MemoryBlock *)p - 1)->region;
+}
+
+int main(int argc, char *argv[])
+{
+  int round, i, j;
+  int fail = 0;
+  char *items[3];
+  size_t sizes[3] = { SMALL_SIZE, LARGE_SIZE, LARGE_SIZE };
+
+  if (my_malloc_async_free_start() != 0) {
+    printf("Could not start the asynchronous free thread\n");
+    printf("Test failed\n");
+    return 1;
+  }
+
+  items[0] = MALLOC(sizes[0]);
+  items[1] = malloc_hint(sizes[1], LIFETIME_LONG);
+  items[2] = malloc_hint(sizes[2], LIFETIME_LONG);
+
+  for (round=0; round < NUM_ROUNDS && fail == 0; round++) {
+    for (i=0; i < 3; i++) {
+      FREE(items[i]);
+    } //for i
+    my_malloc_async_free_flush();
+
+    sizes[0] += SMALL_SIZE;
+    items[0] = MALLOC(sizes[0]);
+    items[1] = malloc_hint(sizes[1], LIFETIME_LONG);
+    items[2] = malloc_hint(sizes[2], LIFETIME_LONG);
+    for (i=0; i < 3; i++) {
+      memset(items[i], i + 1, sizes[i]);
+    } //for i
+
+    if (region_of(items[0]) != HEAP_MAIN ||
+	region_of(items[1]) != HEAP_LONG_LIVED ||
+	region_of(items[2]) != HEAP_LONG_LIVED) {
+      printf("Round %d: a block came from the wrong region\n", round);
+      fail = 1;
+    } //if
+    for (i=0; i < 3; i++) {
+      for (j=0; j < sizes[i]; j++) {
+	if (items[i][j] != i + 1) {
+	  printf("Round %d: block %d was overwritten\n", round, i);
+	  fail = 1;
+	  break;
+	} //if
+      } //for j
+    } //for i
+  } //for round
+
+  for (i=0; i < 3; i++) {
+    FREE(items[i]);
+  } //for i
+  my_malloc_async_free_stop();
+
+  if (fail == 0) {
+    printf("Every block came back from its own region\n");
+    printf("Test passed\n");
+  } else {
+    printf("Test failed\n");
+  } //else
+
+  return fail;
+}
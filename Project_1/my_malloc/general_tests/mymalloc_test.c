@@ -10,6 +10,10 @@
 #define MALLOC(sz) bf_malloc(sz)
 #define FREE(p)    bf_free(p)
 #endif
+#ifdef AD
+#define MALLOC(sz) ad_malloc(sz)
+#define FREE(p)    ad_free(p)
+#endif
 
  
 int main(int argc, char *argv[])
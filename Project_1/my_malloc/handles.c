@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include "handles.h"
+#include <sys/mman.h>
+#include <string.h>
+
+extern FreeList freeList;
+extern heap_info_t heap_info;
+
+struct HandleSlot {
+  MemoryBlock * block;     /* NULL while the slot is free */
+  uint32_t pins;
+  my_handle_t nextFree;    /* next free slot's handle, or HANDLE_NULL */
+};
+
+/* Slot i holds handle i + 1, so HANDLE_NULL is never handed out. */
+static struct HandleSlot * slots = NULL;
+static uint32_t numSlots = 0;
+static uint32_t slotCapacity = 0;
+static my_handle_t freeSlots = HANDLE_NULL;
+
+MemoryBlock * compactCursor = NULL;
+static size_t compactCredit = 0;      /* bytes freed through hfree not yet spent copying */
+
+static void growSlots() {
+  size_t newCapacity = slotCapacity ? (size_t)slotCapacity * 2 : HANDLE_INITIAL_SLOTS;
+  struct HandleSlot * grown;
+  if (slotCapacity == 0) {
+    grown = mmap(NULL, newCapacity * sizeof(*grown), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    grown = mremap(slots, slotCapacity * sizeof(*grown), newCapacity * sizeof(*grown), MREMAP_MAYMOVE);
+  }
+  if (grown == MAP_FAILED || newCapacity > UINT32_MAX) {
+    fprintf(stderr, "handle table failed to grow to %zu entries\n", newCapacity);
+    abort();
+  }
+  heap_stats.mmapCalls++;
+  slots = grown;
+  slotCapacity = newCapacity;
+}
+
+static struct HandleSlot * slotOf(my_handle_t handle) {
+  assert(handle != HANDLE_NULL && handle <= numSlots && slots[handle - 1].block != NULL);
+  return &slots[handle - 1];
+}
+
+my_handle_t halloc(size_t size) {
+  void * ptr = bf_malloc(size);
+  if (ptr == NULL) {
+    return HANDLE_NULL;
+  }
+  my_handle_t handle = freeSlots;
+  if (handle != HANDLE_NULL) {
+    freeSlots = slots[handle - 1].nextFree;
+  } else {
+    if (numSlots == slotCapacity) {
+      growSlots();
+    }
+    handle = ++numSlots;
+  }
+  struct HandleSlot * slot = &slots[handle - 1];
+  slot->block = (MemoryBlock *)ptr - 1;
+  slot->pins = 0;
+  slot->block->handle = handle;
+  return handle;
+}
+
+void hfree(my_handle_t handle) {
+  if (handle == HANDLE_NULL) {
+    return;
+  }
+  struct HandleSlot * slot = slotOf(handle);
+  MemoryBlock * block = slot->block;
+  size_t totalSize = META_SIZE + block->dataSize;
+  block->handle = HANDLE_NULL;
+  ff_free(block + 1);
+  slot->block = NULL;
+  slot->nextFree = freeSlots;
+  freeSlots = handle;
+
+  compactCredit += totalSize;
+  if (compactCredit >= HANDLE_COMPACT_STEP
+      && heap_info.totalFreed > HANDLE_COMPACT_FRAG * heap_info.totalAllocated) {
+    compactCredit -= HANDLE_COMPACT_STEP;
+    hcompact(HANDLE_COMPACT_STEP);
+  }
+}
+
+void * hlock(my_handle_t handle) {
+  struct HandleSlot * slot = slotOf(handle);
+  slot->pins++;
+  return slot->block + 1;
+}
+
+void hunlock(my_handle_t handle) {
+  struct HandleSlot * slot = slotOf(handle);
+  assert(slot->pins > 0);
+  slot->pins--;
+}
+
+/*
+ * @brief Returns the block right above a free block if the compactor may
+ * move it: an unpinned handle block of the same region.
+ */
+static MemoryBlock * movableAbove(MemoryBlock * hole) {
+  char * end = (char *)(hole + 1) + hole->dataSize;
+  if (heapSegmentEndsAt(end)) {
+    return NULL;
+  }
+  MemoryBlock * block = (MemoryBlock *)end;
+  if (!block->allocated || block->handle == HANDLE_NULL || block->region != hole->region) {
+    return NULL;
+  }
+  return slots[block->handle - 1].pins == 0 ? block : NULL;
+}
+
+/*
+ * @brief Moves a block down into the free block just below it.
+ * @param hole: The free block.
+ * @param block: The block right above it.
+ * @return The free block, now right above the moved block and merged with
+ * any free block after it.
+ */
+static MemoryBlock * slideDown(MemoryBlock * hole, MemoryBlock * block) {
+  FreeList * list = freeListOf(hole);
+  MemoryBlock * before = hole->prev;
+  unsigned char region = hole->region;
+  size_t holeSize = hole->dataSize;
+  size_t blockSize = META_SIZE + block->dataSize;
+
+  removeFromFreeList(list, hole);
+  memmove(hole, block, blockSize);
+  slots[hole->handle - 1].block = hole;
+  if (hole->sampled) {
+    profileMoved(block + 1, hole + 1);
+  }
+
+  MemoryBlock * moved = (MemoryBlock *)((char *)hole + blockSize);
+  initializeMemoryBlock(moved, holeSize, false);
+  moved->region = region;
+  insertIntoFreeList(list, moved, before);
+  coalesceWithRight(moved);
+  heap_stats.relocations++;
+  heap_stats.relocatedBytes += blockSize;
+  return moved;
+}
+
+size_t hcompact(size_t budget) {
+  asyncFreeLock();
+  size_t copied = 0;
+  bool fromStart = compactCursor == NULL;
+  MemoryBlock * hole = fromStart ? freeList.head : compactCursor;
+  for (;;) {
+    while (hole != NULL && copied < budget) {
+      MemoryBlock * block = movableAbove(hole);
+      if (block == NULL) {
+        hole = hole->next;
+        continue;
+      }
+      copied += META_SIZE + block->dataSize;
+      hole = slideDown(hole, block);
+    }
+    if (hole != NULL) {
+      compactCursor = hole;
+      break;
+    }
+    /* End of a pass. If it began part-way up, look at the rest once more
+     * before declaring there is nothing to do. */
+    compactCursor = NULL;
+    if (fromStart || copied > 0) {
+      break;
+    }
+    fromStart = true;
+    hole = freeList.head;
+  }
+  trimHeap(&freeList);
+  if (copied == 0) {
+    compactCredit = 0;
+  }
+  asyncFreeUnlock();
+  return copied;
+}
@@ -0,0 +1,92 @@
+#ifndef __MY_MALLOC_HANDLES__
+#define __MY_MALLOC_HANDLES__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Relocatable allocation through handles.
+ *
+ * halloc() returns a handle rather than a pointer. The block behind it is
+ * only reachable through hlock(), which pins it and returns its current
+ * address, until the matching hunlock(). Blocks whose handle is not pinned
+ * may be moved by the compactor, which slides them down into the free
+ * block just below them:
+ *
+ *     [ free F ][ block B ][ ... ]   ->   [ block B ][ free F ][ ... ]
+ *
+ * F then merges with whatever free space follows B, and the hole keeps
+ * moving up the heap until it reaches something that cannot move (a pinned
+ * block, a plain ff/bf/ad_malloc block, or the end of a heap segment).
+ * Holes that reach the top of the heap are trimmed, so with no pins the
+ * data segment shrinks back to the live handle data plus whatever the
+ * other allocators still hold.
+ *
+ * Compaction is incremental: hcompact(budget) moves blocks until about
+ * budget bytes have been copied and remembers where it stopped. hfree()
+ * runs a step of HANDLE_COMPACT_STEP bytes for every HANDLE_COMPACT_STEP
+ * bytes it has freed, while the free space is above HANDLE_COMPACT_FRAG of
+ * the data segment, so the copying never exceeds the bytes freed. A pass
+ * that finds nothing to move forfeits the bytes saved up so far.
+ *
+ * Handle blocks are ordinary main-heap blocks, so fragmentation, stats and
+ * snapshots count them as usual. Free them with hfree(), never with the
+ * *_free functions. Like the rest of the library this is single-threaded.
+ */
+
+typedef uint32_t my_handle_t;
+#define HANDLE_NULL 0
+
+#ifndef HANDLE_COMPACT_STEP
+#define HANDLE_COMPACT_STEP  (64 * 1024)   /* bytes copied per step from hfree */
+#endif
+#define HANDLE_COMPACT_FRAG  0.25          /* free / data segment size */
+#define HANDLE_INITIAL_SLOTS 4096
+
+/*
+ * @brief Allocates a relocatable block.
+ * @param size: Size of the data needed.
+ * @return Handle of the block, or HANDLE_NULL if size is 0 or the heap
+ * could not grow.
+ */
+my_handle_t halloc(size_t size);
+
+/*
+ * @brief Frees a block allocated with halloc, pinned or not. The handle
+ * must not be used afterwards.
+ * @param handle: Handle to free; HANDLE_NULL is ignored.
+ */
+void hfree(my_handle_t handle);
+
+/*
+ * @brief Pins a block and returns its address, valid until the matching
+ * hunlock(). Pins nest.
+ * @param handle: Handle of the block.
+ * @return Address of the block's data.
+ */
+void * hlock(my_handle_t handle);
+
+/*
+ * @brief Releases one pin taken by hlock().
+ * @param handle: Handle of the block.
+ */
+void hunlock(my_handle_t handle);
+
+/*
+ * @brief Runs one step of the compactor.
+ * @param budget: Stop once at least this many bytes have been copied.
+ * @return Bytes copied, 0 once a whole pass over the heap finds nothing
+ * left to move.
+ */
+size_t hcompact(size_t budget);
+
+/*
+ * Internal bookkeeping shared with my_malloc.c: the free block the
+ * compactor stopped at, or NULL to start a pass from the bottom of the
+ * heap. removeFromFreeList() moves it to the free block before the one
+ * removed, so it never points at a block that is no longer free.
+ */
+struct MemoryBlock;
+extern struct MemoryBlock * compactCursor;
+
+#endif
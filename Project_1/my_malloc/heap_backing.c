@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include "heap_backing.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static bool initialized = false;
+static enum heapBacking backing = HEAP_BACKING_SBRK;
+static char * regionStart = NULL;    /* the reservation, HUGE_PAGE_SIZE aligned */
+static char * regionBreak = NULL;
+static char * committedEnd = NULL;   /* [regionStart, committedEnd) is readable and writable */
+
+static char * alignUp(char * addr) {
+  return (char *)(((uintptr_t)addr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+}
+
+static void initializeBacking() {
+  initialized = true;
+  const char * kind = getenv("MY_MALLOC_HEAP");
+  if (kind == NULL || (strcmp(kind, "thp") != 0 && strcmp(kind, "hugetlb") != 0)) {
+    return;
+  }
+  /* PROT_NONE reserves address space without committing memory; one extra
+   * huge page leaves room to align the start. */
+  size_t length = HEAP_RESERVE + HUGE_PAGE_SIZE;
+  char * reserved = mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    fprintf(stderr, "could not reserve a huge-page heap, using sbrk\n");
+    return;
+  }
+  regionStart = alignUp(reserved);
+  if (regionStart > reserved) {
+    munmap(reserved, regionStart - reserved);
+  }
+  munmap(regionStart + HEAP_RESERVE, reserved + length - (regionStart + HEAP_RESERVE));
+  regionBreak = regionStart;
+  committedEnd = regionStart;
+  backing = strcmp(kind, "hugetlb") == 0 ? HEAP_BACKING_HUGETLB : HEAP_BACKING_THP;
+}
+
+/*
+ * @brief Makes the reservation readable and writable up to 'end', a huge
+ * page boundary.
+ * @return false if the memory could not be committed.
+ */
+static bool commit(char * end) {
+  while (committedEnd < end) {
+    if (backing == HEAP_BACKING_HUGETLB
+        && mmap(committedEnd, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED) {
+      committedEnd += HUGE_PAGE_SIZE;
+      continue;
+    }
+    /* THP, or a huge page the hugetlb pool could not supply. */
+    size_t bytes = backing == HEAP_BACKING_HUGETLB ? HUGE_PAGE_SIZE : (size_t)(end - committedEnd);
+    if (mmap(committedEnd, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+        == MAP_FAILED) {
+      return false;
+    }
+    madvise(committedEnd, bytes, MADV_HUGEPAGE);
+    committedEnd += bytes;
+  }
+  return true;
+}
+
+void * heapExtend(size_t bytes) {
+  if (!initialized) {
+    initializeBacking();
+  }
+  if (backing == HEAP_BACKING_SBRK) {
+    return sbrk(bytes);
+  }
+  int savedErrno = errno;
+  if (bytes > (size_t)(regionStart + HEAP_RESERVE - regionBreak)) {
+    errno = ENOMEM;
+    return (void *)-1;
+  }
+  char * newBreak = regionBreak + bytes;
+  if (newBreak > committedEnd && !commit(alignUp(newBreak))) {
+    errno = ENOMEM;
+    return (void *)-1;
+  }
+  char * oldBreak = regionBreak;
+  regionBreak = newBreak;
+  errno = savedErrno;   /* a hugetlb page that fell back to THP is not a failure */
+  return oldBreak;
+}
+
+void heapRetract(size_t bytes) {
+  if (backing == HEAP_BACKING_SBRK) {
+    sbrk(-(intptr_t)bytes);
+    return;
+  }
+  regionBreak -= bytes;
+  char * keep = alignUp(regionBreak) + HEAP_RELEASE_SLACK * HUGE_PAGE_SIZE;
+  if (keep < committedEnd) {
+    /* Mapping PROT_NONE over the range frees its pages and uncommits it
+     * in one call, for THP and hugetlb pages alike. */
+    mmap(keep, committedEnd - keep, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    committedEnd = keep;
+  }
+}
+
+void * heapBreak() {
+  if (!initialized) {
+    initializeBacking();
+  }
+  return backing == HEAP_BACKING_SBRK ? sbrk(0) : regionBreak;
+}
+
+enum heapBacking heapBackingKind() {
+  if (!initialized) {
+    initializeBacking();
+  }
+  return backing;
+}
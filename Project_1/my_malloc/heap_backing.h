@@ -0,0 +1,67 @@
+#ifndef __MY_MALLOC_HEAP_BACKING__
+#define __MY_MALLOC_HEAP_BACKING__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Where the heap's memory comes from.
+ *
+ * By default the heap is the data segment and grows with sbrk. Setting
+ * MY_MALLOC_HEAP in the environment before the first allocation selects a
+ * huge-page backing instead:
+ *
+ *   thp      Reserve HEAP_RESERVE bytes of address space, 2 MB aligned,
+ *            and grow a break of our own within it. The reservation is
+ *            madvise(MADV_HUGEPAGE)d, so the kernel backs each touched
+ *            2 MB of it with one transparent huge page and a walk over a
+ *            large free list or payload takes one dTLB entry per 2 MB
+ *            instead of per 4 KB.
+ *   hugetlb  As thp, but each 2 MB of the reservation is committed with
+ *            MAP_HUGETLB from the preallocated pool
+ *            (/proc/sys/vm/nr_hugepages), falling back to THP for any
+ *            huge page the pool cannot supply.
+ *
+ * Either way the break moves exactly as sbrk's would, so the heap layout,
+ * get_data_segment_size() and trimming are unchanged. Memory is committed
+ * and released in whole huge pages, though: shrinking the break gives
+ * back only the huge pages entirely above it, and keeps
+ * HEAP_RELEASE_SLACK of them committed as a cushion against a heap that
+ * shrinks and grows around the same boundary.
+ */
+
+enum heapBacking {
+  HEAP_BACKING_SBRK,
+  HEAP_BACKING_THP,
+  HEAP_BACKING_HUGETLB
+};
+
+#define HUGE_PAGE_SIZE      ((size_t)2 * 1024 * 1024)
+#ifndef HEAP_RESERVE
+#define HEAP_RESERVE        ((size_t)1 << 40)   /* address space reserved for a huge-page heap */
+#endif
+#define HEAP_RELEASE_SLACK  1                   /* free huge pages kept above the break */
+
+/*
+ * @brief Moves the break up, like sbrk(bytes).
+ * @return The old break, or (void *)-1 with errno set to ENOMEM.
+ */
+void * heapExtend(size_t bytes);
+
+/*
+ * @brief Moves the break down, like sbrk(-bytes), releasing whole huge
+ * pages above it.
+ */
+void heapRetract(size_t bytes);
+
+/*
+ * @brief Returns the current break, like sbrk(0).
+ */
+void * heapBreak();
+
+/*
+ * @brief Returns the backing in use, chosen on the first call of any of
+ * the above.
+ */
+enum heapBacking heapBackingKind();
+
+#endif
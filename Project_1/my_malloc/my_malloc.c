@@ -1,7 +1,10 @@
 #include "my_malloc.h"
+#include <sys/mman.h>
 //Global variables
 FreeList freeList = { .head = NULL, .tail = NULL };
+FreeList longLivedList = { .head = NULL, .tail = NULL };
 heap_info_t heap_info = { .totalAllocated = 0, .totalFreed = 0 };
+static char * trimFloor = NULL;   /* trimHeap leaves the heap at least this far */
 
 bool isEmptyFreeList (FreeList * freeList) {
     return !freeList->head && !freeList->tail;
@@ -10,6 +13,9 @@ bool isEmptyFreeList (FreeList * freeList) {
 void initializeMemoryBlock(MemoryBlock * block, size_t dataSize, bool allocated) {
   block->dataSize = dataSize;
   block->allocated = allocated;
+  block->region = HEAP_MAIN;
+  block->sampled = false;
+  block->handle = HANDLE_NULL;
   block->prev = NULL;
   block->next = NULL;
 }
@@ -19,6 +25,9 @@ void appendToFreeList(FreeList * list, MemoryBlock * toAdd) {
   if (isEmptyFreeList(list)) {
     list->head = &(*toAdd);
     list->tail = &(*toAdd);
+    //toAdd may still be linked into the pending batch of an asynchronous free
+    toAdd->prev = NULL;
+    toAdd->next = NULL;
   } else {
     //Otherwise (if toAdd isn't first element in the list)
     list->tail->next = &(*toAdd);
@@ -27,12 +36,19 @@ void appendToFreeList(FreeList * list, MemoryBlock * toAdd) {
     list->tail = &(*toAdd);
   }
   toAdd->allocated = false;
+  heap_info.totalFreed += META_SIZE + toAdd->dataSize;
+  statsFreeBlockAdded(toAdd->dataSize);
+#ifdef USE_FREE_INDEX
+  freeIndexInsert(&list->index, toAdd);
+#endif
 }
 
 void insertIntoFreeList(FreeList * list, MemoryBlock * block, MemoryBlock* curr) {
   if (isEmptyFreeList(list)) {
     list->head = &(*block);
     list->tail = &(*block);
+    block->prev = NULL;
+    block->next = NULL;
   } else if (curr == NULL) {
     list->head->prev = &(*block);
     block->next = list->head;
@@ -50,6 +66,11 @@ void insertIntoFreeList(FreeList * list, MemoryBlock * block, MemoryBlock* curr)
     block->next = &(*toInsert);
     toInsert->prev = &(*block);
   }
+  heap_info.totalFreed += META_SIZE + block->dataSize;
+  statsFreeBlockAdded(block->dataSize);
+#ifdef USE_FREE_INDEX
+  freeIndexInsert(&list->index, block);
+#endif
 }
 
 void removeFromFreeList(FreeList* list, MemoryBlock* toRemove) {
@@ -71,15 +92,23 @@ void removeFromFreeList(FreeList* list, MemoryBlock* toRemove) {
     toRemove->next->prev = toRemove->prev;
   }
 
+  if (toRemove == compactCursor) {
+    compactCursor = toRemove->prev;
+  }
   toRemove->prev = NULL;
   toRemove->next = NULL;
   toRemove->allocated = true;
+  heap_info.totalFreed -= META_SIZE + toRemove->dataSize;
+  statsFreeBlockRemoved(toRemove->dataSize);
+#ifdef USE_FREE_INDEX
+  freeIndexRemove(&list->index, toRemove);
+#endif
 }
 
 
 void* allocateMemory(size_t dataSize) {
   size_t totalSize = dataSize + META_SIZE;
-  MemoryBlock* allocated = sbrk(totalSize);
+  MemoryBlock* allocated = heapExtend(totalSize);
 
   if (allocated == (void*)(-1) || errno == ENOMEM) {
     fprintf(stderr, "sbrk failed to allocate memory\n");
@@ -87,23 +116,40 @@ void* allocateMemory(size_t dataSize) {
   }
 
   initializeMemoryBlock(allocated, dataSize, true);
+  heapSegmentGrown(allocated, totalSize);
   heap_info.totalAllocated += totalSize;
+  heap_stats.sbrkCalls++;
   return allocated + 1;  //Return the pointer to the start of the actual data not the metadata. This pointer arithmetic is essentially equal to (char *)allocatedBlock + META_SIZE
 }
 
+void resizeFreeBlock(MemoryBlock * block, size_t dataSize) {
+  heap_info.totalFreed += dataSize;
+  heap_info.totalFreed -= block->dataSize;
+  statsFreeBlockRemoved(block->dataSize);
+  statsFreeBlockAdded(dataSize);
+  block->dataSize = dataSize;
+#ifdef USE_FREE_INDEX
+  freeIndexUpdate(&freeListOf(block)->index, block);
+#endif
+}
+
+FreeList * freeListOf(MemoryBlock * block) {
+  return block->region == HEAP_LONG_LIVED ? &longLivedList : &freeList;
+}
+
 MemoryBlock* splitMemoryBlock(MemoryBlock* block, size_t dataSize) {
-  if (block->dataSize < META_SIZE + dataSize) {
-      heap_info.totalFreed -= (META_SIZE + block->dataSize);
-      removeFromFreeList(&freeList, block);
+  FreeList * list = freeListOf(block);
+  if (block->dataSize <= META_SIZE + dataSize) {
+      removeFromFreeList(list, block);
   } else {
       MemoryBlock * remainingBlock = (MemoryBlock *)((char*)(block + 1) + dataSize);
       size_t remainingSize = block->dataSize - dataSize - META_SIZE;
+      resizeFreeBlock(block, dataSize);
       initializeMemoryBlock(remainingBlock, remainingSize, false);
-      block->dataSize = dataSize;
-      block->allocated = true;
-      insertIntoFreeList(&freeList, remainingBlock, block);
-      removeFromFreeList(&freeList, block);
-      heap_info.totalFreed -= (META_SIZE + dataSize);
+      remainingBlock->region = block->region;
+      insertIntoFreeList(list, remainingBlock, block);
+      removeFromFreeList(list, block);
+      heap_stats.splits++;
   }
   return block;
 }
@@ -111,52 +157,103 @@ MemoryBlock* splitMemoryBlock(MemoryBlock* block, size_t dataSize) {
 void coalesceWithLeft(MemoryBlock* block) {
   if (block->prev && (char*)block == (char*)block->prev + META_SIZE + block->prev->dataSize) {
     MemoryBlock * leftBlock = block->prev;
-    leftBlock->dataSize += META_SIZE + block->dataSize;
-    removeFromFreeList(&freeList, block);
+    removeFromFreeList(freeListOf(block), block);
+    resizeFreeBlock(leftBlock, leftBlock->dataSize + META_SIZE + block->dataSize);
+    heap_stats.coalesces++;
   }
 }
 
 void coalesceWithRight(MemoryBlock* block) {
   if (block->next && (char*)block->next == (char*)block + META_SIZE + block->dataSize) {
     MemoryBlock * rightBlock = block->next;
-    block->dataSize += META_SIZE + rightBlock->dataSize;
-    removeFromFreeList(&freeList, rightBlock);
+    removeFromFreeList(freeListOf(block), rightBlock);
+    resizeFreeBlock(block, block->dataSize + META_SIZE + rightBlock->dataSize);
+    heap_stats.coalesces++;
   }
 }
 
-void freeMemoryBlock(MemoryBlock * block) {
+void trimHeap(FreeList * list) {
+  MemoryBlock * top = list->tail;
+  if (top == NULL || (char*)(top + 1) + top->dataSize != (char*)heapBreak()) {
+    return;
+  }
+  char * end = (char*)(top + 1) + top->dataSize;
+  if (trimFloor <= (char*)top) {
+    if (top->dataSize < TRIM_THRESHOLD) {
+      return;
+    }
+    size_t totalSize = META_SIZE + top->dataSize;
+    heapSegmentShrunk(end, totalSize);
+    removeFromFreeList(list, top);
+    heapRetract(totalSize);
+    heap_info.totalAllocated -= totalSize;
+  } else if (end - trimFloor >= TRIM_THRESHOLD) {
+    /* Part of the block is reserved: trim only what lies above the floor. */
+    size_t totalSize = end - trimFloor;
+    heapSegmentShrunk(end, totalSize);
+    resizeFreeBlock(top, top->dataSize - totalSize);
+    heapRetract(totalSize);
+    heap_info.totalAllocated -= totalSize;
+  }
+}
+
+MemoryBlock * insertFreedBlock(MemoryBlock * block, MemoryBlock * below) {
+  FreeList * list = freeListOf(block);
   block->allocated = false;
-  heap_info.totalFreed += block->dataSize + META_SIZE;
-  if (isEmptyFreeList(&freeList) || block > freeList.tail) {
-    appendToFreeList(&freeList, block);
-    bool coalesce = (!isEmptyFreeList(&freeList) && block > freeList.tail)? true : false;
-    if (coalesce) {
-      coalesceWithLeft(block);
+  if (isEmptyFreeList(list) || block > list->tail) {
+    appendToFreeList(list, block);
+    MemoryBlock * left = block->prev;
+    coalesceWithLeft(block);
+    if (left != NULL && (char*)(left + 1) + left->dataSize > (char*)block) {
+      return left;
     }
-  } else if (block < freeList.head) {
-    insertIntoFreeList(&freeList, block, NULL);
+  } else if (block < list->head) {
+    insertIntoFreeList(list, block, NULL);
     coalesceWithRight(block);
   }
    else {
-      MemoryBlock * iter = freeList.head;
+#ifdef USE_FREE_INDEX
+      (void)below;
+      MemoryBlock * curr = freeIndexPredecessor(&list->index, block);
+#else
+      MemoryBlock * iter = below != NULL ? below : list->head;
       while (iter < block) {
         iter = iter->next;
       }
       MemoryBlock * curr = iter->prev;
-      insertIntoFreeList(&freeList, block, curr);
+#endif
+      insertIntoFreeList(list, block, curr);
       coalesceWithRight(block);
       coalesceWithLeft(block);
+      if (curr != NULL && (char*)(curr + 1) + curr->dataSize > (char*)block) {
+        return curr;
+      }
   }
+  return block;
+}
+
+void freeMemoryBlock(MemoryBlock * block) {
+  FreeList * list = freeListOf(block);
+  insertFreedBlock(block, NULL);
+  trimHeap(list);
 }
 
 void * ff_malloc(size_t size) {
     if (size == 0) { return NULL; }
+    TRACE_BEGIN(TRACE_FF_MALLOC);
+    asyncFreeLock();
+    statsAllocationRequested(size);
+#ifdef USE_FREE_INDEX
+    MemoryBlock * curr = freeIndexFirstFit(&freeList.index, size, NULL);
+#else
     MemoryBlock * curr = freeList.head;
     curr = findFirstFit(curr, size);
-    if (curr != NULL) {
-        return splitMemoryBlock(curr, size) + 1;
-    }
-    return allocateMemory(size);
+#endif
+    void * ptr = curr != NULL ? (void *)(splitMemoryBlock(curr, size) + 1) : allocateMemory(size);
+    profileAllocated(ptr, size);
+    asyncFreeUnlock();
+    TRACE_END(TRACE_FF_MALLOC, size);
+    return ptr;
 }
 
 void ff_free (void * ptr) {
@@ -165,7 +262,22 @@ void ff_free (void * ptr) {
     }
     MemoryBlock * block = (MemoryBlock *)(ptr) - 1;
     if (block->allocated == true) {
-      freeMemoryBlock(block);
+      TRACE_BEGIN(TRACE_FREE);
+#ifdef MALLOC_TRACE
+      //read before freeMemoryBlock coalesces the block with its neighbours
+      size_t dataSize = block->dataSize;
+#endif
+      if (asyncFreeRunning) {
+        block->allocated = false;
+        asyncFreePush(block);
+      } else {
+        heap_stats.freeCalls++;
+        if (block->sampled) {
+          profileFreed(ptr);
+        }
+        freeMemoryBlock(block);
+      }
+      TRACE_END(TRACE_FREE, dataSize);
     }
 }
 MemoryBlock * findFirstFit(MemoryBlock * curr, size_t size) {
@@ -199,18 +311,131 @@ MemoryBlock * findBestFit(MemoryBlock * curr, size_t size){
 
 void* bf_malloc(size_t size) {
     if (size == 0) { return NULL; }
+    TRACE_BEGIN(TRACE_BF_MALLOC);
+    asyncFreeLock();
+    statsAllocationRequested(size);
+#ifdef USE_FREE_INDEX
+    MemoryBlock * bestFit = freeIndexBestFit(&freeList.index, size, NULL);
+#else
     MemoryBlock * current = freeList.head;
     MemoryBlock * bestFit = findBestFit(current, size);
-    if (bestFit != NULL) {
-        return splitMemoryBlock(current, size) + 1;
-      }
-    return allocateMemory(size);
+#endif
+    void * ptr = bestFit != NULL ? (void *)(splitMemoryBlock(bestFit, size) + 1) : allocateMemory(size);
+    profileAllocated(ptr, size);
+    asyncFreeUnlock();
+    TRACE_END(TRACE_BF_MALLOC, size);
+    return ptr;
 }
 
 void bf_free(void * ptr) {
   ff_free(ptr);
 }
 
+void * ad_malloc(size_t size) {
+    if (size == 0) { return NULL; }
+    TRACE_BEGIN(TRACE_AD_MALLOC);
+    asyncFreeLock();
+    statsAllocationRequested(size);
+    MemoryBlock * fit = adaptiveFindFit(&freeList, size);
+    void * ptr = fit != NULL ? (void *)(splitMemoryBlock(fit, size) + 1) : allocateMemory(size);
+    profileAllocated(ptr, size);
+    asyncFreeUnlock();
+    TRACE_END(TRACE_AD_MALLOC, size);
+    return ptr;
+}
+
+void ad_free(void * ptr) {
+  ff_free(ptr);
+}
+
+/*
+ * @brief Grows the long-lived region by at least LONG_LIVED_CHUNK bytes.
+ * @return The new free block, merged with the region's top block if the
+ * two are adjacent, or NULL if the heap could not grow.
+ */
+static MemoryBlock * growLongLivedRegion(size_t dataSize) {
+  size_t totalSize = dataSize + META_SIZE > LONG_LIVED_CHUNK ? dataSize + META_SIZE : LONG_LIVED_CHUNK;
+  MemoryBlock * chunk = heapExtend(totalSize);
+  if (chunk == (void*)(-1)) {
+    fprintf(stderr, "sbrk failed to allocate memory\n");
+    return NULL;
+  }
+  initializeMemoryBlock(chunk, totalSize - META_SIZE, false);
+  chunk->region = HEAP_LONG_LIVED;
+  heapSegmentGrown(chunk, totalSize);
+  heap_info.totalAllocated += totalSize;
+  heap_stats.sbrkCalls++;
+  appendToFreeList(&longLivedList, chunk);
+  MemoryBlock * left = chunk->prev;
+  coalesceWithLeft(chunk);
+  return longLivedList.tail != chunk ? left : chunk;
+}
+
+void * malloc_hint(size_t size, enum my_malloc_lifetime lifetime) {
+  if (lifetime != LIFETIME_LONG) {
+    return bf_malloc(size);
+  }
+  if (size == 0) { return NULL; }
+  asyncFreeLock();
+  statsAllocationRequested(size);
+#ifdef USE_FREE_INDEX
+  MemoryBlock * fit = freeIndexBestFit(&longLivedList.index, size, NULL);
+#else
+  MemoryBlock * fit = findBestFit(longLivedList.head, size);
+#endif
+  if (fit == NULL) {
+    fit = growLongLivedRegion(size);
+  }
+  void * ptr = fit != NULL ? (void *)(splitMemoryBlock(fit, size) + 1) : NULL;
+  profileAllocated(ptr, size);
+  asyncFreeUnlock();
+  return ptr;
+}
+
+static int reserveHeap(size_t bytes, bool populate) {
+  MemoryBlock * top = freeList.tail;
+  char * heapEnd = heapBreak();
+  size_t available = 0;
+  if (top != NULL && (char*)(top + 1) + top->dataSize == heapEnd) {
+    available = META_SIZE + top->dataSize;
+  }
+  if (bytes > available) {
+    size_t totalSize = bytes - available > META_SIZE ? bytes - available : META_SIZE + 1;
+    MemoryBlock * chunk = heapExtend(totalSize);
+    if (chunk == (void*)(-1)) {
+      return -1;
+    }
+    initializeMemoryBlock(chunk, totalSize - META_SIZE, false);
+    heapSegmentGrown(chunk, totalSize);
+    heap_info.totalAllocated += totalSize;
+    heap_stats.sbrkCalls++;
+    appendToFreeList(&freeList, chunk);
+    coalesceWithLeft(chunk);
+    top = freeList.tail;
+    heapEnd = (char*)chunk + totalSize;
+  }
+  trimFloor = heapEnd;
+  if (populate && top != NULL) {
+    /* Fault in the top free block's pages now rather than on first use. */
+    char * start = (char*)(top + 1);
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    char * first = (char*)(((uintptr_t)start + pageSize - 1) & ~(uintptr_t)(pageSize - 1));
+    if (first < heapEnd && madvise(first, heapEnd - first, MADV_POPULATE_WRITE) != 0) {
+      for (char * page = first; page < heapEnd; page += pageSize) {
+        *(volatile char *)page = 0;   /* kernels before 5.14 */
+      }
+    }
+  }
+  return 0;
+}
+
+int my_malloc_reserve(size_t bytes, bool populate) {
+  asyncFreeLock();
+  int result = reserveHeap(bytes, populate);
+  asyncFreeUnlock();
+  return result;
+}
+
 unsigned long get_data_segment_size() {
   return heap_info.totalAllocated;
 }
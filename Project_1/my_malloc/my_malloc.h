@@ -7,18 +7,32 @@
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include "adaptive.h"
+#include "async_free.h"
+#include "free_index.h"
+#include "handles.h"
+#include "heap_backing.h"
+#include "pheap.h"
+#include "profile.h"
+#include "shm_heap.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 
 /**
  * Represents a block of memory in a memory allocation system.
  *
  * The MemoryBlock structure is used to represent a block of memory that can be
  * allocated or deallocated. It contains information about the size of the data
- * stored in the block, the allocation status, and pointers to the previous and
- * next blocks in the linked list.
+ * stored in the block, the allocation status, the heap region it belongs to,
+ * the halloc() handle that owns it, if any, and pointers to the previous and next blocks in the linked list.
  */
 struct MemoryBlock {
   size_t dataSize;             /**< Size of the data stored in the block. */
   bool allocated;              /**< Indicates whether the block is currently allocated. */
+  unsigned char region;        /**< HEAP_MAIN or HEAP_LONG_LIVED; sits in what was padding. */
+  bool sampled;                /**< Recorded by the heap profiler; also in the padding. */
+  uint32_t handle;             /**< Owning halloc() handle, or HANDLE_NULL; also in the padding. */
   struct MemoryBlock * prev;    /**< Pointer to the previous MemoryBlock in the linked list. */
   struct MemoryBlock * next;    /**< Pointer to the next MemoryBlock in the linked list. */
 };
@@ -27,15 +41,40 @@ typedef struct MemoryBlock MemoryBlock; /**< Typedef for the MemoryBlock structu
 
 /*
  * @brief Linked list structure to manage free blocks in the heap.
+ * When built with -DUSE_FREE_INDEX the list also maintains a dense,
+ * address-ordered FreeIndex of its blocks for SIMD fit searches.
  */
 struct FreeList {
   MemoryBlock* head;
   MemoryBlock* tail;
+#ifdef USE_FREE_INDEX
+  FreeIndex index;
+#endif
 };
 typedef struct FreeList FreeList;
 
 #define META_SIZE sizeof(MemoryBlock)
 
+/*
+ * @brief Heap regions. Blocks only ever coalesce with blocks of their own
+ * region, each of which has its own free list.
+ */
+enum heapRegion {
+  HEAP_MAIN,          /* ff/bf/ad_malloc and short-lived hinted allocations */
+  HEAP_LONG_LIVED     /* long-lived hinted allocations */
+};
+
+/*
+ * @brief Lifetime hints for malloc_hint().
+ */
+enum my_malloc_lifetime {
+  LIFETIME_SHORT,
+  LIFETIME_LONG
+};
+
+#define LONG_LIVED_CHUNK  (64 * 1024)    /* bytes the long-lived region grows by */
+#define TRIM_THRESHOLD    (128 * 1024)   /* free bytes at the break worth returning */
+
 /*
  * @brief Global variables to track heap information.
  */
@@ -54,7 +93,7 @@ bool isEmptyFreeList (FreeList * freeList);
 
 
 /*
- * @brief Initializes block metadata.
+ * @brief Initializes block metadata, in the main region.
  * @param block: Pointer to the block metadata.
  * @param dataSize: Size of the data in the block.
  * @param allocated: Allocation status of the block.
@@ -83,6 +122,18 @@ void appendToFreeList(FreeList* list, MemoryBlock* block);
  */
 MemoryBlock * findFirstFit(MemoryBlock * curr, size_t size);
 
+/*
+ * This function searches the linked list starting from the given 'curr' block
+ * for the smallest MemoryBlock that can accommodate the specified 'size'. An
+ * exact fit ends the search early.
+ *
+ * @param curr  Pointer to the starting MemoryBlock in the linked list.
+ * @param size  The size of the memory space required.
+ * @return      Pointer to the best-fitting MemoryBlock, or NULL if no suitable
+ *              block is found.
+ */
+MemoryBlock * findBestFit(MemoryBlock * curr, size_t size);
+
 /*
  * This function inserts the specified MemoryBlock into the given FreeList.
  * If the FreeList is empty, the inserted block becomes both the head and tail
@@ -106,6 +157,14 @@ void insertIntoFreeList(FreeList *list, MemoryBlock *block, MemoryBlock * curr);
  */
 void removeFromFreeList(FreeList* list, MemoryBlock* toRemove);
 
+/*
+ * @brief Changes the size of a block that stays in the free list, keeping the
+ * heap accounting (and the free index, when enabled) in step.
+ * @param block: Pointer to the free block.
+ * @param dataSize: New size of the data in the block.
+ */
+void resizeFreeBlock(MemoryBlock * block, size_t dataSize);
+
 /*
  * @brief Allocates memory.
  * @param dataSize: Size of the data to be allocated.
@@ -133,20 +192,45 @@ void coalesceWithLeft(MemoryBlock* block);
 void coalesceWithRight(MemoryBlock* block);
 
 
+/*
+ * @brief Returns the free list of the region a block belongs to.
+ */
+FreeList * freeListOf(MemoryBlock * block);
+
+/*
+ * @brief Gives the top free block of a list back to the system if it ends
+ * at the program break and holds at least TRIM_THRESHOLD bytes.
+ * @param list: Free list whose tail is checked.
+ */
+void trimHeap(FreeList * list);
+
 /*
  * Frees a MemoryBlock and updates the free list, performing coalescing if needed.
 
  * This function marks the specified MemoryBlock as unallocated, updates the total
- * freed memory in the heap_info structure, and adds the block to the free list. If
+ * freed memory in the heap_info structure, and adds the block to its region's free list. If
  * the free list is empty or the block is at the end of the free list, the block is
  * appended to the list. If the block is at the beginning, it is inserted at the start.
  * If the block is in the middle, it is inserted after the suitable block in the list.
- * Coalescing with neighboring free blocks is performed to merge contiguous free blocks.
+ * Coalescing with neighboring free blocks is performed to merge contiguous free blocks,
+ * and the heap is trimmed if that leaves enough free space at its top.
  *
  * @param block Pointer to the MemoryBlock to be freed.
  */
 void freeMemoryBlock(MemoryBlock* block);
 
+/*
+ * @brief Frees a block like freeMemoryBlock, but leaves the heap untrimmed
+ * and, without the free index, looks for the block's place in the free
+ * list starting from 'below'.
+ * @param block: The block to free.
+ * @param below: A free block of the same region lower in memory, or NULL
+ * to search from the head of the list.
+ * @return The free block now holding block's memory: block itself, or the
+ * block it was merged into.
+ */
+MemoryBlock * insertFreedBlock(MemoryBlock * block, MemoryBlock * below);
+
 /*
  * @brief First-fit memory allocation.
  * @param size: Size of the data needed.
@@ -173,6 +257,54 @@ void* bf_malloc(size_t size);
  */
 void bf_free(void* ptr);
 
+/*
+ * @brief Adaptive memory allocation: first fit or (bounded) best fit,
+ * chosen at run time from the observed search lengths and fragmentation.
+ * See adaptive.h.
+ * @param size: Size of the data needed.
+ * @return Pointer to the allocated memory.
+ */
+void* ad_malloc(size_t size);
+
+/*
+ * @brief Adaptive memory deallocation.
+ * @param toFree: Pointer to the memory block to be deallocated.
+ */
+void ad_free(void* ptr);
+
+/*
+ * @brief Lifetime-hinted allocation.
+ *
+ * A single long-lived object left among short-lived ones keeps its
+ * neighbours from ever coalescing. Long-lived requests are therefore
+ * placed, best fit, in a separate region that grows in LONG_LIVED_CHUNK
+ * pieces, and short-lived ones go to the main heap as with bf_malloc. Runs
+ * of short-lived objects can then empty out completely, coalesce, and,
+ * when they end at the top of the heap, be trimmed. Free with any of the
+ * *_free functions; blocks remember their region.
+ * @param size: Size of the data needed.
+ * @param lifetime: LIFETIME_SHORT or LIFETIME_LONG.
+ * @return Pointer to the allocated memory.
+ */
+void* malloc_hint(size_t size, enum my_malloc_lifetime lifetime);
+
+/*
+ * @brief Grows the heap ahead of time.
+ *
+ * Makes sure the main heap ends in a free block of at least 'bytes'
+ * (headers included), growing it if needed, so the next allocations are
+ * carved out of it instead of growing the heap one request at a time.
+ * trimHeap() never shrinks the heap below the end of that block again.
+ * With 'populate', the block's pages are faulted in now
+ * (madvise(MADV_POPULATE_WRITE), or touching each page on kernels
+ * without it), so the first requests served from it do not take a page
+ * fault per 4 KB.
+ * @param bytes: Free bytes wanted at the top of the heap.
+ * @param populate: Whether to prefault them.
+ * @return 0 on success, -1 if the heap could not grow.
+ */
+int my_malloc_reserve(size_t bytes, bool populate);
+
 /*
  * @brief Gets the total size of the data segment.
  * @return Total size of the data segment.
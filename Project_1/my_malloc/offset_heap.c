@@ -0,0 +1,176 @@
+#include "offset_heap.h"
+
+typedef struct OffsetBlock OffsetBlock;
+
+static OffsetBlock * blockAt(struct OffsetHeap * heap, uint64_t offset) {
+  return offset != 0 ? (OffsetBlock *)(heap->base + offset) : NULL;
+}
+
+static uint64_t offsetOf(struct OffsetHeap * heap, OffsetBlock * block) {
+  return block != NULL ? (uint64_t)((char *)block - heap->base) : 0;
+}
+
+/*
+ * @brief Links a block into the free list after 'before', or at the head
+ * if 'before' is NULL.
+ */
+static void insertFreeBlock(struct OffsetHeap * heap, OffsetBlock * block, OffsetBlock * before) {
+  struct OffsetHeapState * state = heap->state;
+  uint64_t offset = offsetOf(heap, block);
+  OffsetBlock * after = before != NULL ? blockAt(heap, before->next) : blockAt(heap, state->freeHead);
+  block->prev = offsetOf(heap, before);
+  block->next = offsetOf(heap, after);
+  if (before != NULL) {
+    before->next = offset;
+  } else {
+    state->freeHead = offset;
+  }
+  if (after != NULL) {
+    after->prev = offset;
+  } else {
+    state->freeTail = offset;
+  }
+  block->allocated = 0;
+  state->totalFreed += OFFSET_HEAP_META_SIZE + block->dataSize;
+}
+
+static void removeFreeBlock(struct OffsetHeap * heap, OffsetBlock * block) {
+  struct OffsetHeapState * state = heap->state;
+  OffsetBlock * before = blockAt(heap, block->prev);
+  OffsetBlock * after = blockAt(heap, block->next);
+  if (before != NULL) {
+    before->next = block->next;
+  } else {
+    state->freeHead = block->next;
+  }
+  if (after != NULL) {
+    after->prev = block->prev;
+  } else {
+    state->freeTail = block->prev;
+  }
+  block->prev = 0;
+  block->next = 0;
+  block->allocated = 1;
+  state->totalFreed -= OFFSET_HEAP_META_SIZE + block->dataSize;
+}
+
+/*
+ * @brief Merges a free block with the next one on the list if the two are
+ * adjacent.
+ */
+static void coalesceWithNext(struct OffsetHeap * heap, OffsetBlock * block) {
+  OffsetBlock * next = blockAt(heap, block->next);
+  if (next == NULL || (char *)next != (char *)(block + 1) + block->dataSize) {
+    return;
+  }
+  removeFreeBlock(heap, next);
+  block->dataSize += OFFSET_HEAP_META_SIZE + next->dataSize;
+  heap->state->totalFreed += OFFSET_HEAP_META_SIZE + next->dataSize;
+}
+
+void offsetHeapInit(struct OffsetHeap * heap, uint64_t first, uint64_t size) {
+  struct OffsetHeapState * state = heap->state;
+  state->size = size;
+  state->freeHead = 0;
+  state->freeTail = 0;
+  state->totalFreed = 0;
+  OffsetBlock * block = blockAt(heap, first);
+  block->dataSize = size - first - OFFSET_HEAP_META_SIZE;
+  insertFreeBlock(heap, block, NULL);
+}
+
+void offsetHeapExtend(struct OffsetHeap * heap, uint64_t bytes) {
+  /* Header first, size last: a crash in between leaves the region longer
+   * than the heap, which is harmless. */
+  OffsetBlock * block = blockAt(heap, heap->state->size);
+  block->dataSize = bytes - OFFSET_HEAP_META_SIZE;
+  heap->state->size += bytes;
+  OffsetBlock * last = blockAt(heap, heap->state->freeTail);
+  insertFreeBlock(heap, block, last);
+  if (last != NULL) {
+    coalesceWithNext(heap, last);
+  }
+}
+
+void * offsetHeapMalloc(struct OffsetHeap * heap, size_t size) {
+  /* No block is larger than the region; checking first also keeps the
+   * rounding below from wrapping sizes near SIZE_MAX to 0. */
+  if (size == 0 || size > heap->state->size) {
+    return NULL;
+  }
+  size = (size + OFFSET_HEAP_ALIGN - 1) / OFFSET_HEAP_ALIGN * OFFSET_HEAP_ALIGN;
+  OffsetBlock * bestFit = NULL;
+  for (OffsetBlock * curr = blockAt(heap, heap->state->freeHead); curr != NULL; curr = blockAt(heap, curr->next)) {
+    if (curr->dataSize >= size && (bestFit == NULL || curr->dataSize < bestFit->dataSize)) {
+      bestFit = curr;
+      if (curr->dataSize == size) {
+        break;
+      }
+    }
+  }
+  if (bestFit == NULL) {
+    return NULL;
+  }
+  if (bestFit->dataSize >= size + OFFSET_HEAP_META_SIZE + OFFSET_HEAP_ALIGN) {
+    /* Remainder header first, so a crash before the resize leaves the
+     * remainder inside bestFit rather than two blocks overlapping. */
+    OffsetBlock * remainder = (OffsetBlock *)((char *)(bestFit + 1) + size);
+    remainder->dataSize = bestFit->dataSize - size - OFFSET_HEAP_META_SIZE;
+    heap->state->totalFreed -= bestFit->dataSize - size;
+    bestFit->dataSize = size;
+    insertFreeBlock(heap, remainder, bestFit);
+  }
+  removeFreeBlock(heap, bestFit);
+  return bestFit + 1;
+}
+
+void offsetHeapFree(struct OffsetHeap * heap, void * ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  OffsetBlock * block = (OffsetBlock *)ptr - 1;
+  if (!block->allocated) {
+    return;
+  }
+  OffsetBlock * before = blockAt(heap, heap->state->freeTail);
+  if (before != NULL && before > block) {
+    OffsetBlock * curr = blockAt(heap, heap->state->freeHead);
+    before = NULL;
+    while (curr < block) {
+      before = curr;
+      curr = blockAt(heap, curr->next);
+    }
+  }
+  insertFreeBlock(heap, block, before);
+  coalesceWithNext(heap, block);
+  if (before != NULL) {
+    coalesceWithNext(heap, before);
+  }
+}
+
+bool offsetHeapRebuild(struct OffsetHeap * heap, uint64_t first) {
+  struct OffsetHeapState * state = heap->state;
+  state->freeHead = 0;
+  state->freeTail = 0;
+  state->totalFreed = 0;
+  OffsetBlock * last = NULL;
+  uint64_t offset = first;
+  while (offset < state->size) {
+    OffsetBlock * block = blockAt(heap, offset);
+    if (state->size - offset < OFFSET_HEAP_META_SIZE || block->dataSize > state->size - offset - OFFSET_HEAP_META_SIZE) {
+      return false;
+    }
+    offset += OFFSET_HEAP_META_SIZE + block->dataSize;
+    if (block->allocated) {
+      continue;
+    }
+    if (last != NULL && (char *)block == (char *)(last + 1) + last->dataSize) {
+      last->dataSize += OFFSET_HEAP_META_SIZE + block->dataSize;
+      state->totalFreed += OFFSET_HEAP_META_SIZE + block->dataSize;
+    } else {
+      insertFreeBlock(heap, block, last);
+      last = block;
+    }
+  }
+  return offset == state->size;
+}
@@ -0,0 +1,92 @@
+#ifndef __MY_MALLOC_OFFSET_HEAP__
+#define __MY_MALLOC_OFFSET_HEAP__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Position-independent heap core shared by the persistent heap (pheap.h)
+ * and the shared-memory heap (shm_heap.h).
+ *
+ * The heap lives in a region that may be mapped at a different address in
+ * each process, or in each run. Its free-list state and every block's
+ * links are therefore stored as offsets from the start of the region, with
+ * 0 meaning none (the region always starts with its owner's header, so no
+ * block is at offset 0). The algorithm is bf_malloc's: best fit over an
+ * address-ordered free list, split when the remainder can hold a header,
+ * coalesce on free.
+ *
+ * Headers are written in an order that keeps the blocks walkable from the
+ * first one at any point (a split writes the remainder's header before
+ * shrinking the block), so after a crash the free list can be rebuilt
+ * with offsetHeapRebuild().
+ *
+ * None of this locks; the owners do.
+ */
+
+#define OFFSET_HEAP_ALIGN 16   /* alignment of sizes and returned pointers */
+
+/*
+ * @brief Free-list state, kept inside the region it describes.
+ */
+struct OffsetHeapState {
+  uint64_t size;          /* bytes of region the blocks may use, from its start */
+  uint64_t freeHead;      /* offsets of the first and last free blocks, 0 if none */
+  uint64_t freeTail;
+  uint64_t totalFreed;    /* bytes in free blocks, headers included */
+};
+
+struct OffsetBlock {
+  uint64_t dataSize;
+  uint32_t allocated;
+  uint32_t reserved;
+  uint64_t prev;          /* free-list links, as offsets; 0 for none */
+  uint64_t next;
+};
+
+#define OFFSET_HEAP_META_SIZE sizeof(struct OffsetBlock)
+
+/*
+ * @brief A process's view of an offset heap: where the region is mapped
+ * here, and where in it the state is.
+ */
+struct OffsetHeap {
+  char * base;
+  struct OffsetHeapState * state;
+};
+
+/*
+ * @brief Lays out an empty heap: one free block from 'first' to 'size'.
+ * @param first: Offset of the first block, a multiple of OFFSET_HEAP_ALIGN.
+ * @param size: Bytes of region the heap may use.
+ */
+void offsetHeapInit(struct OffsetHeap * heap, uint64_t first, uint64_t size);
+
+/*
+ * @brief Adds the 'bytes' after the end of the heap, already mapped by the
+ * caller, as a free block merged with the last one if they touch.
+ */
+void offsetHeapExtend(struct OffsetHeap * heap, uint64_t bytes);
+
+/*
+ * @brief Best-fit allocation.
+ * @param size: Size of the data needed, rounded up to OFFSET_HEAP_ALIGN.
+ * @return Pointer to the data, or NULL if size is 0, exceeds the region or
+ * no free block fits.
+ */
+void * offsetHeapMalloc(struct OffsetHeap * heap, size_t size);
+
+/*
+ * @brief Frees a block from offsetHeapMalloc; NULL and blocks that are
+ * already free are ignored.
+ */
+void offsetHeapFree(struct OffsetHeap * heap, void * ptr);
+
+/*
+ * @brief Rebuilds the free list by walking every block header from
+ * 'first', merging adjacent free blocks.
+ * @return false if a header runs past the end of the heap.
+ */
+bool offsetHeapRebuild(struct OffsetHeap * heap, uint64_t first);
+
+#endif
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include "pheap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct PersistentHeapHeader * header = NULL;   /* PHEAP_BASE while a heap is open */
+static struct OffsetHeap heap;
+static int heapFd = -1;
+
+static size_t roundUp(size_t size, size_t unit) {
+  return (size + unit - 1) / unit * unit;
+}
+
+/*
+ * @brief Extends the file by at least 'bytes' and maps the new part right
+ * after the region.
+ * @return false if the file or the mapping could not grow.
+ */
+static bool growHeap(size_t bytes) {
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  uint64_t oldSize = header->state.size;
+  /* The new file size must stay a valid off_t after rounding to pages */
+  if (bytes > (uint64_t)PTRDIFF_MAX - oldSize - pageSize) {
+    return false;
+  }
+  bytes = roundUp(bytes > PHEAP_GROW ? bytes : PHEAP_GROW, pageSize);
+  if (ftruncate(heapFd, oldSize + bytes) != 0) {
+    return false;
+  }
+  char * wanted = heap.base + oldSize;
+  void * mapped = mmap(wanted, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, heapFd, oldSize);
+  if (mapped != wanted) {
+    if (mapped != MAP_FAILED) {
+      munmap(mapped, bytes);
+    }
+    ftruncate(heapFd, oldSize);
+    return false;
+  }
+  offsetHeapExtend(&heap, bytes);
+  return true;
+}
+
+int pheap_open(const char * path, size_t size) {
+  if (header != NULL) {
+    errno = EBUSY;
+    return PHEAP_ERROR;
+  }
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    return PHEAP_ERROR;
+  }
+  struct stat st;
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+    if (errno == EWOULDBLOCK) {
+      errno = EBUSY;
+    }
+    close(fd);
+    return PHEAP_ERROR;
+  }
+  bool created = st.st_size == 0;
+  size_t length = st.st_size;
+  if (created) {
+    size_t minimum = sizeof(struct PersistentHeapHeader) + OFFSET_HEAP_META_SIZE + PHEAP_ALIGN;
+    length = roundUp(size > minimum ? size : minimum, sysconf(_SC_PAGESIZE));
+    if (ftruncate(fd, length) != 0) {
+      close(fd);
+      return PHEAP_ERROR;
+    }
+  } else if (length < sizeof(struct PersistentHeapHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return PHEAP_ERROR;
+  }
+
+  void * mapped = mmap((void *)PHEAP_BASE, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+  if (mapped != (void *)PHEAP_BASE) {
+    if (mapped != MAP_FAILED) {
+      munmap(mapped, length);   /* kernels without MAP_FIXED_NOREPLACE take it as a hint */
+    }
+    close(fd);
+    errno = EEXIST;
+    return PHEAP_ERROR;
+  }
+  header = mapped;
+  heap.base = mapped;
+  heap.state = &header->state;
+  heapFd = fd;
+
+  int result;
+  if (created) {
+    memcpy(header->magic, PHEAP_MAGIC, sizeof(header->magic));
+    offsetHeapInit(&heap, sizeof(struct PersistentHeapHeader), length);
+    result = PHEAP_CREATED;
+  } else if (memcmp(header->magic, PHEAP_MAGIC, sizeof(header->magic)) != 0 || header->state.size > length
+             || (!header->clean && !offsetHeapRebuild(&heap, sizeof(struct PersistentHeapHeader)))) {
+    munmap(header, length);
+    close(fd);
+    header = NULL;
+    heapFd = -1;
+    errno = EINVAL;
+    return PHEAP_ERROR;
+  } else {
+    result = header->clean ? PHEAP_REOPENED : PHEAP_RECOVERED;
+    if (header->state.size < length) {
+      /* A grow that did not finish: give the tail back so the next one
+       * can map there. */
+      munmap(heap.base + header->state.size, length - header->state.size);
+      ftruncate(fd, header->state.size);
+    }
+  }
+  header->clean = 0;
+  msync(header, sysconf(_SC_PAGESIZE), MS_SYNC);
+  return result;
+}
+
+int pheap_close() {
+  if (header == NULL) {
+    return 0;
+  }
+  size_t length = header->state.size;
+  int result = msync(header, length, MS_SYNC);
+  if (result == 0) {
+    header->clean = 1;
+    result = msync(header, sysconf(_SC_PAGESIZE), MS_SYNC);
+  }
+  munmap(header, length);
+  close(heapFd);
+  header = NULL;
+  heapFd = -1;
+  return result == 0 ? 0 : -1;
+}
+
+void * pheap_malloc(size_t size) {
+  /* Bounded before any rounding, which would wrap sizes near SIZE_MAX */
+  if (size == 0 || header == NULL || size > PTRDIFF_MAX) {
+    return NULL;
+  }
+  void * ptr = offsetHeapMalloc(&heap, size);
+  if (ptr == NULL && growHeap(roundUp(size, PHEAP_ALIGN) + OFFSET_HEAP_META_SIZE)) {
+    ptr = offsetHeapMalloc(&heap, size);
+  }
+  return ptr;
+}
+
+void pheap_free(void * ptr) {
+  if (header != NULL) {
+    offsetHeapFree(&heap, ptr);
+  }
+}
+
+void pheap_set_root(void * ptr) {
+  if (header != NULL) {
+    header->root = pheap_offset(ptr);
+  }
+}
+
+void * pheap_get_root() {
+  return header != NULL ? pheap_pointer(header->root) : NULL;
+}
+
+uint64_t pheap_offset(const void * ptr) {
+  return ptr != NULL ? (uint64_t)((const char *)ptr - heap.base) : 0;
+}
+
+void * pheap_pointer(uint64_t offset) {
+  return offset != 0 ? heap.base + offset : NULL;
+}
+
+size_t pheap_size() {
+  return header != NULL ? header->state.size : 0;
+}
+
+size_t pheap_free_space_size() {
+  return header != NULL ? header->state.totalFreed : 0;
+}
@@ -0,0 +1,112 @@
+#ifndef __MY_MALLOC_PHEAP__
+#define __MY_MALLOC_PHEAP__
+#include <stddef.h>
+#include <stdint.h>
+#include "offset_heap.h"
+
+/*
+ * File-backed persistent heap.
+ *
+ * pheap_open() maps a file at the fixed address PHEAP_BASE and manages it
+ * as an offset heap (offset_heap.h) of its own, separate from the sbrk
+ * heap. The file starts with a PersistentHeapHeader and every block header
+ * stores its free-list links as offsets from the start of the region, so
+ * the allocator state is position independent and nothing in the file
+ * refers to the process that wrote it. Application data inside the heap can keep
+ * plain pointers as long as the file is always mapped at PHEAP_BASE, or
+ * use pheap_offset()/pheap_pointer() to stay independent of it.
+ *
+ * A restarted process reopens the file and finds its data structures
+ * through the root pointer (pheap_set_root()/pheap_get_root()), with a
+ * single mmap and no rebuild. The header carries a clean-shutdown flag,
+ * cleared while the heap is open and set again by pheap_close(). If the
+ * previous process died with the heap open, pheap_open() rebuilds the
+ * free list by walking the block headers and reports PHEAP_RECOVERED: the
+ * allocator is consistent again, the application data is as the process
+ * left it.
+ *
+ * The heap grows by extending the file and mapping the new part right
+ * after the old one, in at least PHEAP_GROW bytes at a time, and is
+ * single-threaded. One persistent heap can be open at a time, and a file
+ * can be open in one process at a time (pheap_open() takes an flock).
+ */
+
+#define PHEAP_MAGIC   "MMPHEAP1"
+#ifndef PHEAP_BASE
+#define PHEAP_BASE    ((uintptr_t)0x600000000000)   /* where the file is mapped */
+#endif
+#define PHEAP_GROW    (1024 * 1024)                 /* minimum growth of the file, bytes */
+#define PHEAP_ALIGN   OFFSET_HEAP_ALIGN             /* alignment of returned pointers */
+
+struct PersistentHeapHeader {
+  char magic[8];                  /* PHEAP_MAGIC, not NUL-terminated */
+  struct OffsetHeapState state;   /* state.size is the bytes in the file */
+  uint64_t root;                  /* offset of the application's root object, 0 if none */
+  uint32_t clean;                 /* 1 if the heap was closed with pheap_close() */
+  uint32_t reserved;
+  uint64_t padding[1];            /* the first block header starts 64 bytes in */
+};
+
+enum pheap_open_result {
+  PHEAP_ERROR = -1,       /* errno is set */
+  PHEAP_CREATED = 0,      /* new, empty heap */
+  PHEAP_REOPENED = 1,     /* closed cleanly last time */
+  PHEAP_RECOVERED = 2     /* not closed cleanly; free list rebuilt */
+};
+
+/*
+ * @brief Opens or creates a persistent heap.
+ * @param path: File backing the heap.
+ * @param size: Initial size of a new file; ignored when the file exists.
+ * @return One of pheap_open_result. Fails with EEXIST if something else
+ * is mapped at PHEAP_BASE, EINVAL if the file is not a heap or its block
+ * headers are inconsistent, EBUSY if a heap is already open here or the
+ * file is open in another process.
+ */
+int pheap_open(const char * path, size_t size);
+
+/*
+ * @brief Flushes the heap to its file, marks it clean and unmaps it.
+ * @return 0 on success, -1 if flushing failed.
+ */
+int pheap_close();
+
+/*
+ * @brief Allocates from the persistent heap.
+ * @param size: Size of the data needed.
+ * @return PHEAP_ALIGN-aligned pointer, or NULL if size is 0 or above
+ * PTRDIFF_MAX, no heap is open or the file could not grow.
+ */
+void * pheap_malloc(size_t size);
+
+/*
+ * @brief Frees a block allocated with pheap_malloc.
+ * @param ptr: Pointer to free; NULL is ignored.
+ */
+void pheap_free(void * ptr);
+
+/*
+ * @brief Records the object a restarted process should start from.
+ * @param ptr: Pointer into the heap, or NULL.
+ */
+void pheap_set_root(void * ptr);
+
+/*
+ * @brief Returns the object recorded with pheap_set_root, or NULL.
+ */
+void * pheap_get_root();
+
+/*
+ * @brief Converts between pointers into the heap and offsets from its
+ * start. NULL and offset 0 map to each other.
+ */
+uint64_t pheap_offset(const void * ptr);
+void * pheap_pointer(uint64_t offset);
+
+/*
+ * @brief Bytes in the heap file, and bytes of it in free blocks.
+ */
+size_t pheap_size();
+size_t pheap_free_space_size();
+
+#endif
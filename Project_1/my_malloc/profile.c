@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include "profile.h"
+#include <execinfo.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define PROFILE_INITIAL_STACKS  1024
+#define PROFILE_INITIAL_SAMPLES 4096   /* power of two */
+
+/*
+ * @brief A distinct allocation stack and what was sampled from it.
+ */
+struct ProfileStack {
+  uint64_t hash;
+  uint32_t depth;
+  uint32_t chain;                    /* next stack in the same bucket, plus one */
+  size_t liveCount;
+  size_t liveBytes;
+  size_t allocCount;
+  size_t allocBytes;
+  void * pcs[PROFILE_MAX_DEPTH];
+};
+
+/*
+ * @brief A live sampled block, in an open-addressed table keyed by its
+ * data pointer. A NULL ptr is an empty slot.
+ */
+struct ProfileSample {
+  void * ptr;
+  size_t size;
+  uint32_t stack;
+};
+
+size_t profileCountdown = 0;   /* 0 sends the first allocation to profileSample, which sets things up */
+
+static bool initialized = false;
+static size_t rate = 0;        /* 0 while not profiling */
+static size_t lastRate = PROFILE_DEFAULT_RATE;   /* what the samples were taken at */
+static uint64_t randomState = 0;
+static const char * exitProfilePath = NULL;
+
+static struct ProfileStack * stacks = NULL;
+static uint32_t * stackBuckets = NULL;   /* stack index plus one, 0 for none; as many as stackCapacity */
+static size_t numStacks = 0;
+static size_t stackCapacity = 0;
+
+static struct ProfileSample * samples = NULL;
+static size_t numSamples = 0;
+static size_t sampleCapacity = 0;
+
+static void * mapTable(size_t bytes) {
+  void * table = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (table == MAP_FAILED) {
+    fprintf(stderr, "heap profile table failed to grow to %zu bytes\n", bytes);
+    abort();
+  }
+  heap_stats.mmapCalls++;
+  return table;
+}
+
+static void profileAtExit() {
+  FILE * out = fopen(exitProfilePath, "w");
+  if (out == NULL) {
+    perror(exitProfilePath);
+    return;
+  }
+  if (my_malloc_profile_dump(out) != 0) {
+    fprintf(stderr, "heap profile to %s failed\n", exitProfilePath);
+  }
+  fclose(out);
+}
+
+static void initializeProfile() {
+  initialized = true;
+  exitProfilePath = getenv("MY_MALLOC_PROFILE");
+  if (exitProfilePath != NULL && exitProfilePath[0] != '\0') {
+    const char * requested = getenv("MY_MALLOC_PROFILE_RATE");
+    my_malloc_profile_start(requested != NULL ? strtoul(requested, NULL, 10) : 0);
+    atexit(profileAtExit);
+  }
+}
+
+/*
+ * @brief Draws the bytes to allocate before the next sample, exponentially
+ * distributed with mean rate.
+ */
+static size_t nextCountdown() {
+  if (rate == 0) {
+    return SIZE_MAX;
+  }
+  uint64_t x = randomState;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  randomState = x;
+  double uniform = ((x >> 11) + 1) * 0x1.0p-53;   /* in (0, 1] */
+  double bytes = -log(uniform) * rate;
+  return bytes < (double)SIZE_MAX / 2 ? (size_t)bytes : SIZE_MAX / 2;
+}
+
+void my_malloc_profile_start(size_t newRate) {
+  if (!initialized) {
+    initializeProfile();
+  }
+  rate = newRate != 0 ? newRate : PROFILE_DEFAULT_RATE;
+  lastRate = rate;
+  if (randomState == 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    randomState = ((uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec) | 1;
+    /* backtrace() loads libgcc on its first call; get that over with
+     * outside of an allocation. */
+    void * pcs[1];
+    backtrace(pcs, 1);
+  }
+  profileCountdown = nextCountdown();
+}
+
+void my_malloc_profile_stop() {
+  rate = 0;
+  profileCountdown = SIZE_MAX;
+}
+
+static uint64_t hashStack(void * const * pcs, int depth) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ (uintptr_t)pcs[i]) * 0x100000001b3ull;
+  }
+  return hash ^ (hash >> 29);
+}
+
+static void growStacks() {
+  size_t newCapacity = stackCapacity ? stackCapacity * 2 : PROFILE_INITIAL_STACKS;
+  struct ProfileStack * grown;
+  if (stackCapacity == 0) {
+    grown = mapTable(newCapacity * sizeof(*grown));
+  } else {
+    grown = mremap(stacks, stackCapacity * sizeof(*grown), newCapacity * sizeof(*grown), MREMAP_MAYMOVE);
+    if (grown == MAP_FAILED) {
+      fprintf(stderr, "heap profile stack table failed to grow to %zu entries\n", newCapacity);
+      abort();
+    }
+    heap_stats.mmapCalls++;
+    munmap(stackBuckets, stackCapacity * sizeof(*stackBuckets));
+  }
+  stacks = grown;
+  stackCapacity = newCapacity;
+  stackBuckets = mapTable(stackCapacity * sizeof(*stackBuckets));
+  for (size_t i = 0; i < numStacks; i++) {
+    uint32_t * bucket = &stackBuckets[stacks[i].hash & (stackCapacity - 1)];
+    stacks[i].chain = *bucket;
+    *bucket = i + 1;
+  }
+}
+
+/*
+ * @brief Returns the index of a stack, adding it if it is new.
+ */
+static uint32_t findStack(void * const * pcs, int depth) {
+  uint64_t hash = hashStack(pcs, depth);
+  uint32_t index = stackCapacity != 0 ? stackBuckets[hash & (stackCapacity - 1)] : 0;
+  while (index != 0) {
+    struct ProfileStack * stack = &stacks[index - 1];
+    if (stack->hash == hash && stack->depth == (uint32_t)depth
+        && memcmp(stack->pcs, pcs, depth * sizeof(*pcs)) == 0) {
+      return index - 1;
+    }
+    index = stack->chain;
+  }
+  if (numStacks == stackCapacity) {
+    growStacks();
+  }
+  struct ProfileStack * stack = &stacks[numStacks];
+  memset(stack, 0, sizeof(*stack));
+  stack->hash = hash;
+  stack->depth = depth;
+  memcpy(stack->pcs, pcs, depth * sizeof(*pcs));
+  uint32_t * bucket = &stackBuckets[hash & (stackCapacity - 1)];
+  stack->chain = *bucket;
+  *bucket = ++numStacks;
+  return numStacks - 1;
+}
+
+static size_t sampleSlot(const void * ptr) {
+  return (size_t)(((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull >> 20) & (sampleCapacity - 1);
+}
+
+static void insertSample(struct ProfileSample sample) {
+  size_t slot = sampleSlot(sample.ptr);
+  while (samples[slot].ptr != NULL) {
+    slot = (slot + 1) & (sampleCapacity - 1);
+  }
+  samples[slot] = sample;
+}
+
+static void growSamples() {
+  struct ProfileSample * old = samples;
+  size_t oldCapacity = sampleCapacity;
+  sampleCapacity = oldCapacity ? oldCapacity * 2 : PROFILE_INITIAL_SAMPLES;
+  samples = mapTable(sampleCapacity * sizeof(*samples));
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (old[i].ptr != NULL) {
+      insertSample(old[i]);
+    }
+  }
+  if (old != NULL) {
+    munmap(old, oldCapacity * sizeof(*old));
+  }
+}
+
+/*
+ * @brief Finds the slot of a live sample; the block is known to be in the
+ * table.
+ */
+static size_t findSample(const void * ptr) {
+  size_t slot = sampleSlot(ptr);
+  while (samples[slot].ptr != ptr) {
+    slot = (slot + 1) & (sampleCapacity - 1);
+  }
+  return slot;
+}
+
+/*
+ * @brief Empties a slot, moving later entries of its probe run back so
+ * lookups never stop early.
+ */
+static void removeSampleAt(size_t hole) {
+  size_t slot = hole;
+  for (;;) {
+    slot = (slot + 1) & (sampleCapacity - 1);
+    if (samples[slot].ptr == NULL) {
+      break;
+    }
+    size_t home = sampleSlot(samples[slot].ptr);
+    /* The entry may fill the hole if its home is not in (hole, slot]. */
+    if (((slot - home) & (sampleCapacity - 1)) >= ((slot - hole) & (sampleCapacity - 1))) {
+      samples[hole] = samples[slot];
+      hole = slot;
+    }
+  }
+  samples[hole].ptr = NULL;
+}
+
+void profileSample(void * ptr, size_t size) {
+  if (!initialized) {
+    initializeProfile();
+  }
+  profileCountdown = nextCountdown();
+  if (ptr == NULL || rate == 0) {
+    return;
+  }
+  void * pcs[PROFILE_MAX_DEPTH + 1];
+  int depth = backtrace(pcs, PROFILE_MAX_DEPTH + 1) - 1;   /* less this frame */
+  uint32_t index = findStack(pcs + 1, depth);
+  struct ProfileStack * stack = &stacks[index];
+  stack->liveCount++;
+  stack->liveBytes += size;
+  stack->allocCount++;
+  stack->allocBytes += size;
+
+  if (2 * (numSamples + 1) > sampleCapacity) {
+    growSamples();
+  }
+  insertSample((struct ProfileSample){ .ptr = ptr, .size = size, .stack = index });
+  numSamples++;
+  ((MemoryBlock *)ptr - 1)->sampled = true;
+}
+
+void profileFreed(void * ptr) {
+  ((MemoryBlock *)ptr - 1)->sampled = false;
+  size_t slot = findSample(ptr);
+  struct ProfileStack * stack = &stacks[samples[slot].stack];
+  stack->liveCount--;
+  stack->liveBytes -= samples[slot].size;
+  removeSampleAt(slot);
+  numSamples--;
+}
+
+void profileMoved(void * from, void * to) {
+  size_t slot = findSample(from);
+  struct ProfileSample sample = samples[slot];
+  removeSampleAt(slot);
+  sample.ptr = to;
+  insertSample(sample);
+}
+
+static int copyMaps(FILE * out) {
+  FILE * maps = fopen("/proc/self/maps", "r");
+  if (maps == NULL) {
+    return 0;   /* pprof can still symbolize against the binary */
+  }
+  char buffer[4096];
+  size_t bytes;
+  int result = 0;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+    if (fwrite(buffer, 1, bytes, out) != bytes) {
+      result = -1;
+      break;
+    }
+  }
+  fclose(maps);
+  return result;
+}
+
+int my_malloc_profile_dump(FILE * out) {
+  size_t liveCount = 0, liveBytes = 0, allocCount = 0, allocBytes = 0;
+  for (size_t i = 0; i < numStacks; i++) {
+    liveCount += stacks[i].liveCount;
+    liveBytes += stacks[i].liveBytes;
+    allocCount += stacks[i].allocCount;
+    allocBytes += stacks[i].allocBytes;
+  }
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+          liveCount, liveBytes, allocCount, allocBytes, lastRate);
+  for (size_t i = 0; i < numStacks; i++) {
+    struct ProfileStack * stack = &stacks[i];
+    fprintf(out, "%zu: %zu [%zu: %zu] @", stack->liveCount, stack->liveBytes, stack->allocCount, stack->allocBytes);
+    for (uint32_t j = 0; j < stack->depth; j++) {
+      fprintf(out, " %p", stack->pcs[j]);
+    }
+    fputc('\n', out);
+  }
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  int result = copyMaps(out);
+  return result == 0 && !ferror(out) ? 0 : -1;
+}
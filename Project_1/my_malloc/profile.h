@@ -0,0 +1,101 @@
+#ifndef __MY_MALLOC_PROFILE__
+#define __MY_MALLOC_PROFILE__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Sampling heap profiler.
+ *
+ * While profiling, the allocator samples about one allocation per
+ * sampling rate bytes allocated: each allocation is charged against a
+ * countdown, and the one that takes it below zero is sampled and draws the
+ * next countdown from an exponential distribution with the rate as its
+ * mean (so allocations of every size are sampled with probability
+ * 1 - exp(-size / rate), whatever their order). A sampled allocation
+ * records its call stack (backtrace(3)) in a table of distinct stacks and
+ * is marked in its block header; freeing a marked block takes it off its
+ * stack's live totals. Unsampled allocations and frees pay for one
+ * subtraction and one test, and profiling is off until started.
+ *
+ * my_malloc_profile_dump() writes the live heap in the text format of
+ * gperftools heap profiles, which pprof reads and scales back up by the
+ * sampling rate:
+ *
+ *     heap profile: <live>: <live bytes> [<allocs>: <alloc bytes>] @ heap_v2/<rate>
+ *     <live>: <live bytes> [<allocs>: <alloc bytes>] @ 0x<pc> 0x<pc> ...
+ *     ...
+ *
+ *     MAPPED_LIBRARIES:
+ *     <contents of /proc/self/maps>
+ *
+ * one line per stack, counting sampled allocations only: those still live
+ * and all those made since profiling started. Sizes are the requested
+ * ones.
+ *
+ * Setting MY_MALLOC_PROFILE=<path> in the environment starts profiling at
+ * the first allocation, at MY_MALLOC_PROFILE_RATE bytes (default
+ * PROFILE_DEFAULT_RATE), and dumps a profile to that file at exit:
+ *
+ *     MY_MALLOC_PROFILE=heap.prof ./workload_allocs ...
+ *     pprof -text --inuse_space ./workload_allocs heap.prof
+ *
+ * Like the rest of the allocator, the profiler is not thread-safe.
+ */
+
+#ifndef PROFILE_DEFAULT_RATE
+#define PROFILE_DEFAULT_RATE  (512 * 1024)   /* mean bytes between samples */
+#endif
+#define PROFILE_MAX_DEPTH     32             /* frames kept per stack */
+
+/*
+ * @brief Starts sampling allocations, or changes the rate if already
+ * started.
+ * @param rate: Mean bytes allocated between samples; 0 selects
+ * PROFILE_DEFAULT_RATE and 1 samples every allocation.
+ */
+void my_malloc_profile_start(size_t rate);
+
+/*
+ * @brief Stops sampling new allocations. Blocks already sampled stay in
+ * the profile until they are freed.
+ */
+void my_malloc_profile_stop();
+
+/*
+ * @brief Writes a heap profile of the sampled allocations.
+ * @param out: Stream to write to.
+ * @return 0 on success, -1 if writing failed.
+ */
+int my_malloc_profile_dump(FILE * out);
+
+/*
+ * Hooks called by my_malloc.c and handles.c.
+ */
+extern size_t profileCountdown;   /* bytes left to allocate before the next sample */
+
+/*
+ * @brief Records a sampled allocation, or just starts a new countdown if
+ * profiling is off or the allocation failed.
+ */
+void profileSample(void * ptr, size_t size);
+
+/*
+ * @brief Removes a sampled block from the profile; ptr is its data.
+ */
+void profileFreed(void * ptr);
+
+/*
+ * @brief Follows a sampled block the compactor moved.
+ */
+void profileMoved(void * from, void * to);
+
+static inline void profileAllocated(void * ptr, size_t size) {
+  if (__builtin_expect(size < profileCountdown, true)) {
+    profileCountdown -= size;
+    return;
+  }
+  profileSample(ptr, size);
+}
+
+#endif
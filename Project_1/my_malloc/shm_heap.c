@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "shm_heap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(struct SharedHeapHeader) <= SHM_HEAP_FIRST_BLOCK, "header overlaps the first block");
+
+/*
+ * @brief Maps a region and fills in the attachment, which takes over fd
+ * if this succeeds.
+ */
+static int mapRegion(shm_heap_t * heap, int fd, size_t length) {
+  void * mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    return -1;
+  }
+  heap->header = mapped;
+  heap->heap.base = mapped;
+  heap->heap.state = &heap->header->state;
+  heap->length = length;
+  heap->fd = fd;
+  return 0;
+}
+
+int shm_heap_create(shm_heap_t * heap, const char * name, size_t size) {
+  if (size < SHM_HEAP_FIRST_BLOCK + OFFSET_HEAP_META_SIZE + OFFSET_HEAP_ALIGN) {
+    errno = EINVAL;
+    return -1;
+  }
+  size = size / OFFSET_HEAP_ALIGN * OFFSET_HEAP_ALIGN;
+  int fd = name != NULL ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : memfd_create("shm_heap", 0);
+  if (fd < 0) {
+    return -1;
+  }
+  bool mapped = ftruncate(fd, size) == 0 && mapRegion(heap, fd, size) == 0;
+  if (!mapped) {
+    int saved = errno;
+    close(fd);
+    if (name != NULL) {
+      shm_unlink(name);
+    }
+    errno = saved;
+    return -1;
+  }
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&heap->header->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  offsetHeapInit(&heap->heap, SHM_HEAP_FIRST_BLOCK, size);
+  /* Magic last: an attacher that sees it sees an initialized heap. */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(heap->header->magic, SHM_HEAP_MAGIC, sizeof(heap->header->magic));
+  return 0;
+}
+
+int shm_heap_attach_fd(shm_heap_t * heap, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return -1;
+  }
+  if ((size_t)st.st_size < SHM_HEAP_FIRST_BLOCK) {
+    errno = EINVAL;
+    return -1;
+  }
+  int dup = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (dup < 0) {
+    return -1;
+  }
+  if (mapRegion(heap, dup, st.st_size) != 0) {
+    int saved = errno;
+    close(dup);
+    errno = saved;
+    return -1;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (memcmp(heap->header->magic, SHM_HEAP_MAGIC, sizeof(heap->header->magic)) != 0
+      || heap->header->state.size > heap->length) {
+    shm_heap_detach(heap);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+int shm_heap_attach(shm_heap_t * heap, const char * name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = shm_heap_attach_fd(heap, fd);
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return result;
+}
+
+void shm_heap_detach(shm_heap_t * heap) {
+  if (heap->header == NULL) {
+    return;
+  }
+  munmap(heap->header, heap->length);
+  close(heap->fd);
+  heap->header = NULL;
+  heap->heap.base = NULL;
+  heap->heap.state = NULL;
+  heap->fd = -1;
+}
+
+/*
+ * @brief Takes the heap's lock, repairing the free list if its last holder
+ * died in the middle of an update.
+ * @return false if the heap cannot be used any more.
+ */
+static bool lockHeap(shm_heap_t * heap) {
+  int result = pthread_mutex_lock(&heap->header->lock);
+  if (result == EOWNERDEAD) {
+    if (!offsetHeapRebuild(&heap->heap, SHM_HEAP_FIRST_BLOCK)) {
+      /* Unlocking without marking it consistent makes the mutex unusable
+       * for everyone, which is what a corrupted heap deserves. */
+      pthread_mutex_unlock(&heap->header->lock);
+      return false;
+    }
+    pthread_mutex_consistent(&heap->header->lock);
+    result = 0;
+  }
+  return result == 0;
+}
+
+void * shm_heap_malloc(shm_heap_t * heap, size_t size) {
+  if (size == 0 || !lockHeap(heap)) {
+    return NULL;
+  }
+  void * ptr = offsetHeapMalloc(&heap->heap, size);
+  pthread_mutex_unlock(&heap->header->lock);
+  return ptr;
+}
+
+void shm_heap_free(shm_heap_t * heap, void * ptr) {
+  if (ptr == NULL || !lockHeap(heap)) {
+    return;
+  }
+  offsetHeapFree(&heap->heap, ptr);
+  pthread_mutex_unlock(&heap->header->lock);
+}
+
+uint64_t shm_heap_offset(const shm_heap_t * heap, const void * ptr) {
+  return ptr != NULL ? (uint64_t)((const char *)ptr - heap->heap.base) : 0;
+}
+
+void * shm_heap_pointer(const shm_heap_t * heap, uint64_t offset) {
+  return offset != 0 ? heap->heap.base + offset : NULL;
+}
+
+size_t shm_heap_free_space_size(shm_heap_t * heap) {
+  if (!lockHeap(heap)) {
+    return 0;
+  }
+  size_t bytes = heap->header->state.totalFreed;
+  pthread_mutex_unlock(&heap->header->lock);
+  return bytes;
+}
@@ -0,0 +1,109 @@
+#ifndef __MY_MALLOC_SHM_HEAP__
+#define __MY_MALLOC_SHM_HEAP__
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "offset_heap.h"
+
+/*
+ * Heap shared between processes.
+ *
+ * One process creates a POSIX shared memory object (or, with no name, a
+ * memfd to pass on by fork or SCM_RIGHTS) and lays out an offset heap
+ * (offset_heap.h) in it; others attach to it by name or descriptor. Each
+ * process maps the region wherever its address space has room, so the
+ * only thing that means the same to all of them is an offset from the
+ * start of the region. To hand a message over, the producer allocates and
+ * fills a buffer, sends shm_heap_offset() of it (8 bytes, over whatever
+ * channel it likes), and the consumer turns it back into a pointer with
+ * shm_heap_pointer(), reads it in place and frees it with shm_heap_free()
+ * from its own side. The payload is never copied.
+ *
+ * Allocation and free take a process-shared robust mutex kept in the
+ * region. If a process dies holding it, the next one to lock it rebuilds
+ * the free list by walking the block headers (which every update leaves
+ * walkable) and marks the mutex consistent; blocks the dead process had
+ * allocated stay allocated. The region does not grow: a heap is created
+ * with its final size, and shm_heap_malloc returns NULL when it is full.
+ */
+
+#define SHM_HEAP_MAGIC       "MMSHEAP1"
+#define SHM_HEAP_FIRST_BLOCK 128        /* offset of the first block header */
+
+struct SharedHeapHeader {
+  char magic[8];                  /* SHM_HEAP_MAGIC once initialized, not NUL-terminated */
+  struct OffsetHeapState state;   /* state.size is the size of the region */
+  pthread_mutex_t lock;           /* process-shared, robust */
+};
+
+/*
+ * @brief A process's attachment to a shared heap.
+ */
+struct SharedHeap {
+  struct OffsetHeap heap;             /* heap.base is where the region is mapped here */
+  struct SharedHeapHeader * header;
+  size_t length;
+  int fd;                             /* to pass on to other processes */
+};
+typedef struct SharedHeap shm_heap_t;
+
+/*
+ * @brief Creates a shared heap and attaches to it.
+ * @param heap: Attachment to fill in.
+ * @param name: shm_open name ("/name"), which must not exist yet, or NULL
+ * for an anonymous memfd.
+ * @param size: Bytes in the region.
+ * @return 0 on success, -1 with errno set.
+ */
+int shm_heap_create(shm_heap_t * heap, const char * name, size_t size);
+
+/*
+ * @brief Attaches to a shared heap created by another process.
+ * @param heap: Attachment to fill in.
+ * @param name: Name it was created with.
+ * @return 0 on success, -1 with errno set (EINVAL if the object is not an
+ * initialized shared heap).
+ */
+int shm_heap_attach(shm_heap_t * heap, const char * name);
+
+/*
+ * @brief Attaches through a descriptor for the region, e.g. another
+ * attachment's fd received over a socket. The descriptor is duplicated.
+ */
+int shm_heap_attach_fd(shm_heap_t * heap, int fd);
+
+/*
+ * @brief Unmaps the region and closes the attachment's descriptor. The
+ * heap lives on until every process has detached and, for a named heap,
+ * shm_unlink() has been called.
+ */
+void shm_heap_detach(shm_heap_t * heap);
+
+/*
+ * @brief Allocates from a shared heap.
+ * @param size: Size of the data needed.
+ * @return OFFSET_HEAP_ALIGN-aligned pointer, or NULL if size is 0 or the
+ * heap is full.
+ */
+void * shm_heap_malloc(shm_heap_t * heap, size_t size);
+
+/*
+ * @brief Frees a block, whichever process allocated it.
+ * @param ptr: Pointer into this attachment's mapping; NULL is ignored.
+ */
+void shm_heap_free(shm_heap_t * heap, void * ptr);
+
+/*
+ * @brief Converts between pointers into this attachment's mapping and
+ * offsets that mean the same in every process. NULL and offset 0 map to
+ * each other.
+ */
+uint64_t shm_heap_offset(const shm_heap_t * heap, const void * ptr);
+void * shm_heap_pointer(const shm_heap_t * heap, uint64_t offset);
+
+/*
+ * @brief Bytes of the region in free blocks.
+ */
+size_t shm_heap_free_space_size(shm_heap_t * heap);
+
+#endif
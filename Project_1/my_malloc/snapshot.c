@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include "snapshot.h"
+#include <sys/mman.h>
+#include <string.h>
+
+#define SNAPSHOT_INITIAL_SEGMENTS 256
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+#ifndef SNAPSHOT_PREFETCH_DISTANCE
+#define SNAPSHOT_PREFETCH_DISTANCE 4096   /* bytes ahead of the current header */
+#endif
+
+struct HeapSegment {
+  char * start;
+  char * end;
+};
+
+static struct HeapSegment * segments = NULL;
+static size_t numSegments = 0;
+static size_t segmentCapacity = 0;
+static const char * exitSnapshotPath = NULL;
+
+static void snapshotAtExit() {
+  FILE * out = fopen(exitSnapshotPath, "wb");
+  if (out == NULL) {
+    perror(exitSnapshotPath);
+    return;
+  }
+  if (my_malloc_snapshot(out) != 0) {
+    fprintf(stderr, "heap snapshot to %s failed\n", exitSnapshotPath);
+  }
+  fclose(out);
+}
+
+static void growSegments() {
+  size_t newCapacity = segmentCapacity ? segmentCapacity * 2 : SNAPSHOT_INITIAL_SEGMENTS;
+  struct HeapSegment * grown;
+  if (segmentCapacity == 0) {
+    grown = mmap(NULL, newCapacity * sizeof(*grown), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    exitSnapshotPath = getenv("MY_MALLOC_SNAPSHOT");
+    if (exitSnapshotPath != NULL && exitSnapshotPath[0] != '\0') {
+      atexit(snapshotAtExit);
+    }
+  } else {
+    grown = mremap(segments, segmentCapacity * sizeof(*grown), newCapacity * sizeof(*grown), MREMAP_MAYMOVE);
+  }
+  if (grown == MAP_FAILED) {
+    fprintf(stderr, "heap segment table failed to grow to %zu entries\n", newCapacity);
+    abort();
+  }
+  heap_stats.mmapCalls++;
+  segments = grown;
+  segmentCapacity = newCapacity;
+}
+
+void heapSegmentGrown(void * start, size_t bytes) {
+  if (numSegments > 0 && segments[numSegments - 1].end == (char*)start) {
+    segments[numSegments - 1].end += bytes;
+    return;
+  }
+  if (numSegments == segmentCapacity) {
+    growSegments();
+  }
+  segments[numSegments].start = start;
+  segments[numSegments].end = (char*)start + bytes;
+  numSegments++;
+}
+
+void heapSegmentShrunk(void * end, size_t bytes) {
+  for (size_t i = numSegments; i-- > 0; ) {
+    if (segments[i].end != (char*)end) {
+      continue;
+    }
+    segments[i].end -= bytes;
+    if (segments[i].end == segments[i].start) {
+      memmove(&segments[i], &segments[i + 1], (numSegments - i - 1) * sizeof(*segments));
+      numSegments--;
+    }
+    return;
+  }
+}
+
+bool heapSegmentEndsAt(const void * addr) {
+  for (size_t i = numSegments; i-- > 0; ) {
+    if (segments[i].end == (const char*)addr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int writeSnapshot(FILE * out) {
+  struct SnapshotHeader header;
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.metaSize = META_SIZE;
+  header.segments = numSegments;
+  header.bytes = 0;
+  for (size_t i = 0; i < numSegments; i++) {
+    header.bytes += segments[i].end - segments[i].start;
+  }
+  if (fwrite(&header, sizeof(header), 1, out) != 1) {
+    return -1;
+  }
+
+  unsigned char buffer[SNAPSHOT_BUFFER_SIZE];
+  for (size_t i = 0; i < numSegments; i++) {
+    struct SnapshotSegment segment = {(uintptr_t)segments[i].start, segments[i].end - segments[i].start};
+    if (fwrite(&segment, sizeof(segment), 1, out) != 1) {
+      return -1;
+    }
+    size_t used = 0;
+    char * curr = segments[i].start;
+    char * end = segments[i].end;
+    while (curr < end) {
+      MemoryBlock * block = (MemoryBlock *)curr;
+      /* Headers are chased one by one, but always upwards: pull in the
+       * lines a page ahead so the walk does not stall on each one. */
+      __builtin_prefetch(curr + SNAPSHOT_PREFETCH_DISTANCE);
+      __builtin_prefetch(curr + SNAPSHOT_PREFETCH_DISTANCE + 64);
+      uint64_t value = (uint64_t)block->dataSize << 2 | (uint64_t)block->region << 1 | block->allocated;
+      while (value >= 0x80) {
+        buffer[used++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+      }
+      buffer[used++] = (unsigned char)value;
+      curr += META_SIZE + block->dataSize;
+      if (used > SNAPSHOT_BUFFER_SIZE - 10) {
+        if (fwrite(buffer, 1, used, out) != used) {
+          return -1;
+        }
+        used = 0;
+      }
+    }
+    if (fwrite(buffer, 1, used, out) != used || curr != end) {
+      return -1;
+    }
+  }
+  return fflush(out) == 0 ? 0 : -1;
+}
+
+int my_malloc_snapshot(FILE * out) {
+  asyncFreeLock();
+  int result = writeSnapshot(out);
+  asyncFreeUnlock();
+  return result;
+}
@@ -0,0 +1,70 @@
+#ifndef __MY_MALLOC_SNAPSHOT__
+#define __MY_MALLOC_SNAPSHOT__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Heap snapshots.
+ *
+ * The allocator records every range it grows the heap by (heapExtend(),
+ * normally sbrk). A range that continues the previous one extends it, so
+ * a heap is normally a single segment; a new segment starts only when
+ * something else (glibc's malloc, say) moved the break in between.
+ * my_malloc_snapshot() walks each segment from its start, header by
+ * header, and writes
+ *
+ *     SnapshotHeader
+ *     for each segment: SnapshotSegment, then one varint per block
+ *
+ * A block's varint (LEB128, low 7 bits first) is
+ * dataSize << 2 | region << 1 | allocated. Addresses are implicit: the
+ * first block starts at the segment start and each following one
+ * metaSize + dataSize bytes later, which is also how a reader checks that
+ * the walk was consistent. Size classes are floor(log2(dataSize)), as in
+ * stats.h. Small blocks encode in one or two bytes.
+ *
+ * The walk reads one header per block and writes through a local buffer,
+ * so it runs at close to memory bandwidth and allocates nothing from the
+ * heap it is walking. It is not safe to run concurrently with ff/bf calls.
+ *
+ * Setting MY_MALLOC_SNAPSHOT=<path> in the environment writes a snapshot
+ * to that file at exit. tools/heap_analyze reads the format.
+ */
+
+#define SNAPSHOT_MAGIC "MMHEAP01"
+
+struct SnapshotHeader {
+  char magic[8];          /* SNAPSHOT_MAGIC, not NUL-terminated */
+  uint32_t metaSize;      /* bytes of header before each block's data */
+  uint32_t segments;
+  uint64_t bytes;         /* total length of the segments */
+};
+
+struct SnapshotSegment {
+  uint64_t start;         /* address of the first block header */
+  uint64_t length;        /* bytes, a whole number of blocks */
+};
+
+/*
+ * @brief Writes a snapshot of every block in the heap.
+ * @param out: Stream to write to.
+ * @return 0 on success, -1 if writing failed or a block header did not
+ * line up with its segment (a corrupted heap).
+ */
+int my_malloc_snapshot(FILE * out);
+
+/*
+ * Segment bookkeeping, called by my_malloc.c around heapExtend/heapRetract.
+ */
+void heapSegmentGrown(void * start, size_t bytes);
+void heapSegmentShrunk(void * end, size_t bytes);
+
+/*
+ * @brief Tells whether a heap segment ends at an address, i.e. whether
+ * there is no block header there to read.
+ */
+bool heapSegmentEndsAt(const void * addr);
+
+#endif
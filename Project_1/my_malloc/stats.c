@@ -0,0 +1,91 @@
+#include "my_malloc.h"
+#include "stats.h"
+
+extern FreeList freeList;
+extern FreeList longLivedList;
+extern heap_info_t heap_info;
+
+my_malloc_stats_t heap_stats;
+bool largestFreeBlockStale = false;
+
+void my_malloc_stats(my_malloc_stats_t * stats) {
+  asyncFreeLock();
+  if (largestFreeBlockStale) {
+    size_t largest = 0;
+    for (MemoryBlock * curr = freeList.head; curr != NULL; curr = curr->next) {
+      if (curr->dataSize > largest) {
+        largest = curr->dataSize;
+      }
+    }
+    for (MemoryBlock * curr = longLivedList.head; curr != NULL; curr = curr->next) {
+      if (curr->dataSize > largest) {
+        largest = curr->dataSize;
+      }
+    }
+    heap_stats.largestFreeBlock = largest;
+    largestFreeBlockStale = false;
+  }
+  *stats = heap_stats;
+  stats->policy = adaptivePolicy.policy;
+  stats->probeLimit = adaptivePolicy.probeLimit;
+  stats->freeBytes = heap_info.totalFreed;
+  stats->liveBytes = heap_info.totalAllocated - heap_info.totalFreed;
+  stats->externalFragmentation = stats->freeBytes == 0 ? 0.0
+    : 1.0 - (double)(stats->largestFreeBlock + META_SIZE) / (double)stats->freeBytes;
+  asyncFreeUnlock();
+}
+
+static const char * policyNames[] = {"first_fit", "best_fit"};
+
+void my_malloc_stats_print(FILE * out, enum my_malloc_stats_format format) {
+  my_malloc_stats_t stats;
+  my_malloc_stats(&stats);
+
+  if (format == MY_MALLOC_STATS_JSON) {
+    fprintf(out, "{\"live_bytes\":%zu,\"free_bytes\":%zu,\"free_blocks\":%zu,\"largest_free_block\":%zu,"
+            "\"external_fragmentation\":%.6f,\"sbrk_calls\":%zu,\"mmap_calls\":%zu,\"malloc_calls\":%zu,"
+            "\"free_calls\":%zu,\"splits\":%zu,\"coalesces\":%zu,\"policy\":\"%s\",\"probe_limit\":%zu,"
+            "\"policy_switches\":%zu,\"relocations\":%zu,\"relocated_bytes\":%zu,\"size_classes\":[",
+            stats.liveBytes, stats.freeBytes, stats.freeBlocks, stats.largestFreeBlock,
+            stats.externalFragmentation, stats.sbrkCalls, stats.mmapCalls, stats.mallocCalls,
+            stats.freeCalls, stats.splits, stats.coalesces, policyNames[stats.policy], stats.probeLimit,
+            stats.policySwitches, stats.relocations, stats.relocatedBytes);
+    bool first = true;
+    for (unsigned i = 0; i < MY_MALLOC_STATS_CLASSES; i++) {
+      if (stats.freeBlocksByClass[i] == 0 && stats.allocationsByClass[i] == 0) {
+        continue;
+      }
+      fprintf(out, "%s{\"min_size\":%zu,\"free_blocks\":%zu,\"allocations\":%zu}",
+              first ? "" : ",", (size_t)1 << i, stats.freeBlocksByClass[i], stats.allocationsByClass[i]);
+      first = false;
+    }
+    fprintf(out, "]}\n");
+    return;
+  }
+
+  fprintf(out, "live bytes              %zu\n", stats.liveBytes);
+  fprintf(out, "free bytes              %zu\n", stats.freeBytes);
+  fprintf(out, "free blocks             %zu\n", stats.freeBlocks);
+  fprintf(out, "largest free block      %zu\n", stats.largestFreeBlock);
+  fprintf(out, "external fragmentation  %.4f\n", stats.externalFragmentation);
+  fprintf(out, "sbrk calls              %zu\n", stats.sbrkCalls);
+  fprintf(out, "mmap calls              %zu\n", stats.mmapCalls);
+  fprintf(out, "malloc calls            %zu\n", stats.mallocCalls);
+  fprintf(out, "free calls              %zu\n", stats.freeCalls);
+  fprintf(out, "splits                  %zu\n", stats.splits);
+  fprintf(out, "coalesces               %zu\n", stats.coalesces);
+  fprintf(out, "policy                  %s\n", policyNames[stats.policy]);
+  fprintf(out, "probe limit             %zu\n", stats.probeLimit);
+  fprintf(out, "policy switches         %zu\n", stats.policySwitches);
+  fprintf(out, "relocations             %zu\n", stats.relocations);
+  fprintf(out, "relocated bytes         %zu\n", stats.relocatedBytes);
+  fprintf(out, "%-22s %12s %12s\n", "size class", "free blocks", "allocations");
+  for (unsigned i = 0; i < MY_MALLOC_STATS_CLASSES; i++) {
+    if (stats.freeBlocksByClass[i] == 0 && stats.allocationsByClass[i] == 0) {
+      continue;
+    }
+    char range[48];                // room for two 20-digit bounds
+    snprintf(range, sizeof(range), "[%zu, %zu)", (size_t)1 << i, (size_t)2 << i);
+    fprintf(out, "%-22s %12zu %12zu\n", range, stats.freeBlocksByClass[i], stats.allocationsByClass[i]);
+  }
+}
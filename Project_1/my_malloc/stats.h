@@ -0,0 +1,102 @@
+#ifndef __MY_MALLOC_STATS__
+#define __MY_MALLOC_STATS__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "adaptive.h"
+
+/*
+ * Number of size classes tracked by the histograms. Class k holds sizes in
+ * [2^k, 2^(k+1)); the last class also collects everything larger.
+ */
+#define MY_MALLOC_STATS_CLASSES 48
+
+/**
+ * Snapshot of the allocator's runtime statistics.
+ *
+ * Byte counts include block headers, the same convention as
+ * get_data_segment_size() and get_data_segment_free_space_size(), so
+ * liveBytes + freeBytes is the data segment size.
+ */
+struct _my_malloc_stats_t {
+  size_t liveBytes;               /**< Bytes in allocated blocks. */
+  size_t freeBytes;               /**< Bytes in free blocks. */
+  size_t freeBlocks;              /**< Number of blocks in the free lists. */
+  size_t largestFreeBlock;        /**< dataSize of the largest free block. */
+  double externalFragmentation;   /**< 1 - (largest free block + header) / free bytes; 0 with no free space. */
+  size_t sbrkCalls;               /**< Calls that grew the data segment. */
+  size_t mmapCalls;               /**< mmap/mremap calls made for allocator metadata. */
+  size_t mallocCalls;             /**< Non-zero-size allocation requests. */
+  size_t freeCalls;               /**< Frees of allocated blocks. */
+  size_t splits;                  /**< Free blocks split to satisfy a request. */
+  size_t coalesces;               /**< Merges of adjacent free blocks. */
+  enum my_malloc_policy policy;   /**< Fit policy ad_malloc is currently using. */
+  size_t probeLimit;              /**< Best-fit probe limit of ad_malloc; 0 is unbounded. */
+  size_t policySwitches;          /**< Times ad_malloc changed policy. */
+  size_t relocations;             /**< Handle blocks moved by the compactor. */
+  size_t relocatedBytes;          /**< Bytes, headers included, the compactor copied. */
+  size_t freeBlocksByClass[MY_MALLOC_STATS_CLASSES];  /**< Free blocks per size class. */
+  size_t allocationsByClass[MY_MALLOC_STATS_CLASSES]; /**< Allocation requests per size class. */
+};
+typedef struct _my_malloc_stats_t my_malloc_stats_t;
+
+enum my_malloc_stats_format {
+  MY_MALLOC_STATS_TEXT,
+  MY_MALLOC_STATS_JSON
+};
+
+/*
+ * @brief Fills in a snapshot of the allocator statistics.
+ *
+ * All counters are maintained incrementally; the only non-constant work is
+ * re-finding the largest free block after the previous largest was
+ * allocated, split or merged away, and that happens here rather than on the
+ * malloc/free paths.
+ * @param stats: Pointer to the snapshot to fill in.
+ */
+void my_malloc_stats(my_malloc_stats_t * stats);
+
+/*
+ * @brief Writes a statistics snapshot to a stream.
+ * @param out: Stream to write to.
+ * @param format: MY_MALLOC_STATS_TEXT or MY_MALLOC_STATS_JSON (one line).
+ */
+void my_malloc_stats_print(FILE * out, enum my_malloc_stats_format format);
+
+/*
+ * Internal bookkeeping shared with my_malloc.c. The counters live in
+ * heap_stats; the free-space fields of a snapshot are derived at read time.
+ */
+extern my_malloc_stats_t heap_stats;
+extern bool largestFreeBlockStale;
+
+static inline unsigned statsSizeClass(size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  unsigned sizeClass = 63 - __builtin_clzl(size);
+  return sizeClass < MY_MALLOC_STATS_CLASSES ? sizeClass : MY_MALLOC_STATS_CLASSES - 1;
+}
+
+static inline void statsFreeBlockAdded(size_t dataSize) {
+  heap_stats.freeBlocks++;
+  heap_stats.freeBlocksByClass[statsSizeClass(dataSize)]++;
+  if (dataSize > heap_stats.largestFreeBlock) {
+    heap_stats.largestFreeBlock = dataSize;
+  }
+}
+
+static inline void statsFreeBlockRemoved(size_t dataSize) {
+  heap_stats.freeBlocks--;
+  heap_stats.freeBlocksByClass[statsSizeClass(dataSize)]--;
+  if (dataSize >= heap_stats.largestFreeBlock) {
+    largestFreeBlockStale = true;
+  }
+}
+
+static inline void statsAllocationRequested(size_t size) {
+  heap_stats.mallocCalls++;
+  heap_stats.allocationsByClass[statsSizeClass(size)]++;
+}
+
+#endif
@@ -0,0 +1,480 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+/*
+ * Offline analysis of a heap snapshot (see snapshot.h).
+ *
+ *     heap_analyze [-w width] [-r rows] [-n requests] [-s seed] snapshot.bin
+ *
+ * Prints
+ *  - a summary: segment, live and free bytes, header overhead, the largest
+ *    free block and external fragmentation as my_malloc_stats() defines it;
+ *  - a histogram of free block sizes by power-of-two class;
+ *  - a fragmentation map of each segment, -r rows of -w cells, where each
+ *    cell shows how much of its address range is allocated:
+ *        ' ' none   '.' < 25%   ':' < 50%   '+' < 75%   '#' < 100%   '@' all
+ *  - what-if results: the bytes compaction would give back, and how far
+ *    the free blocks as they stand would go under first, best and worst
+ *    fit. Each policy serves the same -n requests (default 100000), drawn
+ *    with seed -s from the sizes of the live blocks, until the first one
+ *    that would have to grow the heap. Blocks are split as the allocator
+ *    splits them.
+ */
+
+struct Block {
+  uint64_t address;
+  uint64_t size;
+  unsigned char allocated;
+  unsigned char region;
+};
+
+static struct Block * blocks;
+static size_t numBlocks, blocksCapacity;
+static uint32_t metaSize;
+
+/*
+ * @brief Decodes one varint at *cursor, advancing it.
+ * @return 1 on success, 0 if the data ends first.
+ */
+static int readVarint(const unsigned char ** cursor, const unsigned char * end, uint64_t * value) {
+  *value = 0;
+  for (unsigned shift = 0; shift < 64 && *cursor < end; shift += 7) {
+    unsigned char c = *(*cursor)++;
+    *value |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int readSnapshot(const char * path, struct SnapshotSegment ** segmentsOut, uint32_t * numSegments) {
+  FILE * in = fopen(path, "rb");
+  if (in == NULL || fseek(in, 0, SEEK_END) != 0) {
+    return 0;
+  }
+  long fileSize = ftell(in);
+  unsigned char * data = malloc(fileSize > 0 ? fileSize : 1);
+  rewind(in);
+  if (data == NULL || fread(data, 1, fileSize, in) != (size_t)fileSize) {
+    return 0;
+  }
+  fclose(in);
+  const unsigned char * cursor = data;
+  const unsigned char * dataEnd = data + fileSize;
+
+  struct SnapshotHeader header;
+  if ((size_t)fileSize < sizeof(header)) {
+    return 0;
+  }
+  memcpy(&header, cursor, sizeof(header));
+  cursor += sizeof(header);
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+    return 0;
+  }
+  metaSize = header.metaSize;
+  struct SnapshotSegment * segments = calloc(header.segments + 1, sizeof(*segments));
+  for (uint32_t i = 0; i < header.segments; i++) {
+    if ((size_t)(dataEnd - cursor) < sizeof(segments[i])) {
+      return 0;
+    }
+    memcpy(&segments[i], cursor, sizeof(segments[i]));
+    cursor += sizeof(segments[i]);
+    uint64_t address = segments[i].start;
+    uint64_t end = segments[i].start + segments[i].length;
+    while (address < end) {
+      uint64_t value;
+      if (!readVarint(&cursor, dataEnd, &value)) {
+        return 0;
+      }
+      if (numBlocks == blocksCapacity) {
+        blocksCapacity = blocksCapacity ? 2 * blocksCapacity : 1 << 16;
+        blocks = realloc(blocks, blocksCapacity * sizeof(*blocks));
+        if (blocks == NULL) {
+          perror("realloc");
+          exit(EXIT_FAILURE);
+        }
+      }
+      struct Block * block = &blocks[numBlocks++];
+      block->address = address;
+      block->size = value >> 2;
+      block->region = (value >> 1) & 1;
+      block->allocated = value & 1;
+      address += metaSize + block->size;
+    }
+    if (address != end) {
+      fprintf(stderr, "segment %u: blocks overrun its end\n", i);
+      return 0;
+    }
+  }
+  free(data);
+  *segmentsOut = segments;
+  *numSegments = header.segments;
+  return 1;
+}
+
+static unsigned sizeClass(uint64_t size) {
+  return size == 0 ? 0 : 63 - __builtin_clzll(size);
+}
+
+static void printSummary(const struct SnapshotSegment * segments, uint32_t numSegments) {
+  uint64_t segmentBytes = 0, liveBytes = 0, freeBytes = 0, largestFree = 0;
+  size_t freeBlocks = 0;
+  for (uint32_t i = 0; i < numSegments; i++) {
+    segmentBytes += segments[i].length;
+  }
+  for (size_t i = 0; i < numBlocks; i++) {
+    uint64_t bytes = metaSize + blocks[i].size;
+    if (blocks[i].allocated) {
+      liveBytes += bytes;
+    } else {
+      freeBytes += bytes;
+      freeBlocks++;
+      if (blocks[i].size > largestFree) {
+        largestFree = blocks[i].size;
+      }
+    }
+  }
+  printf("segments                %u\n", numSegments);
+  printf("segment bytes           %lu\n", (unsigned long)segmentBytes);
+  printf("blocks                  %zu (%zu free)\n", numBlocks, freeBlocks);
+  printf("live bytes              %lu\n", (unsigned long)liveBytes);
+  printf("free bytes              %lu\n", (unsigned long)freeBytes);
+  printf("header bytes            %lu\n", (unsigned long)(numBlocks * metaSize));
+  printf("largest free block      %lu\n", (unsigned long)largestFree);
+  printf("fragmentation           %.4f (free / segment)\n", segmentBytes ? (double)freeBytes / segmentBytes : 0.0);
+  printf("external fragmentation  %.4f\n", freeBytes ? 1.0 - (double)(largestFree + metaSize) / freeBytes : 0.0);
+}
+
+static void printFreeHistogram() {
+  size_t counts[64] = {0};
+  uint64_t bytes[64] = {0};
+  uint64_t total = 0;
+  for (size_t i = 0; i < numBlocks; i++) {
+    if (!blocks[i].allocated) {
+      unsigned c = sizeClass(blocks[i].size);
+      counts[c]++;
+      bytes[c] += blocks[i].size;
+      total += blocks[i].size;
+    }
+  }
+  printf("\n%-22s %12s %14s %8s\n", "free block size", "blocks", "bytes", "cum %");
+  uint64_t cumulative = 0;
+  for (unsigned c = 0; c < 64; c++) {
+    if (counts[c] == 0) {
+      continue;
+    }
+    char range[48];
+    snprintf(range, sizeof(range), "[%lu, %lu)", 1UL << c, 2UL << c);
+    cumulative += bytes[c];
+    printf("%-22s %12zu %14lu %7.2f%%\n", range, counts[c], (unsigned long)bytes[c], 100.0 * cumulative / total);
+  }
+}
+
+static void printMap(const struct SnapshotSegment * segments, uint32_t numSegments, size_t width, size_t rows) {
+  static const char shades[] = " .:+#@";
+  size_t cells = width * rows;
+  uint64_t * used = malloc(cells * sizeof(uint64_t));
+  size_t next = 0;
+  for (uint32_t s = 0; s < numSegments; s++) {
+    uint64_t start = segments[s].start;
+    uint64_t length = segments[s].length;
+    double cellBytes = (double)length / cells;
+    memset(used, 0, cells * sizeof(uint64_t));
+    for (; next < numBlocks && blocks[next].address < start + length; next++) {
+      if (!blocks[next].allocated) {
+        continue;
+      }
+      /* Spread the block's bytes over the cells it covers. */
+      uint64_t from = blocks[next].address - start;
+      uint64_t to = from + metaSize + blocks[next].size;
+      for (size_t cell = (size_t)(from / cellBytes); cell < cells && from < to; cell++) {
+        uint64_t cellEnd = (uint64_t)((cell + 1) * cellBytes);
+        uint64_t stop = to < cellEnd ? to : cellEnd;
+        if (stop > from) {
+          used[cell] += stop - from;
+          from = stop;
+        }
+      }
+    }
+    printf("\nsegment %u: 0x%lx, %lu bytes, %.0f bytes per cell\n", s, (unsigned long)start,
+           (unsigned long)length, cellBytes);
+    for (size_t row = 0; row < rows; row++) {
+      putchar('|');
+      for (size_t column = 0; column < width; column++) {
+        size_t cell = row * width + column;
+        uint64_t span = (uint64_t)((cell + 1) * cellBytes) - (uint64_t)(cell * cellBytes);
+        double fraction = span ? (double)used[cell] / span : 0.0;
+        int shade = 5;
+        if (used[cell] == 0) {
+          shade = 0;
+        } else if (used[cell] < span) {
+          shade = fraction < 0.75 ? 1 + (int)(fraction * 4) : 4;
+        }
+        putchar(shades[shade]);
+      }
+      printf("|\n");
+    }
+  }
+  free(used);
+}
+
+/*
+ * What-if simulation over the free blocks, in address order. First and
+ * worst fit use a max segment tree over the blocks; best fit uses
+ * size-segregated bins with a bitmap of the non-empty ones: one bin per
+ * size below EXACT_BINS, where any block of the first non-empty bin is a
+ * best fit, and eight per power of two above, which are scanned for their
+ * smallest fitting block.
+ */
+static uint64_t * freeSizes;
+static size_t numFree, treeLeaves;
+static uint64_t * tree;
+
+static void treeSet(size_t i, uint64_t size) {
+  size_t node = treeLeaves + i;
+  tree[node] = size;
+  for (node /= 2; node >= 1; node /= 2) {
+    tree[node] = tree[2 * node] > tree[2 * node + 1] ? tree[2 * node] : tree[2 * node + 1];
+  }
+}
+
+static long treeFind(uint64_t atLeast) {
+  if (tree[1] < atLeast) {
+    return -1;
+  }
+  size_t node = 1;
+  while (node < treeLeaves) {
+    node = tree[2 * node] >= atLeast ? 2 * node : 2 * node + 1;
+  }
+  return (long)(node - treeLeaves);
+}
+
+#define EXACT_BINS 4096
+#define NUM_BINS (EXACT_BINS + 64 * 8)
+static long binHead[NUM_BINS];
+static long * binNext;
+static long * binPrev;
+static uint64_t binMap[NUM_BINS / 64];
+
+static unsigned binOf(uint64_t size) {
+  if (size < EXACT_BINS) {
+    return (unsigned)size;
+  }
+  unsigned log = sizeClass(size);
+  return EXACT_BINS + ((log - sizeClass(EXACT_BINS)) << 3) + (unsigned)((size >> (log - 3)) & 7);
+}
+
+static void binInsert(long i) {
+  unsigned bin = binOf(freeSizes[i]);
+  binPrev[i] = -1;
+  binNext[i] = binHead[bin];
+  if (binHead[bin] >= 0) {
+    binPrev[binHead[bin]] = i;
+  }
+  binHead[bin] = i;
+  binMap[bin / 64] |= 1ULL << (bin % 64);
+}
+
+static void binRemove(long i) {
+  unsigned bin = binOf(freeSizes[i]);
+  if (binPrev[i] >= 0) {
+    binNext[binPrev[i]] = binNext[i];
+  } else {
+    binHead[bin] = binNext[i];
+  }
+  if (binNext[i] >= 0) {
+    binPrev[binNext[i]] = binPrev[i];
+  }
+  if (binHead[bin] < 0) {
+    binMap[bin / 64] &= ~(1ULL << (bin % 64));
+  }
+}
+
+static long binSmallest(unsigned bin, uint64_t atLeast) {
+  long best = -1;
+  for (long i = binHead[bin]; i >= 0; i = binNext[i]) {
+    if (freeSizes[i] >= atLeast && (best < 0 || freeSizes[i] < freeSizes[best])) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+static long binFind(uint64_t atLeast) {
+  unsigned bin = binOf(atLeast);
+  if (bin >= EXACT_BINS) {
+    long best = binSmallest(bin, atLeast);
+    if (best >= 0) {
+      return best;
+    }
+    bin++;
+  }
+  for (unsigned word = bin / 64; word < NUM_BINS / 64; word++) {
+    uint64_t bits = binMap[word];
+    if (word == bin / 64) {
+      bits &= ~0ULL << (bin % 64);
+    }
+    if (bits != 0) {
+      unsigned found = word * 64 + __builtin_ctzll(bits);
+      return found < EXACT_BINS ? binHead[found] : binSmallest(found, atLeast);
+    }
+  }
+  return -1;
+}
+
+enum whatIfPolicy { WHATIF_FIRST_FIT, WHATIF_BEST_FIT, WHATIF_WORST_FIT };
+
+static void simulate(enum whatIfPolicy policy, const uint64_t * original, const uint64_t * requests,
+                     size_t numRequests, uint64_t freeBytes) {
+  static const char * names[] = {"first fit", "best fit", "worst fit"};
+  memcpy(freeSizes, original, numFree * sizeof(uint64_t));
+  if (policy == WHATIF_BEST_FIT) {
+    memset(binHead, -1, sizeof(binHead));
+    memset(binMap, 0, sizeof(binMap));
+    for (size_t i = numFree; i-- > 0; ) {
+      binInsert((long)i);
+    }
+  } else {
+    memset(tree, 0, 2 * treeLeaves * sizeof(uint64_t));
+    for (size_t i = 0; i < numFree; i++) {
+      tree[treeLeaves + i] = freeSizes[i];
+    }
+    for (size_t node = treeLeaves - 1; node >= 1; node--) {
+      tree[node] = tree[2 * node] > tree[2 * node + 1] ? tree[2 * node] : tree[2 * node + 1];
+    }
+  }
+
+  size_t served = 0;
+  uint64_t servedBytes = 0;
+  for (; served < numRequests; served++) {
+    uint64_t size = requests[served];
+    long i;
+    if (policy == WHATIF_FIRST_FIT) {
+      i = treeFind(size);
+    } else if (policy == WHATIF_BEST_FIT) {
+      i = binFind(size);
+    } else {
+      i = tree[1] >= size ? treeFind(tree[1]) : -1;
+    }
+    if (i < 0) {
+      break;
+    }
+    uint64_t remaining = freeSizes[i] > metaSize + size ? freeSizes[i] - size - metaSize : 0;
+    servedBytes += remaining ? size + metaSize : freeSizes[i] + metaSize;
+    if (policy == WHATIF_BEST_FIT) {
+      binRemove(i);
+      freeSizes[i] = remaining;
+      if (remaining) {
+        binInsert(i);
+      }
+    } else {
+      freeSizes[i] = remaining;
+      treeSet((size_t)i, remaining);
+    }
+  }
+
+  size_t left = 0;
+  uint64_t largest = 0;
+  for (size_t i = 0; i < numFree; i++) {
+    if (freeSizes[i]) {
+      left++;
+      largest = freeSizes[i] > largest ? freeSizes[i] : largest;
+    }
+  }
+  printf("%-10s %10zu%s %14lu %8.2f%% %12zu %12lu\n", names[policy], served, served == numRequests ? "+" : " ",
+         (unsigned long)servedBytes, freeBytes ? 100.0 * servedBytes / freeBytes : 0.0, left, (unsigned long)largest);
+}
+
+static void printWhatIf(size_t numRequests, uint64_t seed) {
+  uint64_t liveBytes = 0, freeBytes = 0, liveHeaders = 0;
+  size_t numLive = 0;
+  for (size_t i = 0; i < numBlocks; i++) {
+    if (blocks[i].allocated) {
+      liveBytes += blocks[i].size;
+      liveHeaders += metaSize;
+      numLive++;
+    } else {
+      freeBytes += metaSize + blocks[i].size;
+      numFree++;
+    }
+  }
+  printf("\ncompaction: live data and headers fit in %lu bytes, %lu fewer than now\n",
+         (unsigned long)(liveBytes + liveHeaders), (unsigned long)freeBytes);
+  if (numLive == 0 || numFree == 0) {
+    return;
+  }
+
+  uint64_t * liveSizes = malloc(numLive * sizeof(uint64_t));
+  uint64_t * original = malloc(numFree * sizeof(uint64_t));
+  uint64_t * requests = malloc(numRequests * sizeof(uint64_t));
+  freeSizes = malloc(numFree * sizeof(uint64_t));
+  binNext = malloc(numFree * sizeof(long));
+  binPrev = malloc(numFree * sizeof(long));
+  for (treeLeaves = 1; treeLeaves < numFree; treeLeaves *= 2) {
+  }
+  tree = malloc(2 * treeLeaves * sizeof(uint64_t));
+  size_t live = 0, dead = 0;
+  for (size_t i = 0; i < numBlocks; i++) {
+    if (blocks[i].allocated) {
+      liveSizes[live++] = blocks[i].size;
+    } else {
+      original[dead++] = blocks[i].size;
+    }
+  }
+  uint64_t state = seed ? seed : 1;
+  for (size_t i = 0; i < numRequests; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    requests[i] = liveSizes[state % numLive];
+  }
+
+  printf("what-if: up to %zu requests drawn from the live block sizes, served from the existing free blocks\n",
+         numRequests);
+  printf("%-10s %11s %14s %9s %12s %12s\n", "policy", "requests", "bytes reused", "of free", "blocks left",
+         "largest left");
+  simulate(WHATIF_FIRST_FIT, original, requests, numRequests, freeBytes);
+  simulate(WHATIF_BEST_FIT, original, requests, numRequests, freeBytes);
+  simulate(WHATIF_WORST_FIT, original, requests, numRequests, freeBytes);
+  printf("(+: every request was served without growing the heap)\n");
+}
+
+static void usage(const char * program) {
+  fprintf(stderr, "usage: %s [-w width] [-r rows] [-n requests] [-s seed] snapshot.bin\n", program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t width = 64, rows = 16, numRequests = 100000;
+  uint64_t seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:r:n:s:")) != -1) {
+    switch (opt) {
+      case 'w': width = strtoul(optarg, NULL, 10); break;
+      case 'r': rows = strtoul(optarg, NULL, 10); break;
+      case 'n': numRequests = strtoul(optarg, NULL, 10); break;
+      case 's': seed = strtoull(optarg, NULL, 10); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || width == 0 || rows == 0 || numRequests == 0) {
+    usage(argv[0]);
+  }
+  struct SnapshotSegment * segments;
+  uint32_t numSegments;
+  if (!readSnapshot(argv[optind], &segments, &numSegments)) {
+    fprintf(stderr, "%s: cannot read snapshot %s\n", argv[0], argv[optind]);
+    return EXIT_FAILURE;
+  }
+  printSummary(segments, numSegments);
+  printFreeHistogram();
+  printMap(segments, numSegments, width, rows);
+  printWhatIf(numRequests, seed);
+  return EXIT_SUCCESS;
+}
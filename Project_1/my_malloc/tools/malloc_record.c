@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace_format.h"
+
+/*
+ * LD_PRELOAD recorder: interposes malloc, calloc, realloc, free and the
+ * aligned allocation calls, forwards them to the next definition (glibc),
+ * and logs each one to the trace file named by MALLOC_RECORD_FILE
+ * (default malloc_trace.bin).
+ *
+ *     LD_PRELOAD=$PWD/libmalloc_record.so MALLOC_RECORD_FILE=app.trace ./app
+ *
+ * Aligned allocations are recorded as plain mallocs of the same size.
+ * Everything the recorder itself needs comes from mmap, so it never
+ * shows up in its own trace.
+ */
+
+#define EVENT_BUFFER_SIZE 4096
+#define BOOTSTRAP_SIZE    8192
+
+static void * (*realMalloc)(size_t);
+static void * (*realCalloc)(size_t, size_t);
+static void * (*realRealloc)(void *, size_t);
+static void (*realFree)(void *);
+static int (*realPosixMemalign)(void **, size_t, size_t);
+static void * (*realAlignedAlloc)(size_t, size_t);
+static void * (*realMemalign)(size_t, size_t);
+
+/* dlsym may allocate before realCalloc is known; serve that from here. */
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrapUsed;
+
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+static int traceFd = -1;
+static bool unbuffered;
+static struct TraceEvent events[EVENT_BUFFER_SIZE];
+static size_t eventCount;
+static uint32_t nextId;
+static uint64_t startTime;
+
+static __thread int threadNumber __attribute__((tls_model("initial-exec"))) = -1;
+static __thread bool recording __attribute__((tls_model("initial-exec")));
+static int threadCount;
+
+/*
+ * Pointer -> id map: open addressing with linear probing and backward-shift
+ * deletion, so no tombstones build up under churn.
+ */
+struct IdSlot {
+  uintptr_t ptr;
+  uint32_t id;
+};
+
+static struct IdSlot * idSlots;
+static size_t idCapacity;
+static size_t idCount;
+
+static size_t hashPointer(uintptr_t ptr) {
+  return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15ull);
+}
+
+static void idMapInsert(uintptr_t ptr, uint32_t id);
+
+static bool growIdMap() {
+  size_t oldCapacity = idCapacity;
+  struct IdSlot * oldSlots = idSlots;
+  size_t capacity = oldCapacity == 0 ? (1 << 16) : oldCapacity * 2;
+  void * memory = mmap(NULL, capacity * sizeof(struct IdSlot), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  idSlots = memory;
+  idCapacity = capacity;
+  idCount = 0;
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (oldSlots[i].ptr != 0) {
+      idMapInsert(oldSlots[i].ptr, oldSlots[i].id);
+    }
+  }
+  if (oldSlots != NULL) {
+    munmap(oldSlots, oldCapacity * sizeof(struct IdSlot));
+  }
+  return true;
+}
+
+static void idMapInsert(uintptr_t ptr, uint32_t id) {
+  if ((idCount + 1) * 2 > idCapacity && !growIdMap()) {
+    return;
+  }
+  size_t mask = idCapacity - 1;
+  size_t i = hashPointer(ptr) & mask;
+  while (idSlots[i].ptr != 0 && idSlots[i].ptr != ptr) {
+    i = (i + 1) & mask;
+  }
+  if (idSlots[i].ptr == 0) {
+    idCount++;
+  }
+  idSlots[i].ptr = ptr;
+  idSlots[i].id = id;
+}
+
+/*
+ * @brief Removes ptr from the map.
+ * @return true and its id in *id if ptr was present.
+ */
+static bool idMapRemove(uintptr_t ptr, uint32_t * id) {
+  if (idCapacity == 0) {
+    return false;
+  }
+  size_t mask = idCapacity - 1;
+  size_t i = hashPointer(ptr) & mask;
+  while (idSlots[i].ptr != ptr) {
+    if (idSlots[i].ptr == 0) {
+      return false;
+    }
+    i = (i + 1) & mask;
+  }
+  *id = idSlots[i].id;
+  idCount--;
+  size_t hole = i;
+  for (size_t j = (i + 1) & mask; idSlots[j].ptr != 0; j = (j + 1) & mask) {
+    size_t home = hashPointer(idSlots[j].ptr) & mask;
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      idSlots[hole] = idSlots[j];
+      hole = j;
+    }
+  }
+  idSlots[hole].ptr = 0;
+  return true;
+}
+
+static uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void writeAll(const void * data, size_t bytes) {
+  const char * cursor = data;
+  while (bytes > 0) {
+    ssize_t written = write(traceFd, cursor, bytes);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(traceFd);
+      traceFd = -1;
+      return;
+    }
+    cursor += written;
+    bytes -= (size_t)written;
+  }
+}
+
+static void flushEvents() {
+  if (traceFd >= 0 && eventCount > 0) {
+    writeAll(events, eventCount * sizeof(struct TraceEvent));
+  }
+  eventCount = 0;
+}
+
+/*
+ * @brief Appends one event. Called with recordLock held.
+ */
+static void logEvent(enum traceEventOp op, uint32_t id, size_t size) {
+  if (threadNumber < 0) {
+    threadNumber = threadCount++;
+  }
+  uint64_t now = nowNs();
+  if (startTime == 0) {
+    startTime = now;
+  }
+  struct TraceEvent * event = &events[eventCount++];
+  event->time = now - startTime;
+  event->size = size;
+  event->id = id;
+  event->thread = (uint16_t)threadNumber;
+  event->op = (uint8_t)op;
+  event->reserved = 0;
+  if (eventCount == EVENT_BUFFER_SIZE || unbuffered) {
+    flushEvents();
+  }
+}
+
+static void recordAllocation(enum traceEventOp op, void * ptr, size_t size) {
+  if (ptr == NULL || recording) {
+    return;
+  }
+  recording = true;
+  pthread_mutex_lock(&recordLock);
+  uint32_t id = nextId++;
+  idMapInsert((uintptr_t)ptr, id);
+  logEvent(op, id, size);
+  pthread_mutex_unlock(&recordLock);
+  recording = false;
+}
+
+static void recordFree(void * ptr) {
+  if (ptr == NULL || recording) {
+    return;
+  }
+  recording = true;
+  pthread_mutex_lock(&recordLock);
+  uint32_t id;
+  if (idMapRemove((uintptr_t)ptr, &id)) {
+    logEvent(TRACE_EVENT_FREE, id, 0);
+  }
+  pthread_mutex_unlock(&recordLock);
+  recording = false;
+}
+
+/*
+ * @brief Reallocates and records the resize. The object keeps its id; one
+ * that predates recording becomes a fresh allocation. The lock is held
+ * across the call so no other thread can be handed the old address before
+ * the map forgets it.
+ */
+static void * reallocAndRecord(void * ptr, size_t size) {
+  if (recording) {
+    return realRealloc(ptr, size);
+  }
+  recording = true;
+  pthread_mutex_lock(&recordLock);
+  void * newPtr = realRealloc(ptr, size);
+  uint32_t id;
+  if (newPtr != NULL) {
+    if (idMapRemove((uintptr_t)ptr, &id)) {
+      idMapInsert((uintptr_t)newPtr, id);
+      logEvent(TRACE_EVENT_REALLOC, id, size);
+    } else {
+      id = nextId++;
+      idMapInsert((uintptr_t)newPtr, id);
+      logEvent(TRACE_EVENT_MALLOC, id, size);
+    }
+  }
+  pthread_mutex_unlock(&recordLock);
+  recording = false;
+  return newPtr;
+}
+
+static void resolveSymbols() {
+  realCalloc = dlsym(RTLD_NEXT, "calloc");
+  realMalloc = dlsym(RTLD_NEXT, "malloc");
+  realRealloc = dlsym(RTLD_NEXT, "realloc");
+  realFree = dlsym(RTLD_NEXT, "free");
+  realPosixMemalign = dlsym(RTLD_NEXT, "posix_memalign");
+  realAlignedAlloc = dlsym(RTLD_NEXT, "aligned_alloc");
+  realMemalign = dlsym(RTLD_NEXT, "memalign");
+}
+
+__attribute__((constructor)) static void startRecording() {
+  if (realMalloc == NULL) {
+    resolveSymbols();
+  }
+  const char * path = getenv("MALLOC_RECORD_FILE");
+  if (path == NULL || path[0] == '\0') {
+    path = "malloc_trace.bin";
+  }
+  pthread_mutex_lock(&recordLock);
+  traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (traceFd >= 0) {
+    struct TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.eventSize = sizeof(struct TraceEvent);
+    header.reserved = 0;
+    writeAll(&header, sizeof(header));
+  }
+  pthread_mutex_unlock(&recordLock);
+}
+
+/*
+ * Later destructors and atexit handlers may still allocate; from here on
+ * every event is written straight through.
+ */
+__attribute__((destructor)) static void stopRecording() {
+  pthread_mutex_lock(&recordLock);
+  flushEvents();
+  unbuffered = true;
+  pthread_mutex_unlock(&recordLock);
+}
+
+static bool fromBootstrap(void * ptr) {
+  return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+void * malloc(size_t size) {
+  if (realMalloc == NULL) {
+    resolveSymbols();
+  }
+  void * ptr = realMalloc(size);
+  recordAllocation(TRACE_EVENT_MALLOC, ptr, size);
+  return ptr;
+}
+
+void * calloc(size_t count, size_t size) {
+  if (realCalloc == NULL) {
+    /* dlsym itself is asking; bump-allocate from the zeroed bootstrap area. */
+    size_t bytes = (count * size + 15) & ~(size_t)15;
+    if (bootstrapUsed + bytes > BOOTSTRAP_SIZE) {
+      return NULL;
+    }
+    void * ptr = bootstrap + bootstrapUsed;
+    bootstrapUsed += bytes;
+    return ptr;
+  }
+  void * ptr = realCalloc(count, size);
+  recordAllocation(TRACE_EVENT_CALLOC, ptr, count * size);
+  return ptr;
+}
+
+void * realloc(void * ptr, size_t size) {
+  if (realRealloc == NULL) {
+    resolveSymbols();
+  }
+  if (ptr == NULL) {
+    return malloc(size);
+  }
+  if (fromBootstrap(ptr)) {
+    void * copy = malloc(size);
+    if (copy != NULL) {
+      size_t available = (size_t)(bootstrap + BOOTSTRAP_SIZE - (char *)ptr);
+      memcpy(copy, ptr, size < available ? size : available);
+    }
+    return copy;
+  }
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return reallocAndRecord(ptr, size);
+}
+
+void free(void * ptr) {
+  if (ptr == NULL || fromBootstrap(ptr)) {
+    return;
+  }
+  if (realFree == NULL) {
+    resolveSymbols();
+  }
+  recordFree(ptr);
+  realFree(ptr);
+}
+
+int posix_memalign(void ** result, size_t alignment, size_t size) {
+  if (realPosixMemalign == NULL) {
+    resolveSymbols();
+  }
+  int error = realPosixMemalign(result, alignment, size);
+  if (error == 0) {
+    recordAllocation(TRACE_EVENT_MALLOC, *result, size);
+  }
+  return error;
+}
+
+void * aligned_alloc(size_t alignment, size_t size) {
+  if (realAlignedAlloc == NULL) {
+    resolveSymbols();
+  }
+  void * ptr = realAlignedAlloc(alignment, size);
+  recordAllocation(TRACE_EVENT_MALLOC, ptr, size);
+  return ptr;
+}
+
+void * memalign(size_t alignment, size_t size) {
+  if (realMemalign == NULL) {
+    resolveSymbols();
+  }
+  void * ptr = realMemalign(alignment, size);
+  recordAllocation(TRACE_EVENT_MALLOC, ptr, size);
+  return ptr;
+}
@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "my_malloc.h"
+#include "trace_format.h"
+
+/*
+ * Deterministic replay of a malloc_record trace against one allocator.
+ *
+ *     malloc_replay [-a ff|bf|ad|ts_lock|ts_nolock|glibc] [-n samples] trace.bin
+ *
+ * Events run on one thread in recorded order, so two replays of the same
+ * trace make exactly the same calls. Every allocation writes its first
+ * byte and realloc copies the old contents, as the traced program would.
+ * The ff_/bf_ entry points have no realloc or calloc; they are replayed as
+ * malloc + memcpy + free and malloc + memset.
+ *
+ * Output is a CSV time series of -n evenly spaced samples (default 20)
+ *
+ *     events,live_bytes,segment_bytes,free_bytes,fragmentation
+ *
+ * followed by a summary. live_bytes is the bytes the trace has requested
+ * and not yet freed; fragmentation is 1 - live_bytes / segment_bytes. For
+ * glibc the segment is mallinfo2's arena + hblkhd. Sampling is excluded
+ * from the timing. The peak live size counts every event, but the peak
+ * segment is the largest sample, so raise -n for a closer figure.
+ *
+ * The ad_ and ts_ entry points are declared weak: build against a library that
+ * provides them (make WDIR=../../../project2/core) to replay with them.
+ */
+
+void * ad_malloc(size_t size) __attribute__((weak));
+void ad_free(void * ptr) __attribute__((weak));
+void * ts_malloc_lock(size_t size) __attribute__((weak));
+void ts_free_lock(void * ptr) __attribute__((weak));
+void * ts_malloc_nolock(size_t size) __attribute__((weak));
+void ts_free_nolock(void * ptr) __attribute__((weak));
+
+typedef void * (*mallocFuncPtr)(size_t);
+typedef void (*freeFuncPtr)(void *);
+
+struct Allocator {
+  const char * name;
+  mallocFuncPtr allocate;
+  freeFuncPtr release;
+};
+
+static double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+}
+
+static void * mapArray(size_t bytes) {
+  void * memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+static void segmentUsage(int glibc, size_t * segment, size_t * freeSpace) {
+  if (glibc) {
+    struct mallinfo2 info = mallinfo2();
+    *segment = info.arena + info.hblkhd;
+    *freeSpace = info.fordblks;
+  } else {
+    *segment = get_data_segment_size();
+    *freeSpace = get_data_segment_free_space_size();
+  }
+}
+
+static void usage(const char * program) {
+  fprintf(stderr, "usage: %s [-a ff|bf|ad|ts_lock|ts_nolock|glibc] [-n samples] trace.bin\n", program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  struct Allocator allocators[] = {
+    {"ff", ff_malloc, ff_free},
+    {"bf", bf_malloc, bf_free},
+    {"ad", ad_malloc, ad_free},
+    {"ts_lock", ts_malloc_lock, ts_free_lock},
+    {"ts_nolock", ts_malloc_nolock, ts_free_nolock},
+    {"glibc", malloc, free},
+  };
+  const char * name = "ff";
+  size_t samples = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "a:n:")) != -1) {
+    switch (opt) {
+      case 'a':
+        name = optarg;
+        break;
+      case 'n':
+        samples = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  struct Allocator * allocator = NULL;
+  for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+    if (strcmp(allocators[i].name, name) == 0) {
+      allocator = &allocators[i];
+    }
+  }
+  if (allocator == NULL) {
+    usage(argv[0]);
+  }
+  if (allocator->allocate == NULL || allocator->release == NULL) {
+    fprintf(stderr, "%s: this build's library has no %s entry points\n", argv[0], name);
+    return EXIT_FAILURE;
+  }
+  int glibc = allocator->allocate == malloc;
+
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(argv[optind]);
+    return EXIT_FAILURE;
+  }
+  const struct TraceFileHeader * header = NULL;
+  if ((size_t)st.st_size >= sizeof(*header)) {
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  }
+  if (header == NULL || header == MAP_FAILED || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->eventSize != sizeof(struct TraceEvent)) {
+    fprintf(stderr, "%s: not a malloc_record trace\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  const struct TraceEvent * events = (const struct TraceEvent *)(header + 1);
+  size_t numEvents = (st.st_size - sizeof(*header)) / sizeof(struct TraceEvent);
+
+  /* Objects and sizes by id live outside the heap being measured. */
+  uint32_t maxId = 0;
+  for (size_t i = 0; i < numEvents; i++) {
+    if (events[i].id > maxId) {
+      maxId = events[i].id;
+    }
+  }
+  void ** objects = mapArray(((size_t)maxId + 1) * sizeof(void *));
+  size_t * sizes = mapArray(((size_t)maxId + 1) * sizeof(size_t));
+
+  size_t interval = samples > 0 ? (numEvents + samples - 1) / samples : numEvents;
+  if (interval == 0) {
+    interval = 1;
+  }
+  size_t liveBytes = 0, peakLive = 0, peakSegment = 0, segment = 0, freeSpace = 0;
+  size_t skipped = 0;
+  double elapsed = 0;
+  struct timespec start_time, end_time;
+
+  printf("events,live_bytes,segment_bytes,free_bytes,fragmentation\n");
+  for (size_t done = 0; done < numEvents; ) {
+    size_t stop = done + interval < numEvents ? done + interval : numEvents;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (; done < stop; done++) {
+      const struct TraceEvent * event = &events[done];
+      void * old = objects[event->id];
+      void * ptr;
+      switch (event->op) {
+        case TRACE_EVENT_MALLOC:
+        case TRACE_EVENT_CALLOC:
+          if (old != NULL) {
+            skipped++;
+            break;
+          }
+          if (glibc && event->op == TRACE_EVENT_CALLOC) {
+            ptr = calloc(1, event->size);
+          } else {
+            ptr = allocator->allocate(event->size);
+            if (ptr != NULL && event->op == TRACE_EVENT_CALLOC) {
+              memset(ptr, 0, event->size);
+            } else if (ptr != NULL && event->size > 0) {
+              *(volatile char *)ptr = 0;
+            }
+          }
+          objects[event->id] = ptr;
+          sizes[event->id] = event->size;
+          liveBytes += event->size;
+          break;
+        case TRACE_EVENT_REALLOC:
+          if (old == NULL) {
+            skipped++;
+            break;
+          }
+          if (glibc) {
+            ptr = realloc(old, event->size);
+          } else {
+            ptr = allocator->allocate(event->size);
+            if (ptr != NULL) {
+              memcpy(ptr, old, sizes[event->id] < event->size ? sizes[event->id] : event->size);
+              allocator->release(old);
+            }
+          }
+          if (ptr != NULL) {
+            objects[event->id] = ptr;
+            liveBytes += event->size - sizes[event->id];
+            sizes[event->id] = event->size;
+          }
+          break;
+        case TRACE_EVENT_FREE:
+          if (old == NULL) {
+            skipped++;
+            break;
+          }
+          allocator->release(old);
+          objects[event->id] = NULL;
+          liveBytes -= sizes[event->id];
+          break;
+        default:
+          skipped++;
+      }
+      if (liveBytes > peakLive) {
+        peakLive = liveBytes;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    elapsed += calc_time(start_time, end_time);
+
+    segmentUsage(glibc, &segment, &freeSpace);
+    if (segment > peakSegment) {
+      peakSegment = segment;
+    }
+    printf("%zu,%zu,%zu,%zu,%.4f\n", done, liveBytes, segment, freeSpace,
+           segment > 0 ? 1.0 - (double)liveBytes / segment : 0.0);
+  }
+
+  printf("# allocator %s, %zu events", name, numEvents);
+  if (skipped > 0) {
+    printf(" (%zu skipped: unknown or reused id)", skipped);
+  }
+  printf("\n# time %.6f s, %.2f M events/s\n", elapsed / 1e9, elapsed > 0 ? numEvents / elapsed * 1e3 : 0.0);
+  printf("# peak live %zu bytes, peak segment %zu bytes (sampled)\n", peakLive, peakSegment);
+  printf("# final fragmentation %.4f\n", segment > 0 ? 1.0 - (double)liveBytes / segment : 0.0);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,353 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace_format.h"
+
+/*
+ * Computes the size-class table that minimizes internal fragmentation for
+ * an observed request-size mix, and writes it as a header usable from C
+ * (static const tables) and C++ (constexpr tables).
+ *
+ *     size_class_opt [-k classes] [-a align] [-m max] [-o out.h] INPUT
+ *
+ * INPUT is one of
+ *     -t trace.bin   a malloc_record trace (malloc/calloc/realloc sizes)
+ *     -H hist.txt    "SIZE COUNT" pairs, one per line
+ *     -s stats.json  my_malloc_stats_print(..., MY_MALLOC_STATS_JSON)
+ *                    output; its classes are powers of two, so every
+ *                    request in [2^k, 2^(k+1)) is taken to be 2^(k+1) - 1
+ *
+ * Requests are rounded up to -a bytes (default 16); those above -m
+ * (default: the largest request) are left to the allocator's large-object
+ * path and ignored. With sizes s_1 < ... < s_n seen c_i times, the waste
+ * of a table is sum c_i * (class(s_i) - s_i). The optimal table of k
+ * classes is found by dynamic programming over the sorted sizes; since the
+ * best split point only moves right as the prefix grows, each layer is
+ * solved by divide and conquer in O(n log n).
+ *
+ * A summary comparing the table with power-of-two classes goes to stderr.
+ */
+
+#define MAX_CLASSES 255
+
+struct SizeCount {
+  size_t size;
+  double count;
+};
+
+static struct SizeCount * entries;
+static size_t numEntries, entriesCapacity;
+
+static void addSize(size_t size, double count) {
+  if (numEntries == entriesCapacity) {
+    entriesCapacity = entriesCapacity == 0 ? 1024 : 2 * entriesCapacity;
+    entries = realloc(entries, entriesCapacity * sizeof(*entries));
+    if (entries == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  entries[numEntries].size = size;
+  entries[numEntries].count = count;
+  numEntries++;
+}
+
+static int compareEntries(const void * a, const void * b) {
+  size_t x = ((const struct SizeCount *)a)->size, y = ((const struct SizeCount *)b)->size;
+  return (x > y) - (x < y);
+}
+
+static int readTrace(const char * path) {
+  FILE * in = fopen(path, "rb");
+  struct TraceFileHeader header;
+  if (in == NULL || fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.eventSize != sizeof(struct TraceEvent)) {
+    return 0;
+  }
+  struct TraceEvent event;
+  while (fread(&event, sizeof(event), 1, in) == 1) {
+    if (event.op != TRACE_EVENT_FREE && event.size > 0) {
+      addSize(event.size, 1);
+    }
+  }
+  fclose(in);
+  return 1;
+}
+
+static int readHistogram(const char * path) {
+  FILE * in = fopen(path, "r");
+  if (in == NULL) {
+    return 0;
+  }
+  size_t size;
+  double count;
+  while (fscanf(in, "%zu %lf", &size, &count) == 2) {
+    if (size > 0 && count > 0) {
+      addSize(size, count);
+    }
+  }
+  fclose(in);
+  return 1;
+}
+
+static int readStats(const char * path) {
+  FILE * in = fopen(path, "r");
+  if (in == NULL) {
+    return 0;
+  }
+  const char * key = "\"min_size\":";
+  size_t matched = 0;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    matched = c == key[matched] ? matched + 1 : (c == key[0] ? 1 : 0);
+    if (key[matched] != '\0') {
+      continue;
+    }
+    matched = 0;
+    size_t minSize, freeBlocks, allocations;
+    if (fscanf(in, "%zu,\"free_blocks\":%zu,\"allocations\":%zu", &minSize, &freeBlocks, &allocations) == 3 &&
+        allocations > 0) {
+      addSize(2 * minSize - 1, allocations);
+    }
+  }
+  fclose(in);
+  return 1;
+}
+
+/*
+ * Layer k of the DP: best[j] is the least waste covering sizes[0..j] with
+ * k classes, the last of which is sizes[j].
+ */
+static size_t n;
+static size_t * sizes;
+static double * prefixCount;     /* sum of counts of sizes[0..j) */
+static double * prefixBytes;     /* sum of count * size of sizes[0..j) */
+static double * previous;
+static double * current;
+static uint32_t * choice;        /* per layer: index of the previous class */
+
+static double classWaste(size_t first, size_t last) {
+  double count = prefixCount[last + 1] - prefixCount[first];
+  double bytes = prefixBytes[last + 1] - prefixBytes[first];
+  return (double)sizes[last] * count - bytes;
+}
+
+static void solveLayer(uint32_t * layerChoice, size_t low, size_t high, size_t optLow, size_t optHigh) {
+  if (low > high) {
+    return;
+  }
+  size_t mid = low + (high - low) / 2;
+  double best = -1;
+  size_t bestSplit = optLow;
+  size_t limit = optHigh < mid ? optHigh : mid - 1;
+  for (size_t split = optLow; split <= limit; split++) {
+    double waste = previous[split] + classWaste(split + 1, mid);
+    if (best < 0 || waste < best) {
+      best = waste;
+      bestSplit = split;
+    }
+  }
+  current[mid] = best;
+  layerChoice[mid] = (uint32_t)bestSplit;
+  if (mid > low) {
+    solveLayer(layerChoice, low, mid - 1, optLow, bestSplit);
+  }
+  solveLayer(layerChoice, mid + 1, high, bestSplit, optHigh);
+}
+
+/*
+ * @brief Fills classes[0..k) with the optimal table.
+ */
+static void optimize(size_t k, size_t * classes) {
+  previous = malloc(n * sizeof(double));
+  current = malloc(n * sizeof(double));
+  choice = malloc(k * n * sizeof(uint32_t));
+  if (previous == NULL || current == NULL || choice == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t j = 0; j < n; j++) {
+    previous[j] = classWaste(0, j);
+  }
+  for (size_t layer = 1; layer < k; layer++) {
+    for (size_t j = 0; j < layer; j++) {
+      current[j] = 0;
+    }
+    solveLayer(choice + layer * n, layer, n - 1, layer - 1, n - 2);
+    double * swap = previous;
+    previous = current;
+    current = swap;
+  }
+  size_t last = n - 1;
+  for (size_t layer = k; layer-- > 0; ) {
+    classes[layer] = sizes[last];
+    if (layer > 0) {
+      last = choice[layer * n + last];
+    }
+  }
+  free(previous);
+  free(current);
+  free(choice);
+}
+
+static double tableWaste(const size_t * classes, size_t k) {
+  double waste = 0;
+  size_t c = 0;
+  for (size_t j = 0; j < n; j++) {
+    while (c < k - 1 && classes[c] < sizes[j]) {
+      c++;
+    }
+    waste += (double)(classes[c] - sizes[j]) * (prefixCount[j + 1] - prefixCount[j]);
+  }
+  return waste;
+}
+
+static void usage(const char * program) {
+  fprintf(stderr, "usage: %s [-k classes] [-a align] [-m max] [-o out.h] -t trace.bin | -H hist.txt | -s stats.json\n",
+          program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t k = 32, align = 16, maxSize = 0;
+  const char * output = NULL;
+  const char * input = NULL;
+  int (*reader)(const char *) = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "k:a:m:o:t:H:s:")) != -1) {
+    switch (opt) {
+      case 'k': k = strtoul(optarg, NULL, 10); break;
+      case 'a': align = strtoul(optarg, NULL, 10); break;
+      case 'm': maxSize = strtoul(optarg, NULL, 10); break;
+      case 'o': output = optarg; break;
+      case 't': input = optarg; reader = readTrace; break;
+      case 'H': input = optarg; reader = readHistogram; break;
+      case 's': input = optarg; reader = readStats; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (reader == NULL || optind != argc || k == 0 || k > MAX_CLASSES || align == 0 || (align & (align - 1)) != 0) {
+    usage(argv[0]);
+  }
+  if (!reader(input)) {
+    fprintf(stderr, "%s: cannot read %s\n", argv[0], input);
+    return EXIT_FAILURE;
+  }
+
+  /* Round to the alignment, drop the large ones, merge duplicates. */
+  double requests = 0, ignored = 0;
+  size_t kept = 0;
+  if (maxSize == 0) {
+    for (size_t i = 0; i < numEntries; i++) {
+      if (entries[i].size > maxSize) {
+        maxSize = entries[i].size;
+      }
+    }
+  }
+  maxSize = (maxSize + align - 1) & ~(align - 1);
+  for (size_t i = 0; i < numEntries; i++) {
+    requests += entries[i].count;
+    size_t rounded = (entries[i].size + align - 1) & ~(align - 1);
+    if (rounded > maxSize) {
+      ignored += entries[i].count;
+      continue;
+    }
+    entries[kept].size = rounded;
+    entries[kept].count = entries[i].count;
+    kept++;
+  }
+  if (kept == 0) {
+    fprintf(stderr, "%s: no requests of at most %zu bytes\n", argv[0], maxSize);
+    return EXIT_FAILURE;
+  }
+  qsort(entries, kept, sizeof(*entries), compareEntries);
+  /* One spare entry for maxSize, added below if no request rounds to it. */
+  sizes = malloc((kept + 1) * sizeof(size_t));
+  prefixCount = calloc(kept + 2, sizeof(double));
+  prefixBytes = calloc(kept + 2, sizeof(double));
+  for (size_t i = 0; i < kept; i++) {
+    if (n > 0 && sizes[n - 1] == entries[i].size) {
+      prefixCount[n] += entries[i].count;
+      prefixBytes[n] += entries[i].count * entries[i].size;
+      continue;
+    }
+    sizes[n] = entries[i].size;
+    prefixCount[n + 1] = prefixCount[n] + entries[i].count;
+    prefixBytes[n + 1] = prefixBytes[n] + entries[i].count * entries[i].size;
+    n++;
+  }
+
+  /* The top class must be maxSize itself so every covered request fits. */
+  if (sizes[n - 1] != maxSize) {
+    sizes[n] = maxSize;
+    prefixCount[n + 1] = prefixCount[n];
+    prefixBytes[n + 1] = prefixBytes[n];
+    n++;
+  }
+  size_t classes[MAX_CLASSES];
+  if (n <= k) {
+    k = n;
+    memcpy(classes, sizes, n * sizeof(size_t));
+  } else {
+    optimize(k, classes);
+  }
+
+  size_t powers[64];
+  size_t numPowers = 0;
+  for (size_t size = align; ; size *= 2) {
+    powers[numPowers++] = size < maxSize ? size : maxSize;
+    if (size >= maxSize) {
+      break;
+    }
+  }
+  double covered = prefixCount[n];
+  double bytes = prefixBytes[n];
+  double waste = tableWaste(classes, k);
+  double powerWaste = tableWaste(powers, numPowers);
+  fprintf(stderr, "%.0f requests, %.0f above %zu bytes ignored, %zu distinct sizes\n", requests, ignored, maxSize, n);
+  fprintf(stderr, "optimized, %zu classes: %.2f%% internal fragmentation (%.1f bytes/request)\n",
+          k, 100.0 * waste / (bytes + waste), waste / covered);
+  fprintf(stderr, "powers of two, %zu classes: %.2f%% internal fragmentation (%.1f bytes/request)\n",
+          numPowers, 100.0 * powerWaste / (bytes + powerWaste), powerWaste / covered);
+
+  FILE * out = output != NULL ? fopen(output, "w") : stdout;
+  if (out == NULL) {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "/*\n * Size classes generated by size_class_opt from %s:\n", input);
+  fprintf(out, " * %zu classes for %.0f requests of at most %zu bytes, %zu-byte aligned.\n", k, covered, maxSize, align);
+  fprintf(out, " * Expected internal fragmentation %.2f%% (powers of two: %.2f%%).\n",
+          100.0 * waste / (bytes + waste), 100.0 * powerWaste / (bytes + powerWaste));
+  fprintf(out, " * Regenerate rather than edit.\n */\n");
+  fprintf(out, "#ifndef SIZE_CLASSES_H\n#define SIZE_CLASSES_H\n#include <stddef.h>\n\n");
+  fprintf(out, "#define SIZE_CLASS_COUNT %zu\n#define SIZE_CLASS_ALIGN %zu\n#define SIZE_CLASS_MAX   %zu\n\n",
+          k, align, maxSize);
+  fprintf(out, "#ifdef __cplusplus\n#define SIZE_CLASS_TABLE constexpr\n#define SIZE_CLASS_FUNC  constexpr inline\n"
+               "#else\n#define SIZE_CLASS_TABLE static const\n#define SIZE_CLASS_FUNC  static inline\n#endif\n\n");
+  fprintf(out, "SIZE_CLASS_TABLE size_t sizeClasses[SIZE_CLASS_COUNT] = {");
+  for (size_t c = 0; c < k; c++) {
+    fprintf(out, "%s%s%zu", c == 0 ? "" : ",", c % 8 == 0 ? "\n  " : " ", classes[c]);
+  }
+  fprintf(out, "\n};\n\n/* sizeClassLookup[(size + SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN] is the class of size. */\n");
+  fprintf(out, "SIZE_CLASS_TABLE unsigned char sizeClassLookup[SIZE_CLASS_MAX / SIZE_CLASS_ALIGN + 1] = {");
+  size_t c = 0;
+  for (size_t slot = 0; slot <= maxSize / align; slot++) {
+    while (classes[c] < slot * align) {
+      c++;
+    }
+    fprintf(out, "%s%s%zu", slot == 0 ? "" : ",", slot % 16 == 0 ? "\n  " : " ", c);
+  }
+  fprintf(out, "\n};\n\n");
+  fprintf(out, "/* Index of the smallest class that holds size; size must not exceed SIZE_CLASS_MAX. */\n");
+  fprintf(out, "SIZE_CLASS_FUNC unsigned sizeClassIndex(size_t size) {\n"
+               "  return sizeClassLookup[(size + SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN];\n}\n\n#endif\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  return EXIT_SUCCESS;
+}
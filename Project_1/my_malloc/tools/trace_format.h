@@ -0,0 +1,40 @@
+#ifndef __MALLOC_TRACE_FORMAT__
+#define __MALLOC_TRACE_FORMAT__
+#include <stdint.h>
+
+/*
+ * On-disk format shared by malloc_record and malloc_replay.
+ *
+ * A trace is a TraceFileHeader followed by fixed-size TraceEvents in the
+ * order the calls returned. Objects are named by ids rather than
+ * addresses: every successful malloc/calloc takes the next id, a realloc
+ * keeps the id of the object it resizes, and a free names the id being
+ * released. Ids are dense, so the replayer can keep its live objects in a
+ * plain array indexed by id.
+ */
+
+#define TRACE_MAGIC "MMTRACE1"
+
+enum traceEventOp {
+  TRACE_EVENT_MALLOC,
+  TRACE_EVENT_CALLOC,
+  TRACE_EVENT_REALLOC,
+  TRACE_EVENT_FREE
+};
+
+struct TraceFileHeader {
+  char magic[8];          /* TRACE_MAGIC, not NUL-terminated */
+  uint32_t eventSize;     /* sizeof(struct TraceEvent) */
+  uint32_t reserved;
+};
+
+struct TraceEvent {
+  uint64_t time;          /* ns since the recorder started */
+  uint64_t size;          /* requested bytes; 0 for free */
+  uint32_t id;            /* object id */
+  uint16_t thread;        /* recorder-assigned thread number, from 0 */
+  uint8_t op;             /* enum traceEventOp */
+  uint8_t reserved;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+/*
+ * One traced call. elapsed is capped to 32 bits of ticks; anything longer
+ * lands in the last histogram bucket anyway.
+ */
+struct TraceRecord {
+  uint32_t elapsed;
+  uint8_t op;
+  uint8_t sizeClass;
+};
+typedef struct TraceRecord TraceRecord;
+
+struct TraceHistogram {
+  _Atomic uint64_t counts[TRACE_NUM_OPS][TRACE_SIZE_CLASSES][TRACE_BUCKETS];
+  _Atomic uint64_t sums[TRACE_NUM_OPS][TRACE_SIZE_CLASSES];
+};
+typedef struct TraceHistogram TraceHistogram;
+
+/*
+ * Per-thread ring. Only the owning thread writes records and head. Records
+ * in [tail, head) are pending; whoever advances tail with a CAS owns them.
+ * The owner drains into its own histogram when the ring fills up, the
+ * dumper drains into the global one, and a slot is only reused after tail
+ * has moved past it, so a dumper that copied a slot the owner has since
+ * drained loses its CAS and retries.
+ */
+struct TraceBuffer {
+  _Atomic size_t head;
+  _Atomic size_t tail;
+  struct TraceBuffer * next;
+  TraceHistogram histogram;
+  TraceRecord ring[TRACE_RING_SIZE];
+};
+typedef struct TraceBuffer TraceBuffer;
+
+__thread struct TraceSampler traceSampler __attribute__((tls_model("initial-exec")));
+static __thread TraceBuffer * threadBuffer;
+static _Atomic(TraceBuffer *) traceBuffers;
+
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static TraceHistogram dumpedHistogram;
+static TraceRecord dumpScratch[TRACE_RING_SIZE];
+
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+static uint64_t anchorTicks;
+static struct timespec anchorTime;
+static const char * exitDumpPath;
+
+static const char * opNames[TRACE_NUM_OPS] = {"ff_malloc", "bf_malloc", "ad_malloc", "free"};
+static const char * classNames[TRACE_SIZE_CLASSES] = {
+  "[0, 64)", "[64, 256)", "[256, 1K)", "[1K, 4K)",
+  "[4K, 16K)", "[16K, 64K)", "[64K, 1M)", "[1M, inf)"
+};
+
+static unsigned traceSizeClass(size_t size) {
+  if (size < 64) {
+    return 0;
+  }
+  if (size >= (1 << 20)) {
+    return 7;
+  }
+  unsigned sizeClass = (63 - __builtin_clzl(size) - 4) / 2;
+  return sizeClass < 6 ? sizeClass : 6;
+}
+
+/*
+ * Values below 2 * TRACE_SUB_BUCKETS get a bucket each; above that every
+ * power of two is split into TRACE_SUB_BUCKETS equal steps.
+ */
+static unsigned traceBucket(uint64_t value) {
+  if (value < 2 * TRACE_SUB_BUCKETS) {
+    return (unsigned)value;
+  }
+  unsigned exponent = 63 - __builtin_clzll(value);
+  unsigned sub = (unsigned)(value >> (exponent - 3)) & (TRACE_SUB_BUCKETS - 1);
+  unsigned bucket = 2 * TRACE_SUB_BUCKETS + (exponent - 4) * TRACE_SUB_BUCKETS + sub;
+  return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+/*
+ * @brief Midpoint of the values that map to a bucket.
+ */
+static double traceBucketValue(unsigned bucket) {
+  if (bucket < 2 * TRACE_SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned exponent = 4 + (bucket - 2 * TRACE_SUB_BUCKETS) / TRACE_SUB_BUCKETS;
+  unsigned sub = (bucket - 2 * TRACE_SUB_BUCKETS) % TRACE_SUB_BUCKETS;
+  double low = (double)((uint64_t)(TRACE_SUB_BUCKETS + sub) << (exponent - 3));
+  return low + (double)(1ull << (exponent - 3)) / 2;
+}
+
+static void addRecords(TraceHistogram * histogram, const TraceRecord * records, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const TraceRecord * record = &records[i];
+    _Atomic uint64_t * bucket = &histogram->counts[record->op][record->sizeClass][traceBucket(record->elapsed)];
+    _Atomic uint64_t * sum = &histogram->sums[record->op][record->sizeClass];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(sum, atomic_load_explicit(sum, memory_order_relaxed) + record->elapsed, memory_order_relaxed);
+  }
+}
+
+static void dumpAtExit() {
+  FILE * out = fopen(exitDumpPath, "w");
+  if (out != NULL) {
+    my_malloc_trace_dump(out);
+    fclose(out);
+  }
+}
+
+static void traceInit() {
+  anchorTicks = traceTimestamp();
+  clock_gettime(CLOCK_MONOTONIC, &anchorTime);
+  exitDumpPath = getenv("MY_MALLOC_TRACE");
+  if (exitDumpPath != NULL && exitDumpPath[0] != '\0') {
+    atexit(dumpAtExit);
+  }
+}
+
+/*
+ * @brief Maps and registers the calling thread's ring. Buffers are never
+ * unmapped, so records of exited threads still show up in later dumps.
+ */
+static TraceBuffer * registerThreadBuffer() {
+  pthread_once(&traceOnce, traceInit);
+  void * memory = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+  TraceBuffer * buffer = memory;
+  buffer->next = atomic_load(&traceBuffers);
+  while (!atomic_compare_exchange_weak(&traceBuffers, &buffer->next, buffer)) {
+  }
+  threadBuffer = buffer;
+  return buffer;
+}
+
+static void ownerDrain(TraceBuffer * buffer, size_t head) {
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+  while (!atomic_compare_exchange_weak_explicit(&buffer->tail, &tail, head, memory_order_acq_rel, memory_order_acquire)) {
+  }
+  for (size_t i = tail; i != head; i++) {
+    addRecords(&buffer->histogram, &buffer->ring[i & (TRACE_RING_SIZE - 1)], 1);
+  }
+}
+
+unsigned traceNextSkip() {
+  uint64_t x = traceSampler.random;
+  if (x == 0) {
+    x = traceTimestamp() | 1;
+  }
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  traceSampler.random = x;
+  return (unsigned)(x & (MALLOC_TRACE_PERIOD - 1)) + (unsigned)((x >> 32) & (MALLOC_TRACE_PERIOD - 1));
+}
+
+void traceRecord(enum traceOp op, size_t size, uint64_t elapsed) {
+  TraceBuffer * buffer = threadBuffer;
+  if (buffer == NULL && (buffer = registerThreadBuffer()) == NULL) {
+    return;
+  }
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&buffer->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+    ownerDrain(buffer, head);
+  }
+  TraceRecord * record = &buffer->ring[head & (TRACE_RING_SIZE - 1)];
+  record->elapsed = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+  record->op = (uint8_t)op;
+  record->sizeClass = (uint8_t)traceSizeClass(size);
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+/*
+ * @brief Moves another thread's pending records into dumpedHistogram.
+ * Called with dumpLock held.
+ */
+static void dumperDrain(TraceBuffer * buffer) {
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+  while (true) {
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    size_t count = 0;
+    for (size_t i = tail; i != head; i++) {
+      dumpScratch[count++] = buffer->ring[i & (TRACE_RING_SIZE - 1)];
+    }
+    if (atomic_compare_exchange_strong_explicit(&buffer->tail, &tail, head, memory_order_acq_rel, memory_order_acquire)) {
+      addRecords(&dumpedHistogram, dumpScratch, count);
+      return;
+    }
+  }
+}
+
+/*
+ * @brief Ticks per nanosecond, measured against CLOCK_MONOTONIC since the
+ * first traced call (or over a short sleep if that was too recent).
+ */
+static double ticksPerNanosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t ticks = traceTimestamp();
+  double elapsed = (double)(now.tv_sec - anchorTime.tv_sec) * 1e9 + (double)(now.tv_nsec - anchorTime.tv_nsec);
+  if (elapsed < 1e7) {
+    struct timespec start, nap = {0, 10000000};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t startTicks = traceTimestamp();
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ticks = traceTimestamp();
+    elapsed = (double)(now.tv_sec - start.tv_sec) * 1e9 + (double)(now.tv_nsec - start.tv_nsec);
+    return (double)(ticks - startTicks) / elapsed;
+  }
+  return (double)(ticks - anchorTicks) / elapsed;
+#else
+  return 1.0;
+#endif
+}
+
+static void printRow(FILE * out, const char * op, const char * sizeClass,
+                     const uint64_t * counts, uint64_t sum, double scale) {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t total = 0;
+  unsigned maxBucket = 0;
+  for (unsigned i = 0; i < TRACE_BUCKETS; i++) {
+    total += counts[i];
+    if (counts[i] != 0) {
+      maxBucket = i;
+    }
+  }
+  if (total == 0) {
+    return;
+  }
+  fprintf(out, "%-10s %-11s %12lu %9.1f", op, sizeClass, total, (double)sum / total / scale);
+  uint64_t seen = 0;
+  unsigned bucket = 0;
+  for (unsigned q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+    uint64_t rank = (uint64_t)(quantiles[q] * (double)total);
+    while (seen + counts[bucket] <= rank && bucket < maxBucket) {
+      seen += counts[bucket++];
+    }
+    fprintf(out, " %9.1f", traceBucketValue(bucket) / scale);
+  }
+  fprintf(out, " %9.1f\n", traceBucketValue(maxBucket) / scale);
+}
+
+void my_malloc_trace_dump(FILE * out) {
+  static uint64_t counts[TRACE_NUM_OPS][TRACE_SIZE_CLASSES][TRACE_BUCKETS];
+  static uint64_t sums[TRACE_NUM_OPS][TRACE_SIZE_CLASSES];
+
+  pthread_once(&traceOnce, traceInit);
+  pthread_mutex_lock(&dumpLock);
+  memset(counts, 0, sizeof(counts));
+  memset(sums, 0, sizeof(sums));
+  for (TraceBuffer * buffer = atomic_load(&traceBuffers); buffer != NULL; buffer = buffer->next) {
+    dumperDrain(buffer);
+  }
+  for (TraceBuffer * buffer = atomic_load(&traceBuffers); ; buffer = buffer->next) {
+    TraceHistogram * histogram = buffer != NULL ? &buffer->histogram : &dumpedHistogram;
+    for (unsigned op = 0; op < TRACE_NUM_OPS; op++) {
+      for (unsigned sizeClass = 0; sizeClass < TRACE_SIZE_CLASSES; sizeClass++) {
+        for (unsigned i = 0; i < TRACE_BUCKETS; i++) {
+          counts[op][sizeClass][i] += atomic_load_explicit(&histogram->counts[op][sizeClass][i], memory_order_relaxed);
+        }
+        sums[op][sizeClass] += atomic_load_explicit(&histogram->sums[op][sizeClass], memory_order_relaxed);
+      }
+    }
+    if (buffer == NULL) {
+      break;
+    }
+  }
+
+#ifndef MALLOC_TRACE
+  fprintf(out, "# built without -DMALLOC_TRACE; no calls are traced\n");
+#else
+  fprintf(out, "# about 1 in %d calls timed per operation\n", MALLOC_TRACE_PERIOD);
+#endif
+  double scale = ticksPerNanosecond();
+  fprintf(out, "%-10s %-11s %12s %9s %9s %9s %9s %9s %9s  (ns)\n",
+          "op", "size", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+  for (unsigned op = 0; op < TRACE_NUM_OPS; op++) {
+    uint64_t all[TRACE_BUCKETS] = {0};
+    uint64_t allSum = 0;
+    for (unsigned sizeClass = 0; sizeClass < TRACE_SIZE_CLASSES; sizeClass++) {
+      printRow(out, opNames[op], classNames[sizeClass], counts[op][sizeClass], sums[op][sizeClass], scale);
+      for (unsigned i = 0; i < TRACE_BUCKETS; i++) {
+        all[i] += counts[op][sizeClass][i];
+      }
+      allSum += sums[op][sizeClass];
+    }
+    printRow(out, opNames[op], "all", all, allSum, scale);
+  }
+  pthread_mutex_unlock(&dumpLock);
+}
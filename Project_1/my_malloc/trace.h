@@ -0,0 +1,111 @@
+#ifndef __MY_MALLOC_TRACE__
+#define __MY_MALLOC_TRACE__
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Per-call latency tracing.
+ *
+ * Built with -DMALLOC_TRACE, ff_malloc/bf_malloc/ad_malloc/ff_free calls are
+ * timestamped on entry and exit (rdtsc where available, clock_gettime
+ * otherwise) and the elapsed time is appended to a ring buffer owned by the
+ * calling thread. A timestamp pair costs about as much as a small allocation
+ * on some hosts, so by default only about one call in MALLOC_TRACE_PERIOD of
+ * each operation is timed, with the gaps randomized so periodic workloads
+ * do not alias; build with -DMALLOC_TRACE_PERIOD=1 to time every call.
+ * Rings are drained into log-bucketed histograms, keyed by operation and
+ * size class, either by their owner when they fill up or by
+ * my_malloc_trace_dump(). Histogram buckets split every power of two into
+ * TRACE_SUB_BUCKETS linear steps, so any reported percentile is within
+ * 1/TRACE_SUB_BUCKETS of the true value.
+ *
+ * Without -DMALLOC_TRACE the TRACE_ macros expand to nothing.
+ *
+ * Setting MY_MALLOC_TRACE=<path> in the environment dumps the histograms to
+ * that file at exit, which traces unmodified test programs.
+ */
+
+enum traceOp {
+  TRACE_FF_MALLOC,
+  TRACE_BF_MALLOC,
+  TRACE_AD_MALLOC,
+  TRACE_FREE,
+  TRACE_NUM_OPS
+};
+
+#define TRACE_RING_SIZE      4096     /* records per thread; power of two */
+#define TRACE_SIZE_CLASSES   8        /* [0,64) [64,256) ... [256K,1M) [1M,inf) */
+#define TRACE_SUB_BUCKETS    8
+#define TRACE_BUCKETS        240      /* covers latencies up to 2^32 ticks */
+
+#ifndef MALLOC_TRACE_PERIOD
+#define MALLOC_TRACE_PERIOD  16
+#endif
+#if MALLOC_TRACE_PERIOD < 1 || (MALLOC_TRACE_PERIOD & (MALLOC_TRACE_PERIOD - 1)) != 0
+#error "MALLOC_TRACE_PERIOD must be a power of two"
+#endif
+
+/*
+ * Per-thread sampling state: calls of each operation left to skip before
+ * the next timed one.
+ */
+struct TraceSampler {
+  unsigned skip[TRACE_NUM_OPS];
+  uint64_t random;
+};
+extern __thread struct TraceSampler traceSampler __attribute__((tls_model("initial-exec")));
+
+/*
+ * @brief Writes latency percentiles per operation and size class.
+ * @param out: Stream to write to.
+ */
+void my_malloc_trace_dump(FILE * out);
+
+/*
+ * @brief Appends one call to the calling thread's ring.
+ * @param op: Operation traced.
+ * @param size: Request size (malloc) or block size (free).
+ * @param elapsed: Duration in ticks (cycles with rdtsc, ns otherwise).
+ */
+void traceRecord(enum traceOp op, size_t size, uint64_t elapsed);
+
+/*
+ * @brief Draws the number of calls to skip after a timed one; the average is
+ * MALLOC_TRACE_PERIOD - 1.
+ */
+unsigned traceNextSkip();
+
+static inline bool traceSampled(enum traceOp op) {
+  if (traceSampler.skip[op] != 0) {
+    traceSampler.skip[op]--;
+    return false;
+  }
+  traceSampler.skip[op] = traceNextSkip();
+  return true;
+}
+
+static inline uint64_t traceTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+#ifdef MALLOC_TRACE
+#define TRACE_BEGIN(op) uint64_t traceStart = traceSampled(op) ? traceTimestamp() : 0
+#define TRACE_END(op, size) if (traceStart != 0) { traceRecord((op), (size), traceTimestamp() - traceStart); }
+#else
+#define TRACE_BEGIN(op)
+#define TRACE_END(op, size)
+#endif
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef ALLOC_CORE_HPP
+#define ALLOC_CORE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+/**
+ * @brief Header-only allocator core specialized at compile time.
+ *
+ * The C allocators thread their state through every call
+ * (bf_malloc(head, tail, sbrk, size)) and reach sbrk through a function
+ * pointer, so every search and every growth is an indirect, non-inlinable
+ * call. Here the fit policy, the growth source and the locking policy are
+ * template parameters: each instantiation owns its list as plain members and
+ * the policy choices are resolved with if constexpr, so the generated code
+ * for one configuration contains neither policy branches nor indirect calls.
+ */
+namespace mymalloc {
+
+/**
+ * @brief Block header, laid out exactly like the C MemoryBlock.
+ */
+struct Block {
+    std::size_t dataSize; ///< Size of the data stored in the block.
+    bool allocated;       ///< Whether the block is currently allocated.
+    Block * prev;         ///< Previous block in the free list.
+    Block * next;         ///< Next block in the free list.
+};
+
+constexpr std::size_t META_SIZE = sizeof(Block);
+constexpr std::size_t ALIGNMENT = 16;
+
+/** Largest request whose aligned size plus header still fits in a size_t. */
+constexpr std::size_t MAX_REQUEST = SIZE_MAX - META_SIZE - ALIGNMENT;
+
+/**
+ * @brief Rounds a request of at most MAX_REQUEST bytes up to the payload alignment.
+ */
+constexpr std::size_t alignUp(std::size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+/**
+ * @brief Free-list search policies.
+ */
+enum class Fit {
+    First, ///< Lowest-addressed block that fits.
+    Best,  ///< Smallest block that fits (exact fits end the search).
+    Next,  ///< First fit, resuming where the previous search stopped.
+    Good   ///< First block within GOOD_FIT_SLACK of the request, else best fit.
+};
+
+/** Good fit accepts a block wasting at most 1/2^GOOD_FIT_SLACK_SHIFT of the request. */
+constexpr unsigned GOOD_FIT_SLACK_SHIFT = 3;
+
+/**
+ * @brief Grows the heap with sbrk, called directly rather than through a pointer.
+ */
+struct SbrkGrowth {
+    void * grow(std::size_t bytes) {
+        std::uintptr_t brk = reinterpret_cast<std::uintptr_t>(sbrk(0));
+        std::size_t pad = (ALIGNMENT - (brk & (ALIGNMENT - 1))) & (ALIGNMENT - 1);
+        // sbrk takes a signed increment; anything larger would move the break down
+        if (bytes > static_cast<std::size_t>(PTRDIFF_MAX) - pad) {
+            return nullptr;
+        }
+        void * ptr = sbrk(bytes + pad);
+        if (ptr == reinterpret_cast<void *>(-1)) {
+            return nullptr;
+        }
+        return static_cast<char *>(ptr) + pad;
+    }
+};
+
+/**
+ * @brief sbrk growth serialized by a process-wide mutex, for heaps that are
+ * otherwise private to a thread (the ts_malloc_nolock design).
+ */
+struct LockedSbrkGrowth {
+    static inline pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    void * grow(std::size_t bytes) {
+        pthread_mutex_lock(&mutex);
+        void * ptr = SbrkGrowth().grow(bytes);
+        pthread_mutex_unlock(&mutex);
+        return ptr;
+    }
+};
+
+/**
+ * @brief Bump-grows within one mmap'd reservation of Reserve bytes.
+ * Pages are only backed once touched (MAP_NORESERVE).
+ */
+template <std::size_t Reserve>
+class MmapRegionGrowth {
+    char * base = nullptr;
+    std::size_t used = 0;
+
+public:
+    void * grow(std::size_t bytes) {
+        if (bytes > static_cast<std::size_t>(PTRDIFF_MAX)) {
+            return nullptr;
+        }
+        if (base == nullptr) {
+            void * region = mmap(nullptr, Reserve, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (region == MAP_FAILED) {
+                return nullptr;
+            }
+            base = static_cast<char *>(region);
+        }
+        if (bytes > Reserve - used) {
+            return nullptr;
+        }
+        void * ptr = base + used;
+        used += bytes;
+        return ptr;
+    }
+};
+
+/**
+ * @brief Bump-grows within a fixed buffer embedded in the heap object.
+ */
+template <std::size_t Bytes>
+class FixedBufferGrowth {
+    alignas(ALIGNMENT) char buffer[Bytes];
+    std::size_t used = 0;
+
+public:
+    void * grow(std::size_t bytes) {
+        if (bytes > static_cast<std::size_t>(PTRDIFF_MAX) || bytes > Bytes - used) {
+            return nullptr;
+        }
+        void * ptr = buffer + used;
+        used += bytes;
+        return ptr;
+    }
+};
+
+/**
+ * @brief Locking policy for heaps only ever touched by one thread.
+ */
+struct NoLock {
+    void lock() {}
+    void unlock() {}
+};
+
+/**
+ * @brief Locking policy wrapping a default pthread mutex.
+ */
+class MutexLock {
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+public:
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+};
+
+/**
+ * @brief An address-ordered, coalescing free-list heap.
+ *
+ * @tparam F      Search policy.
+ * @tparam Growth Source of fresh memory; must provide void * grow(std::size_t).
+ * @tparam Lock   Locking policy; must provide lock() and unlock().
+ *
+ * Heap objects are constant-initialized and trivially destructible, so they
+ * can be namespace-scope or thread_local without any initialization guard.
+ */
+template <Fit F, typename Growth, typename Lock>
+class Heap {
+    Block * head = nullptr;
+    Block * tail = nullptr;
+    Block * rover = nullptr;          ///< Next-fit resume point.
+    std::size_t totalAllocated = 0;   ///< Bytes obtained from the growth source.
+    std::size_t totalFreed = 0;       ///< Bytes (headers included) sitting in the free list.
+    Growth growth;
+    Lock mutex;
+
+public:
+    constexpr Heap() = default;
+
+    /**
+     * @brief Allocates size bytes, aligned to ALIGNMENT.
+     * @return Pointer to the payload, or nullptr for size 0, for sizes above
+     * MAX_REQUEST or when the growth source is exhausted.
+     */
+    void * allocate(std::size_t size) {
+        if (size == 0 || size > MAX_REQUEST) {
+            return nullptr;
+        }
+        size = alignUp(size);
+        mutex.lock();
+        Block * block = find(size);
+        void * ptr = block != nullptr ? static_cast<void *>(split(block, size) + 1) : extend(size);
+        mutex.unlock();
+        return ptr;
+    }
+
+    /**
+     * @brief Returns a block to the free list, coalescing with free neighbours.
+     */
+    void deallocate(void * ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        Block * block = static_cast<Block *>(ptr) - 1;
+        mutex.lock();
+        if (block->allocated) {
+            release(block);
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Deallocation with the request size, for callers that know it
+     * (operator delete, allocator adapters). The size is only checked against
+     * the header in debug builds: coalescing needs the block's real size,
+     * which a split may have left larger than the aligned request.
+     */
+    void deallocate(void * ptr, std::size_t size) {
+        assert(ptr == nullptr || alignUp(size) <= usableSize(ptr));
+        deallocate(ptr);
+    }
+
+    /**
+     * @brief Usable payload size of an allocated block.
+     */
+    static std::size_t usableSize(const void * ptr) {
+        return (static_cast<const Block *>(ptr) - 1)->dataSize;
+    }
+
+    std::size_t segmentSize() const { return totalAllocated; }
+    std::size_t freeSpaceSize() const { return totalFreed; }
+
+private:
+    Block * find(std::size_t size) {
+        if constexpr (F == Fit::First) {
+            for (Block * curr = head; curr != nullptr; curr = curr->next) {
+                if (curr->dataSize >= size) {
+                    return curr;
+                }
+            }
+            return nullptr;
+        } else if constexpr (F == Fit::Next) {
+            Block * start = rover != nullptr ? rover : head;
+            for (Block * curr = start; curr != nullptr; curr = curr->next) {
+                if (curr->dataSize >= size) {
+                    return rover = curr;
+                }
+            }
+            for (Block * curr = head; curr != start; curr = curr->next) {
+                if (curr->dataSize >= size) {
+                    return rover = curr;
+                }
+            }
+            return nullptr;
+        } else {
+            Block * best = nullptr;
+            for (Block * curr = head; curr != nullptr; curr = curr->next) {
+                if (curr->dataSize == size) {
+                    return curr;
+                }
+                if (curr->dataSize > size) {
+                    if constexpr (F == Fit::Good) {
+                        if (curr->dataSize - size <= (size >> GOOD_FIT_SLACK_SHIFT)) {
+                            return curr;
+                        }
+                    }
+                    if (best == nullptr || curr->dataSize < best->dataSize) {
+                        best = curr;
+                    }
+                }
+            }
+            return best;
+        }
+    }
+
+    void * extend(std::size_t size) {
+        Block * block = static_cast<Block *>(growth.grow(size + META_SIZE));
+        if (block == nullptr) {
+            return nullptr;
+        }
+        block->dataSize = size;
+        block->allocated = true;
+        block->prev = nullptr;
+        block->next = nullptr;
+        totalAllocated += size + META_SIZE;
+        return block + 1;
+    }
+
+    void insertAfter(Block * block, Block * curr) {
+        block->prev = curr;
+        block->next = curr != nullptr ? curr->next : head;
+        if (block->next != nullptr) {
+            block->next->prev = block;
+        } else {
+            tail = block;
+        }
+        if (curr != nullptr) {
+            curr->next = block;
+        } else {
+            head = block;
+        }
+    }
+
+    void remove(Block * block) {
+        if constexpr (F == Fit::Next) {
+            if (rover == block) {
+                rover = block->next;
+            }
+        }
+        if (block->prev != nullptr) {
+            block->prev->next = block->next;
+        } else {
+            head = block->next;
+        }
+        if (block->next != nullptr) {
+            block->next->prev = block->prev;
+        } else {
+            tail = block->prev;
+        }
+        block->prev = nullptr;
+        block->next = nullptr;
+    }
+
+    Block * split(Block * block, std::size_t size) {
+        if (block->dataSize <= size + META_SIZE) {
+            totalFreed -= block->dataSize + META_SIZE;
+            remove(block);
+        } else {
+            Block * remaining = reinterpret_cast<Block *>(reinterpret_cast<char *>(block + 1) + size);
+            remaining->dataSize = block->dataSize - size - META_SIZE;
+            remaining->allocated = false;
+            insertAfter(remaining, block);
+            block->dataSize = size;
+            remove(block);
+            totalFreed -= size + META_SIZE;
+        }
+        block->allocated = true;
+        return block;
+    }
+
+    static bool adjacent(const Block * left, const Block * right) {
+        return reinterpret_cast<const char *>(left + 1) + left->dataSize == reinterpret_cast<const char *>(right);
+    }
+
+    void release(Block * block) {
+        block->allocated = false;
+        totalFreed += block->dataSize + META_SIZE;
+        Block * curr = nullptr;
+        if (tail != nullptr && block > tail) {
+            curr = tail;
+        } else if (head != nullptr && block > head) {
+            curr = head;
+            while (curr->next != nullptr && curr->next < block) {
+                curr = curr->next;
+            }
+        }
+        insertAfter(block, curr);
+        if (block->next != nullptr && adjacent(block, block->next)) {
+            Block * right = block->next;
+            remove(right);
+            block->dataSize += META_SIZE + right->dataSize;
+        }
+        if (block->prev != nullptr && adjacent(block->prev, block)) {
+            Block * left = block->prev;
+            remove(block);
+            left->dataSize += META_SIZE + block->dataSize;
+        }
+    }
+};
+
+} // namespace mymalloc
+
+#endif
@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include "stl_allocator.hpp"
+
+/*
+ * Container churn benchmark: the same container workloads run with
+ * std::allocator, with mymalloc::Allocator over ff_malloc, bf_malloc and a
+ * private best-fit heap, and with std::pmr containers over a HeapResource.
+ *
+ *   map      insert NUM_KEYS keys, then erase a random key and insert a new
+ *            one CHURN_OPS times (std::map / std::unordered_map)
+ *   string   build NUM_STRINGS strings by repeated appends, keeping a
+ *            sliding window of WINDOW live strings
+ */
+
+#define NUM_KEYS     20000
+#define CHURN_OPS    200000
+#define NUM_STRINGS  20000
+#define WINDOW       256
+
+using mymalloc::Allocator;
+using mymalloc::BestFitSource;
+using mymalloc::FirstFitSource;
+using mymalloc::HeapResource;
+using mymalloc::HeapSource;
+
+using PrivateHeap = mymalloc::Heap<mymalloc::Fit::Best, mymalloc::MmapRegionGrowth<(1UL << 32)>, mymalloc::NoLock>;
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+volatile size_t sink;
+
+template <typename Map>
+double map_churn(Map & map) {
+  struct timespec start_time, end_time;
+  std::vector<int> keys(NUM_KEYS);
+  srand(0);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (int i = 0; i < NUM_KEYS; i++) {
+    keys[i] = rand();
+    map[keys[i]] = i;
+  }
+  for (int i = 0; i < CHURN_OPS; i++) {
+    int slot = rand() % NUM_KEYS;
+    map.erase(keys[slot]);
+    keys[slot] = rand();
+    map[keys[slot]] = i;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  sink = map.size();
+  return calc_time(start_time, end_time) / (NUM_KEYS + 2.0 * CHURN_OPS);
+}
+
+template <typename String, typename Vector>
+double string_churn(Vector & live) {
+  struct timespec start_time, end_time;
+  static const char chunk[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+  srand(0);
+  for (int i = 0; i < WINDOW; i++) {
+    live.emplace_back(String(typename String::allocator_type(live.get_allocator())));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (int i = 0; i < NUM_STRINGS; i++) {
+    String & s = live[i % WINDOW];
+    s.clear();
+    s.shrink_to_fit();
+    int appends = 8 + rand() % 120;
+    for (int j = 0; j < appends; j++) {
+      s.append(chunk, 1 + (i + j) % (sizeof(chunk) - 1));
+    }
+    sink = s.size();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / NUM_STRINGS;
+}
+
+template <typename Alloc>
+void run(const char * name, const Alloc & alloc) {
+  using Traits = std::allocator_traits<Alloc>;
+  using MapAlloc = typename Traits::template rebind_alloc<std::pair<const int, int>>;
+  using CharAlloc = typename Traits::template rebind_alloc<char>;
+  using String = std::basic_string<char, std::char_traits<char>, CharAlloc>;
+  using StringAlloc = typename Traits::template rebind_alloc<String>;
+
+  std::map<int, int, std::less<int>, MapAlloc> tree{MapAlloc(alloc)};
+  std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, MapAlloc> hash{MapAlloc(alloc)};
+  std::vector<String, StringAlloc> strings{StringAlloc(alloc)};
+  double tree_ns = map_churn(tree);
+  double hash_ns = map_churn(hash);
+  double string_ns = string_churn<String>(strings);
+  printf("%-18s %14.1f %14.1f %14.1f\n", name, tree_ns, hash_ns, string_ns);
+}
+
+void run_pmr(const char * name, std::pmr::memory_resource * resource) {
+  std::pmr::map<int, int> tree(resource);
+  std::pmr::unordered_map<int, int> hash(resource);
+  std::pmr::vector<std::pmr::string> strings(resource);
+  double tree_ns = map_churn(tree);
+  double hash_ns = map_churn(hash);
+  double string_ns = string_churn<std::pmr::string>(strings);
+  printf("%-18s %14.1f %14.1f %14.1f\n", name, tree_ns, hash_ns, string_ns);
+}
+
+int main(int argc, char *argv[])
+{
+  static PrivateHeap heap;
+  HeapResource<BestFitSource> bfResource;
+
+  printf("%-18s %14s %14s %14s\n", "allocator", "map ns/op", "umap ns/op", "string ns/str");
+  run("std::allocator", std::allocator<int>());
+  run("ff_malloc", Allocator<int, FirstFitSource>());
+  run("bf_malloc", Allocator<int, BestFitSource>());
+  run("private heap", Allocator<int, HeapSource<PrivateHeap>>(HeapSource<PrivateHeap>(heap)));
+  run_pmr("pmr new_delete", std::pmr::new_delete_resource());
+  run_pmr("pmr bf_malloc", &bfResource);
+
+  return 0;
+}
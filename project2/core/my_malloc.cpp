@@ -0,0 +1,89 @@
+#include "alloc_core.hpp"
+#include "my_malloc.h"
+
+/*
+ * Thin C wrappers over fixed instantiations of the template core. Each entry
+ * point forwards to a heap whose fit, growth and locking policies are fixed
+ * here, so the body of e.g. ff_malloc is the first-fit search and split
+ * inlined, with sbrk as the only call left on its growth path.
+ *
+ * CORE_GROWTH selects the growth source at build time, e.g.
+ *   make CORE_GROWTH='mymalloc::MmapRegionGrowth<(1UL << 36)>'
+ */
+#ifndef CORE_GROWTH
+#define CORE_GROWTH mymalloc::SbrkGrowth
+#endif
+
+using mymalloc::Fit;
+using mymalloc::Heap;
+using mymalloc::LockedSbrkGrowth;
+using mymalloc::MutexLock;
+using mymalloc::NoLock;
+using mymalloc::SbrkGrowth;
+
+namespace {
+/*
+ * The lock and nolock heaps can both grow in one process, so their sbrk
+ * calls (the break query and the padded bump) go through the same
+ * process-wide mutex; the heap's own MutexLock does not cover nolock heaps.
+ */
+template <class Growth>
+struct SharedGrowth {
+    using type = Growth;
+};
+
+template <>
+struct SharedGrowth<SbrkGrowth> {
+    using type = LockedSbrkGrowth;
+};
+
+Heap<Fit::First, CORE_GROWTH, NoLock> ffHeap;
+Heap<Fit::Best, CORE_GROWTH, NoLock> bfHeap;
+Heap<Fit::Best, SharedGrowth<CORE_GROWTH>::type, MutexLock> lockHeap;
+thread_local Heap<Fit::Best, LockedSbrkGrowth, NoLock> nolockHeap;
+}
+
+extern "C" {
+
+void * ff_malloc(size_t size) {
+    return ffHeap.allocate(size);
+}
+
+void ff_free(void * ptr) {
+    ffHeap.deallocate(ptr);
+}
+
+void * bf_malloc(size_t size) {
+    return bfHeap.allocate(size);
+}
+
+void bf_free(void * ptr) {
+    bfHeap.deallocate(ptr);
+}
+
+void * ts_malloc_lock(size_t size) {
+    return lockHeap.allocate(size);
+}
+
+void ts_free_lock(void * ptr) {
+    lockHeap.deallocate(ptr);
+}
+
+void * ts_malloc_nolock(size_t size) {
+    return nolockHeap.allocate(size);
+}
+
+void ts_free_nolock(void * ptr) {
+    nolockHeap.deallocate(ptr);
+}
+
+// The nolock term is the calling thread's heap only.
+unsigned long get_data_segment_size() {
+    return ffHeap.segmentSize() + bfHeap.segmentSize() + lockHeap.segmentSize() + nolockHeap.segmentSize();
+}
+
+unsigned long get_data_segment_free_space_size() {
+    return ffHeap.freeSpaceSize() + bfHeap.freeSpaceSize() + lockHeap.freeSpaceSize() + nolockHeap.freeSpaceSize();
+}
+
+}
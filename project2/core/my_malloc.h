@@ -0,0 +1,73 @@
+#ifndef __MY_MALLOC__
+#define __MY_MALLOC__
+#include <stddef.h>
+
+/*
+ * C entry points of the template allocator core (alloc_core.hpp).
+ *
+ * The signatures match the ones the test kits call: the single-threaded
+ * ff_/bf_ functions of Project_1 and the thread-safe ts_ functions of this
+ * project, so either kit can be pointed at this directory through WDIR.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * @brief First-fit memory allocation.
+ * @param size: Size of the data needed.
+ * @return Pointer to the allocated memory.
+ */
+void * ff_malloc(size_t size);
+
+/*
+ * @brief First-fit memory deallocation.
+ * @param ptr: Pointer to the memory block to be deallocated.
+ */
+void ff_free(void * ptr);
+
+/*
+ * @brief Best-fit memory allocation.
+ * @param size: Size of the data needed.
+ * @return Pointer to the allocated memory.
+ */
+void * bf_malloc(size_t size);
+
+/*
+ * @brief Best-fit memory deallocation.
+ * @param ptr: Pointer to the memory block to be deallocated.
+ */
+void bf_free(void * ptr);
+
+/*
+ * @brief Thread-safe best-fit allocation from one heap guarded by a mutex.
+ */
+void * ts_malloc_lock(size_t size);
+
+void ts_free_lock(void * ptr);
+
+/*
+ * @brief Thread-safe best-fit allocation from a per-thread heap; only the
+ * sbrk call itself is serialized.
+ */
+void * ts_malloc_nolock(size_t size);
+
+void ts_free_nolock(void * ptr);
+
+/*
+ * @brief Gets the total size of the data segment.
+ * @return Total size of the data segment.
+ */
+unsigned long get_data_segment_size();
+
+/*
+ * @brief Gets the free space size in the data segment.
+ * @return Free space size in the data segment.
+ */
+unsigned long get_data_segment_free_space_size();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef STL_ALLOCATOR_HPP
+#define STL_ALLOCATOR_HPP
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+#include "alloc_core.hpp"
+#include "my_malloc.h"
+
+/**
+ * @brief Adapters that let standard containers allocate from these heaps
+ * directly, without interposing malloc.
+ *
+ * A "source" is the heap an adapter draws from. FirstFitSource and
+ * BestFitSource forward to the exported ff_/bf_ entry points; HeapSource
+ * forwards to a specific mymalloc::Heap instance owned by the caller.
+ * Allocator<T, Source> satisfies the Allocator requirements and
+ * HeapResource<Source> is a std::pmr::memory_resource, so the same source
+ * can back both std:: and std::pmr:: containers.
+ */
+namespace mymalloc {
+
+/**
+ * @brief Source backed by ff_malloc/ff_free.
+ */
+struct FirstFitSource {
+    void * allocate(std::size_t bytes) { return ff_malloc(bytes); }
+    void deallocate(void * ptr, std::size_t) { ff_free(ptr); }
+    bool operator==(const FirstFitSource &) const { return true; }
+};
+
+/**
+ * @brief Source backed by bf_malloc/bf_free.
+ */
+struct BestFitSource {
+    void * allocate(std::size_t bytes) { return bf_malloc(bytes); }
+    void deallocate(void * ptr, std::size_t) { bf_free(ptr); }
+    bool operator==(const BestFitSource &) const { return true; }
+};
+
+/**
+ * @brief Source backed by a caller-owned heap instance.
+ * Two sources compare equal when they refer to the same heap.
+ */
+template <typename HeapType>
+class HeapSource {
+    HeapType * heap;
+
+public:
+    explicit HeapSource(HeapType & heap) : heap(&heap) {}
+
+    void * allocate(std::size_t bytes) { return heap->allocate(bytes); }
+
+    void deallocate(void * ptr, std::size_t bytes) { heap->deallocate(ptr, bytes); }
+
+    bool operator==(const HeapSource & other) const { return heap == other.heap; }
+};
+
+/**
+ * @brief Allocates bytes from a source at the given alignment.
+ *
+ * Requests at or below the heap's natural ALIGNMENT go straight through.
+ * Stricter alignments over-allocate and stash the original pointer in the
+ * word just below the aligned address, where deallocateAligned finds it
+ * again. Returns nullptr if the padded request would overflow a size_t.
+ */
+template <typename Source>
+void * allocateAligned(Source & source, std::size_t bytes, std::size_t alignment) {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (alignment <= ALIGNMENT) {
+        return source.allocate(bytes);
+    }
+    if (bytes > SIZE_MAX - alignment - sizeof(void *)) {
+        return nullptr;
+    }
+    char * raw = static_cast<char *>(source.allocate(bytes + alignment + sizeof(void *)));
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *) + alignment - 1) & ~(alignment - 1);
+    reinterpret_cast<void **>(aligned)[-1] = raw;
+    return reinterpret_cast<void *>(aligned);
+}
+
+/**
+ * @brief Releases memory obtained from allocateAligned with the same bytes and alignment.
+ */
+template <typename Source>
+void deallocateAligned(Source & source, void * ptr, std::size_t bytes, std::size_t alignment) {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (alignment <= ALIGNMENT) {
+        source.deallocate(ptr, bytes);
+    } else {
+        source.deallocate(static_cast<void **>(ptr)[-1], bytes + alignment + sizeof(void *));
+    }
+}
+
+/**
+ * @brief std::allocator-conforming adapter over a source.
+ * @tparam T      Value type.
+ * @tparam Source FirstFitSource, BestFitSource or HeapSource<H>.
+ */
+template <typename T, typename Source = FirstFitSource>
+class Allocator {
+    template <typename U, typename S> friend class Allocator;
+    Source source;
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = Allocator<U, Source>;
+    };
+
+    Allocator() = default;
+    explicit Allocator(const Source & source) : source(source) {}
+    template <typename U>
+    Allocator(const Allocator<U, Source> & other) : source(other.source) {}
+
+    T * allocate(std::size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void * ptr = allocateAligned(source, n * sizeof(T), alignof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T * ptr, std::size_t n) {
+        deallocateAligned(source, ptr, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    bool operator==(const Allocator<U, Source> & other) const { return source == other.source; }
+    template <typename U>
+    bool operator!=(const Allocator<U, Source> & other) const { return !(source == other.source); }
+};
+
+/**
+ * @brief std::pmr::memory_resource over a source.
+ */
+template <typename Source = FirstFitSource>
+class HeapResource : public std::pmr::memory_resource {
+    Source source;
+
+public:
+    HeapResource() = default;
+    explicit HeapResource(const Source & source) : source(source) {}
+
+private:
+    void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void * ptr = allocateAligned(source, bytes, alignment);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void * ptr, std::size_t bytes, std::size_t alignment) override {
+        deallocateAligned(source, ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+        const HeapResource * resource = dynamic_cast<const HeapResource *>(&other);
+        return resource != nullptr && resource->source == source;
+    }
+};
+
+} // namespace mymalloc
+
+#endif
@@ -1,14 +1,9 @@
 #include "my_malloc.h"
-//Global variables
-MemoryBlock * head = NULL;
-MemoryBlock * tail = NULL;
-__thread MemoryBlock * ts_nolockHead = NULL;
-__thread MemoryBlock * ts_nolockTail = NULL;
-FreeList freeList = { .head = NULL, .tail = NULL };
 
+TsLock lock = TS_LOCK_INITIALIZER;
 
-bool isEmptyFreeList (MemoryBlock * head, MemoryBlock * tail) {
-    return !head && !tail;
+bool isEmptyFreeList (FreeList * list) {
+    return !list->head && !list->tail;
 }
 
 void initializeMemoryBlock(MemoryBlock * block, size_t dataSize, bool allocated) {
@@ -18,58 +13,63 @@ void initializeMemoryBlock(MemoryBlock * block, size_t dataSize, bool allocated)
   block->next = NULL;
 }
 
-void appendToFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * toAdd) {
+void appendToFreeList(FreeList * list, MemoryBlock * toAdd) {
     //if list is empty, head and tail should both point to toAdd
-  if (isEmptyFreeList(head, tail)) {
-      head = &(*toAdd);
-      tail = &(*toAdd);
+  if (isEmptyFreeList(list)) {
+      list->head = &(*toAdd);
+      list->tail = &(*toAdd);
+      //toAdd may still be linked into a thread cache or remote-free queue
+      toAdd->prev = NULL;
+      toAdd->next = NULL;
   } else {
     //Otherwise (if toAdd isn't first element in the list)
-      tail->next = &(*toAdd);
-      toAdd->prev = tail;
+      list->tail->next = &(*toAdd);
+      toAdd->prev = list->tail;
       toAdd->next = NULL;
-      tail = &(*toAdd);
+      list->tail = &(*toAdd);
   }
   toAdd->allocated = false;
 }
 
-void insertIntoFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * toInsert, MemoryBlock* curr) {
-  if (isEmptyFreeList(head, tail)) {
-      head = &(*toInsert);
-      tail = &(*toInsert);
+void insertIntoFreeList(FreeList * list, MemoryBlock * block, MemoryBlock* curr) {
+  if (isEmptyFreeList(list)) {
+      list->head = &(*block);
+      list->tail = &(*block);
+      block->prev = NULL;
+      block->next = NULL;
   } else if (curr == NULL) {
-      head->prev = &(*toInsert);
-      toInsert->next = head;
-      toInsert->prev = NULL;
-      head = &(*toInsert);
-  } else if (curr == tail) {
-    tail->next = &(*toInsert);
-    toInsert->prev = tail;
-    toInsert->next = NULL;
-    tail = &(*toInsert);
+      list->head->prev = &(*block);
+      block->next = list->head;
+      block->prev = NULL;
+      list->head = &(*block);
+  } else if (curr == list->tail) {
+    list->tail->next = &(*block);
+    block->prev = list->tail;
+    block->next = NULL;
+    list->tail = &(*block);
   } else {
     MemoryBlock * toInsert = curr->next;
-    curr->next = &(*toInsert);
-    toInsert->prev = &(*curr);
-    toInsert->next = &(*toInsert);
-    toInsert->prev = &(*toInsert);
+    curr->next = &(*block);
+    block->prev = &(*curr);
+    block->next = &(*toInsert);
+    toInsert->prev = &(*block);
   }
 }
 
-void removeFromFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* toRemove) {
-    if (isEmptyFreeList(head, tail)) { 
+void removeFromFreeList(FreeList * list, MemoryBlock* toRemove) {
+    if (isEmptyFreeList(list)) { 
         fprintf(stderr, "Can't remove from an empty list\n"); 
         return; 
     }
-  if (head == toRemove && tail == toRemove) {//else if toRemove is the first element in the list
-      head = NULL;
-      tail = NULL;
-  } else if (toRemove == head) {//else if toRemove is the first element in the list
-    head = head->next;
-    head->prev = NULL;
-  } else if (toRemove == tail) {
-    tail = tail->prev;
-    tail->next = NULL;
+  if (list->head == toRemove && list->tail == toRemove) {//else if toRemove is the first element in the list
+      list->head = NULL;
+      list->tail = NULL;
+  } else if (toRemove == list->head) {//else if toRemove is the first element in the list
+    list->head = list->head->next;
+    list->head->prev = NULL;
+  } else if (toRemove == list->tail) {
+    list->tail = list->tail->prev;
+    list->tail->next = NULL;
   } else {//toRemove is somewhere in between first and last items in list
     toRemove->prev->next = toRemove->next;
     toRemove->next->prev = toRemove->prev;
@@ -93,84 +93,81 @@ void* allocateMemory(size_t dataSize, sbrkFuncPtr funcPtr) {
   return allocated + 1;  //Return the pointer to the start of the actual data not the metadata. This pointer arithmetic is essentially equal to (char *)allocatedBlock + META_SIZE
 }
 
-MemoryBlock* splitMemoryBlock(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block, size_t dataSize) {
+MemoryBlock* splitMemoryBlock(FreeList * list, MemoryBlock* block, size_t dataSize) {
   if (block->dataSize < META_SIZE + dataSize) {
-      removeFromFreeList(head, tail, block);
+      removeFromFreeList(list, block);
   } else {
       MemoryBlock * remainingBlock = (MemoryBlock *)((char*)(block + 1) + dataSize);
       size_t remainingSize = block->dataSize - dataSize - META_SIZE;
       initializeMemoryBlock(remainingBlock, remainingSize, false);
       block->dataSize = dataSize;
       block->allocated = true;
-      insertIntoFreeList(head, tail, remainingBlock, block);
-      removeFromFreeList(head, tail, block);
+      insertIntoFreeList(list, remainingBlock, block);
+      removeFromFreeList(list, block);
   }
   return block;
 }
 
-void coalesceWithLeft(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block) {
+void coalesceWithLeft(FreeList * list, MemoryBlock* block) {
   if (block->prev && (char*)block == (char*)block->prev + META_SIZE + block->prev->dataSize) {
     MemoryBlock * leftBlock = block->prev;
     leftBlock->dataSize += META_SIZE + block->dataSize;
-    removeFromFreeList(head, tail, block);
+    removeFromFreeList(list, block);
   }
 }
 
-void coalesceWithRight(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block) {
+void coalesceWithRight(FreeList * list, MemoryBlock* block) {
   if (block->next && (char*)block->next == (char*)block + META_SIZE + block->dataSize) {
     MemoryBlock * rightBlock = block->next;
     block->dataSize += META_SIZE + rightBlock->dataSize;
-    removeFromFreeList(head, tail, rightBlock);
+    removeFromFreeList(list, rightBlock);
   }
 }
 
-void freeMemoryBlock(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * block) {
+void freeMemoryBlock(FreeList * list, MemoryBlock * block) {
   block->allocated = false;
-  if (isEmptyFreeList(head, tail) || block > tail) {
-    appendToFreeList(head, tail , block);
-    bool coalesce = (!isEmptyFreeList(head, tail) && block > tail)? true : false;
-    if (coalesce) {
-      coalesceWithLeft(head, tail, block);
-    }
-  } else if (block < head) {
-    insertIntoFreeList(head, tail , block, NULL);
-    coalesceWithRight(head, tail, block);
+  if (isEmptyFreeList(list) || block > list->tail) {
+    appendToFreeList(list, block);
+    coalesceWithLeft(list, block);
+  } else if (block < list->head) {
+    insertIntoFreeList(list, block, NULL);
+    coalesceWithRight(list, block);
   }
    else {
-      MemoryBlock * iter = head;
+      MemoryBlock * iter = list->head;
       while (iter < block) {
         iter = iter->next;
       }
       MemoryBlock * curr = iter->prev;
-      insertIntoFreeList(head, tail, block, curr);
-      coalesceWithRight(head, tail, block);
-      coalesceWithLeft(head, tail, block);
+      insertIntoFreeList(list, block, curr);
+      coalesceWithRight(list, block);
+      coalesceWithLeft(list, block);
   }
 }
 
-void * ff_malloc(MemoryBlock * head, MemoryBlock * tail, sbrkFuncPtr funcPtr, size_t size) {
+void * ff_malloc(FreeList * list, sbrkFuncPtr funcPtr, size_t size) {
     if (size == 0) { return NULL; }
-    MemoryBlock * curr = head;
-    curr = findFirstFit(head, tail, curr, size);
+    MemoryBlock * curr = list->head;
+    curr = findFirstFit(list, curr, size);
     if (curr != NULL) {
       // thread-safe?
-        return splitMemoryBlock(head, tail, curr, size) + 1;
+        return splitMemoryBlock(list, curr, size) + 1;
     }
           //Thread-safe?
     return allocateMemory(size, (*funcPtr));
 }
 
-void ff_free (MemoryBlock * head, MemoryBlock * tail, void * ptr) {
+void ff_free (FreeList * list, void * ptr) {
     if (ptr == NULL) {
       return;
     }
     MemoryBlock * block = (MemoryBlock *)(ptr) - 1;
     //MemoryBlock * block = (MemoryBlock*)((char*)ptr - sizeof(MemoryBlock));
     if (block->allocated == true) {
-      freeMemoryBlock(head, tail, block);
+      freeMemoryBlock(list, block);
     }
 }
-MemoryBlock * findFirstFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * curr, size_t size) {
+MemoryBlock * findFirstFit(FreeList * list, MemoryBlock * curr, size_t size) {
     while (curr != NULL) {
         if (curr->dataSize >= size) {
             return curr;
@@ -180,7 +177,7 @@ MemoryBlock * findFirstFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock *
     return curr;
 }
 
-MemoryBlock * findBestFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * curr, size_t size){
+MemoryBlock * findBestFit(FreeList * list, MemoryBlock * curr, size_t size){
     MemoryBlock * bestFit = NULL;
     while (curr != NULL) {
         if (curr->dataSize == size) {
@@ -199,63 +196,431 @@ MemoryBlock * findBestFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock *
   return bestFit;
 }
 
-void * bf_malloc(MemoryBlock * head, MemoryBlock * tail, sbrkFuncPtr funcPtr, size_t size) {
+void * bf_malloc(FreeList * list, sbrkFuncPtr funcPtr, size_t size) {
     if (size == 0) { return NULL; }
-    MemoryBlock * current = head;
-    MemoryBlock * bestFit = findBestFit(head, tail, current, size);
+    MemoryBlock * current = list->head;
+    MemoryBlock * bestFit = findBestFit(list, current, size);
     if (bestFit != NULL) {
-        return splitMemoryBlock(head, tail, bestFit, size) + 1;
+        return splitMemoryBlock(list, bestFit, size) + 1;
       }
     return allocateMemory(size, (*funcPtr));
 }
 
 
-void * sbrk_nolock (size_t size) {
-  assert(pthread_mutex_lock(&lock) == 0);
+void * sbrk_nolock (intptr_t size) {
+  if (tsLock(&lock) != 0) {
+    fprintf(stderr, "Failed to lock cs \n");
+    return (void*)(-1);
+  }
   void * ptr = sbrk(size);
-  if (ptr == (void*)(-1) || errno == ENOMEM) {
-    fprintf(stderr, "sbrk failed to allocate memory\n");
-    return NULL;
-  } 
-  assert(pthread_mutex_unlock(&lock) == 0);
+  if (tsUnlock(&lock) != 0) {
+    fprintf(stderr, "Failed to unlock cs \n");
+    exit(EXIT_FAILURE);
+  }
   return ptr;
 }
-void bf_free(MemoryBlock * head, MemoryBlock * tail, void * ptr) {
-  ff_free(head, tail, ptr);
+void bf_free(FreeList * list, void * ptr) {
+  ff_free(list, ptr);
 }
 
 /* Thread-Safe Malloc and Free */
-void * ts_malloc_lock (size_t size) {
-  if (pthread_mutex_lock(&lock) != 0) {
+static Arena arenas[TS_MAX_ARENAS];
+static unsigned numArenas = 0;
+static atomic_uint nextArena = 0;   /* round-robin assignment of threads to arenas */
+static pthread_once_t arenasOnce = PTHREAD_ONCE_INIT;
+static __thread Arena * threadArena = NULL;
+
+static void initializeArenas() {
+  long count = TS_ARENAS > 0 ? TS_ARENAS : sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) {
+    count = 1;
+  } else if (count > TS_MAX_ARENAS) {
+    count = TS_MAX_ARENAS;
+  }
+  for (long i = 0; i < count; i++) {
+    tsLockInit(&arenas[i].mutex);
+    arenas[i].index = i;
+  }
+  numArenas = count;
+}
+
+/*
+ * @brief Locks an arena for the calling thread: its own if the mutex is
+ * free, otherwise the first of the others it can take without waiting,
+ * which becomes its own from then on. If every arena is busy it waits for
+ * its own.
+ * @return The locked arena, or NULL if locking failed.
+ */
+static Arena * lockThreadArena() {
+  if (threadArena == NULL) {
+    pthread_once(&arenasOnce, initializeArenas);
+    threadArena = &arenas[atomic_fetch_add_explicit(&nextArena, 1, memory_order_relaxed) % numArenas];
+  }
+  Arena * arena = threadArena;
+  for (unsigned tried = 0; tried < numArenas; tried++) {
+    if (tsTryLock(&arena->mutex) == 0) {
+      threadArena = arena;
+      return arena;
+    }
+    arena = &arenas[(arena->index + 1) % numArenas];
+  }
+  if (tsLock(&threadArena->mutex) != 0) {
+    fprintf(stderr, "Failed to lock cs \n");
+    return NULL;
+  }
+  return threadArena;
+}
+
+/*
+ * @brief Locks the arena a block came from.
+ */
+static Arena * lockOwningArena(MemoryBlock * block) {
+  Arena * arena = &arenas[block->owner];
+  if (tsLock(&arena->mutex) != 0) {
     fprintf(stderr, "Failed to lock cs \n");
-     return NULL;
+    return NULL;
+  }
+  return arena;
+}
+
+static void unlockArena(Arena * arena) {
+  if (tsUnlock(&arena->mutex) != 0) {
+    fprintf(stderr, "Failed to unlock cs \n");
+    exit(EXIT_FAILURE);
   }
-  void * allocatedBlock =  bf_malloc(head, tail, sbrk, size);
-  if (pthread_mutex_unlock(&lock) != 0) {
-      fprintf(stderr, "Failed to unlock cs \n");
+}
+
+static __thread ThreadCache threadCache;
+static __thread bool threadCacheRegistered = false;
+static pthread_key_t threadCacheKey;
+static pthread_once_t threadCacheOnce = PTHREAD_ONCE_INIT;
+
+#define TAG_ONE ((uintptr_t)1 << TS_TAG_SHIFT)
+#define TAGGED_BATCH(word) ((MemoryBlock *)((word) & (TAG_ONE - 1)))
+
+static BatchStack batchStacks[TS_LOCKFREE_CLASSES > 0 ? TS_LOCKFREE_CLASSES : 1];
+
+/*
+ * @brief Pushes a batch of free blocks, linked through next, onto its
+ * class's stack. The batch link is only ever accessed atomically, since a
+ * pop that lost a race may still be reading it.
+ */
+static void pushBatch(unsigned sizeClass, MemoryBlock * batch) {
+  BatchStack * stack = &batchStacks[sizeClass];
+  uintptr_t top = atomic_load_explicit(stack, memory_order_relaxed);
+  uintptr_t pushed;
+  do {
+    __atomic_store_n(&batch->prev, TAGGED_BATCH(top), __ATOMIC_RELAXED);
+    pushed = (uintptr_t)batch | ((top & ~(TAG_ONE - 1)) + TAG_ONE);
+  } while (!atomic_compare_exchange_weak_explicit(stack, &top, pushed,
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+/*
+ * @brief Pops a batch of TS_CACHE_BATCH blocks off a class's stack.
+ * @return The first block of the batch, or NULL if the stack is empty.
+ */
+static MemoryBlock * popBatch(unsigned sizeClass) {
+  BatchStack * stack = &batchStacks[sizeClass];
+  uintptr_t top = atomic_load_explicit(stack, memory_order_acquire);
+  MemoryBlock * batch;
+  uintptr_t popped;
+  do {
+    batch = TAGGED_BATCH(top);
+    if (batch == NULL) {
       return NULL;
+    }
+    popped = (uintptr_t)__atomic_load_n(&batch->prev, __ATOMIC_RELAXED) | ((top & ~(TAG_ONE - 1)) + TAG_ONE);
+  } while (!atomic_compare_exchange_weak_explicit(stack, &top, popped,
+                                                  memory_order_acquire, memory_order_acquire));
+  __atomic_store_n(&batch->prev, NULL, __ATOMIC_RELAXED);
+  return batch;
+}
+
+/*
+ * @brief Detaches TS_CACHE_BATCH blocks of a class from a cache holding
+ * more than that.
+ * @return The first block of the batch, linked through next.
+ */
+static MemoryBlock * takeCachedBatch(ThreadCache * cache, unsigned sizeClass) {
+  MemoryBlock * batch = cache->blocks[sizeClass];
+  MemoryBlock * last = batch;
+  for (unsigned i = 1; i < TS_CACHE_BATCH; i++) {
+    last = last->next;
   }
-  return allocatedBlock;
+  cache->blocks[sizeClass] = last->next;
+  last->next = NULL;
+  cache->counts[sizeClass] -= TS_CACHE_BATCH;
+  return batch;
 }
-void bf_freee(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * ptr) {
 
+/*
+ * @brief Returns up to 'count' blocks of a class to their arenas, holding
+ * each arena's mutex across a run of its blocks.
+ */
+static void releaseCachedBlocks(ThreadCache * cache, unsigned sizeClass, unsigned count) {
+  Arena * locked = NULL;
+  while (count-- > 0 && cache->blocks[sizeClass] != NULL) {
+    MemoryBlock * block = cache->blocks[sizeClass];
+    if (locked == NULL || block->owner != locked->index) {
+      if (locked != NULL) {
+        unlockArena(locked);
+      }
+      if ((locked = lockOwningArena(block)) == NULL) {
+        return;
+      }
+    }
+    cache->blocks[sizeClass] = block->next;
+    cache->counts[sizeClass]--;
+    freeMemoryBlock(&locked->list, block);
+  }
+  if (locked != NULL) {
+    unlockArena(locked);
+  }
+}
+
+static void flushThreadCache(void * cache) {
+  for (unsigned c = 0; c < SIZE_CLASS_COUNT; c++) {
+    releaseCachedBlocks(cache, c, ((ThreadCache *)cache)->counts[c]);
+  }
+}
+
+static void createThreadCacheKey() {
+  pthread_key_create(&threadCacheKey, flushThreadCache);
+}
+
+/*
+ * @brief Returns the calling thread's cache, arranging for it to be
+ * flushed back to the arenas when the thread exits.
+ */
+static ThreadCache * getThreadCache() {
+  if (!threadCacheRegistered) {
+    pthread_once(&threadCacheOnce, createThreadCacheKey);
+    pthread_setspecific(threadCacheKey, &threadCache);
+    threadCacheRegistered = true;
+  }
+  return &threadCache;
+}
+
+/*
+ * @brief Refills an empty cache: with a batch off the class's BatchStack
+ * if it has one, otherwise with up to TS_CACHE_BATCH blocks from the
+ * thread's arena under one acquisition of the arena's mutex: best fits
+ * from the arena's free list first, then the rest carved out of a single
+ * sbrk.
+ */
+static void refillThreadCache(ThreadCache * cache, unsigned sizeClass) {
+  if (sizeClass < TS_LOCKFREE_CLASSES) {
+    MemoryBlock * batch = popBatch(sizeClass);
+    if (batch != NULL) {
+      cache->blocks[sizeClass] = batch;
+      cache->counts[sizeClass] += TS_CACHE_BATCH;
+      return;
+    }
+  }
+  size_t dataSize = sizeClasses[sizeClass];
+  Arena * arena = lockThreadArena();
+  if (arena == NULL) {
+    return;
+  }
+  unsigned count = 0;
+  for (; count < TS_CACHE_BATCH; count++) {
+    MemoryBlock * fit = findBestFit(&arena->list, arena->list.head, dataSize);
+    if (fit == NULL) {
+      break;
+    }
+    MemoryBlock * block = splitMemoryBlock(&arena->list, fit, dataSize);
+    block->owner = arena->index;
+    block->next = cache->blocks[sizeClass];
+    cache->blocks[sizeClass] = block;
+  }
+  if (count < TS_CACHE_BATCH) {
+    size_t carved = TS_CACHE_BATCH - count;
+    char * chunk = sbrk_nolock(carved * (META_SIZE + dataSize));
+    if (chunk == (void*)(-1)) {
+      fprintf(stderr, "sbrk failed to allocate memory\n");
+      carved = 0;
+    }
+    for (size_t i = 0; i < carved; i++) {
+      MemoryBlock * block = (MemoryBlock *)(chunk + i * (META_SIZE + dataSize));
+      initializeMemoryBlock(block, dataSize, true);
+      block->owner = arena->index;
+      block->next = cache->blocks[sizeClass];
+      cache->blocks[sizeClass] = block;
+    }
+    count += carved;
+  }
+  cache->counts[sizeClass] += count;
+  unlockArena(arena);
+}
+
+/*
+ * @brief Returns the size class a block belongs in, or SIZE_CLASS_COUNT if
+ * its size is not exactly one of the classes (it was not carved for a
+ * cache, or a split left it a little larger).
+ */
+static unsigned cachedClassOf(MemoryBlock * block) {
+  if (block->dataSize > SIZE_CLASS_MAX) {
+    return SIZE_CLASS_COUNT;
+  }
+  unsigned sizeClass = sizeClassIndex(block->dataSize);
+  return sizeClasses[sizeClass] == block->dataSize ? sizeClass : SIZE_CLASS_COUNT;
+}
+
+void * ts_malloc_lock (size_t size) {
+  if (size == 0) { return NULL; }
+  if (size <= SIZE_CLASS_MAX) {
+    ThreadCache * cache = getThreadCache();
+    unsigned sizeClass = sizeClassIndex(size);
+    if (cache->blocks[sizeClass] == NULL) {
+      refillThreadCache(cache, sizeClass);
+      if (cache->blocks[sizeClass] == NULL) {
+        return NULL;
+      }
+    }
+    MemoryBlock * block = cache->blocks[sizeClass];
+    cache->blocks[sizeClass] = block->next;
+    cache->counts[sizeClass]--;
+    block->next = NULL;
+    return block + 1;
+  }
+  Arena * arena = lockThreadArena();
+  if (arena == NULL) {
+    return NULL;
+  }
+  void * allocatedBlock = bf_malloc(&arena->list, sbrk_nolock, size);
+  if (allocatedBlock != NULL) {
+    ((MemoryBlock *)allocatedBlock - 1)->owner = arena->index;
+  }
+  unlockArena(arena);
+  return allocatedBlock;
 }
 void ts_free_lock(void * ptr) {
-  if (pthread_mutex_lock(&lock) != 0) {
-      fprintf(stderr, "Failed to lock cs \n");
+  if (ptr == NULL) {
+    return;
+  }
+  MemoryBlock * block = (MemoryBlock *)(ptr) - 1;
+  unsigned sizeClass = cachedClassOf(block);
+  if (sizeClass < SIZE_CLASS_COUNT) {
+    ThreadCache * cache = getThreadCache();
+    block->next = cache->blocks[sizeClass];
+    cache->blocks[sizeClass] = block;
+    if (++cache->counts[sizeClass] <= TS_CACHE_LIMIT) {
+      return;
+    }
+    /* Overflowing: hand a batch back so other threads can reuse it. */
+    if (sizeClass < TS_LOCKFREE_CLASSES) {
+      pushBatch(sizeClass, takeCachedBatch(cache, sizeClass));
+    } else {
+      releaseCachedBlocks(cache, sizeClass, TS_CACHE_BATCH);
+    }
+    return;
+  }
+  Arena * arena = lockOwningArena(block);
+  if (arena == NULL) {
+    return;
+  }
+  bf_free(&arena->list, ptr);
+  unlockArena(arena);
+}
+
+static ThreadHeap threadHeaps[TS_MAX_HEAPS];
+static unsigned numThreadHeaps = 0;
+static ThreadHeap * orphanedHeaps = NULL;   /* heaps of exited threads, linked through nextOrphan */
+static __thread ThreadHeap * threadHeap = NULL;
+static pthread_key_t threadHeapKey;
+static pthread_once_t threadHeapOnce = PTHREAD_ONCE_INIT;
+
+static void detachThreadHeap(void * heap) {
+  if (tsLock(&lock) != 0) {
+    fprintf(stderr, "Failed to lock cs \n");
+    return;
+  }
+  ((ThreadHeap *)heap)->nextOrphan = orphanedHeaps;
+  orphanedHeaps = heap;
+  if (tsUnlock(&lock) != 0) {
+    fprintf(stderr, "Failed to unlock cs \n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void createThreadHeapKey() {
+  pthread_key_create(&threadHeapKey, detachThreadHeap);
+}
+
+/*
+ * @brief Gives the calling thread a heap: one left behind by an exited
+ * thread if there is one, so its free blocks are not stranded, or a new one.
+ */
+static ThreadHeap * attachThreadHeap() {
+  pthread_once(&threadHeapOnce, createThreadHeapKey);
+  if (tsLock(&lock) != 0) {
+    fprintf(stderr, "Failed to lock cs \n");
+    return NULL;
+  }
+  ThreadHeap * heap = orphanedHeaps;
+  if (heap != NULL) {
+    orphanedHeaps = heap->nextOrphan;
+  } else if (numThreadHeaps < TS_MAX_HEAPS) {
+    heap = &threadHeaps[numThreadHeaps];
+    heap->index = numThreadHeaps++;
+  }
+  if (tsUnlock(&lock) != 0) {
+    fprintf(stderr, "Failed to unlock cs \n");
+    exit(EXIT_FAILURE);
   }
-  bf_free(head, tail, ptr);
-  if (pthread_mutex_unlock(&lock) != 0) {
-      fprintf(stderr, "Failed to unlock cs \n");
-      exit(EXIT_FAILURE);
-  } 
-}  
+  if (heap == NULL) {
+    fprintf(stderr, "more than %d threads allocating at once\n", TS_MAX_HEAPS);
+    return NULL;
+  }
+  pthread_setspecific(threadHeapKey, heap);
+  threadHeap = heap;
+  return heap;
+}
+
+/*
+ * @brief Frees the blocks other threads have handed back to a heap. Only
+ * its owner calls this, so the list needs no lock; taking the whole queue
+ * with one exchange leaves nothing for a concurrent push to race with.
+ */
+static void reclaimRemoteFrees(ThreadHeap * heap) {
+  MemoryBlock * block = atomic_exchange_explicit(&heap->remoteFrees, NULL, memory_order_acquire);
+  while (block != NULL) {
+    MemoryBlock * next = block->next;
+    ff_free(&heap->list, block + 1);
+    block = next;
+  }
+}
 
 void * ts_malloc_nolock (size_t size) {
-    void * allocated = bf_malloc(ts_nolockHead, ts_nolockTail, sbrk_nolock, size);
+    ThreadHeap * heap = threadHeap != NULL ? threadHeap : attachThreadHeap();
+    if (heap == NULL) {
+      return NULL;
+    }
+    if (atomic_load_explicit(&heap->remoteFrees, memory_order_relaxed) != NULL) {
+      reclaimRemoteFrees(heap);
+    }
+    void * allocated = bf_malloc(&heap->list, sbrk_nolock, size);
+    if (allocated != NULL) {
+      ((MemoryBlock *)allocated - 1)->owner = heap->index;
+    }
     return allocated;
 }
 
-void * ts_free_nolock(void * ptr) {
-    bf_freee(ts_nolockHead, ts_nolockTail, ptr);
+void ts_free_nolock(void * ptr) {
+    if (ptr == NULL) {
+      return;
+    }
+    MemoryBlock * block = (MemoryBlock *)(ptr) - 1;
+    ThreadHeap * owner = &threadHeaps[block->owner];
+    if (owner == threadHeap) {
+      bf_free(&owner->list, ptr);
+      return;
+    }
+    /* Someone else's block: push it onto the owner's queue for it to free. */
+    MemoryBlock * head = atomic_load_explicit(&owner->remoteFrees, memory_order_relaxed);
+    do {
+      block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remoteFrees, &head, block,
+                                                    memory_order_release, memory_order_relaxed));
 }
@@ -9,8 +9,15 @@
 #include <assert.h>
 #include <stddef.h> 
 #include <pthread.h>
+#include <stdatomic.h>
+#include "size_classes.h"
+#include "ts_lock.h"
 
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * @brief Serializes growing the data segment (and handing ThreadHeaps to
+ * threads); a TsLock of the kind picked by TS_LOCK.
+ */
+extern TsLock lock;
 
 typedef void * (*sbrkFuncPtr) (intptr_t);
 /**
@@ -18,12 +25,14 @@ typedef void * (*sbrkFuncPtr) (intptr_t);
  *
  * The MemoryBlock structure is used to represent a block of memory that can be
  * allocated or deallocated. It contains information about the size of the data
- * stored in the block, the allocation status, and pointers to the previous and
- * next blocks in the linked list.
+ * stored in the block, the allocation status, the Arena (ts_malloc_lock) or
+ * ThreadHeap (ts_malloc_nolock) that owns it, and pointers to the previous
+ * and next blocks in the linked list.
  */
 struct MemoryBlock {
   size_t dataSize;             /**< Size of the data stored in the block. */
   bool allocated;              /**< Indicates whether the block is currently allocated. */
+  uint32_t owner;              /**< Index of the owning Arena or ThreadHeap; sits in the padding. */
   struct MemoryBlock * prev;    /**< Pointer to the previous MemoryBlock in the linked list. */
   struct MemoryBlock * next;    /**< Pointer to the next MemoryBlock in the linked list. */
 };
@@ -41,6 +50,103 @@ typedef struct FreeList FreeList;
 
 #define META_SIZE sizeof(MemoryBlock)
 
+#define TS_MAX_ARENAS 64   /* upper bound on the number of arenas */
+#ifndef TS_ARENAS
+#define TS_ARENAS 0        /* arenas for ts_malloc_lock; 0 for one per online CPU */
+#endif
+
+/*
+ * @brief One of the locked heaps behind ts_malloc_lock/ts_free_lock.
+ *
+ * Rather than one free list behind one lock, there are TS_ARENAS of each
+ * (by default one per online CPU, at most TS_MAX_ARENAS). Threads are
+ * dealt arenas round-robin on their first allocation. A thread that finds
+ * its arena's lock held tries the others in turn with tsTryLock and
+ * moves to the first one it gets, blocking on its own only if every
+ * arena is busy, so contended threads spread themselves out. Every block
+ * records the index of the arena it came from, and a free, from whichever
+ * thread, goes back to that arena. The arenas share the data segment;
+ * growing it takes the global lock.
+ */
+struct Arena {
+  TsLock mutex;                             /**< A lock of the kind picked by TS_LOCK. */
+  FreeList list;                            /**< Guarded by mutex. */
+  uint32_t index;                           /**< Position in the arena table, stored in owned blocks. */
+};
+typedef struct Arena Arena;
+
+#define TS_CACHE_BATCH 32                    /* blocks moved between a thread cache and the arenas at once */
+#define TS_CACHE_LIMIT (2 * TS_CACHE_BATCH)  /* blocks of a class a cache holds before giving a batch back */
+
+/*
+ * @brief Per-thread cache of free blocks for ts_malloc_lock/ts_free_lock.
+ *
+ * Requests of up to SIZE_CLASS_MAX bytes are rounded up to a size class
+ * (size_classes.h) and served from the calling thread's list for that
+ * class without locking. An empty list is refilled with TS_CACHE_BATCH
+ * blocks from the thread's arena under one acquisition of its mutex, and
+ * a list that grows past TS_CACHE_LIMIT hands TS_CACHE_BATCH back, each
+ * to the arena it came from. Cached blocks stay allocated as far as the
+ * arenas are concerned; they are linked through their next pointers, and
+ * a block freed by another thread simply joins that thread's cache. A
+ * thread's cache is flushed back to the arenas when it exits. Larger
+ * requests go to an arena directly.
+ */
+struct ThreadCache {
+  MemoryBlock * blocks[SIZE_CLASS_COUNT];   /**< Free blocks of each class. */
+  unsigned counts[SIZE_CLASS_COUNT];        /**< Length of each list. */
+};
+typedef struct ThreadCache ThreadCache;
+
+#ifndef TS_LOCKFREE_CLASSES
+#define TS_LOCKFREE_CLASSES 4   /* smallest size classes shared through lock-free stacks; 0 for none */
+#endif
+#define TS_TAG_SHIFT 48         /* user addresses fit below this bit; the bits above count generations */
+
+/*
+ * @brief A lock-free stack of batches of free blocks of one size class,
+ * for the TS_LOCKFREE_CLASSES smallest classes.
+ *
+ * For these classes a thread cache that overflows pushes TS_CACHE_BATCH
+ * blocks onto its class's stack as one entry, and an empty cache pops one
+ * entry before trying its arena, each with one compare-and-swap, so small
+ * frees never wait on an arena mutex and small allocations only do when
+ * the stack is empty. A batch is linked through its blocks' next pointers
+ * and the batches through their first blocks' prev. The stack is one word:
+ * the first batch's address in the bits below TS_TAG_SHIFT and a
+ * generation count, bumped by every push and pop, above. A pop that read
+ * the top, and then lost it to a pop and a push that put the same block
+ * back (ABA), sees a different generation and retries instead of
+ * installing a stale link. Blocks are never unmapped, so reading the link
+ * of a batch someone else has just popped is harmless. Blocks on a stack
+ * stay allocated as far as the arenas are concerned.
+ */
+typedef _Atomic(uintptr_t) BatchStack;
+
+#define TS_MAX_HEAPS 1024   /* threads that can be allocating with ts_malloc_nolock at once */
+
+/*
+ * @brief A per-thread heap for ts_malloc_nolock/ts_free_nolock.
+ *
+ * Each thread allocates from its own free list without locking (only
+ * growing the heap with sbrk takes the lock) and records its heap's index
+ * in every block it hands out. A thread freeing one of its own blocks
+ * puts it straight back on its list. A block owned by another heap is
+ * pushed onto that heap's remoteFrees, a lock-free stack any thread may
+ * push onto and only the owner empties: the owner takes the whole stack
+ * with one exchange at its next allocation and frees the batch into its
+ * list. When a thread exits its heap, with whatever is free in it or
+ * still queued for it, is handed to the next thread that starts
+ * allocating.
+ */
+struct ThreadHeap {
+  FreeList list;                            /**< Owner only. */
+  _Atomic(MemoryBlock *) remoteFrees;       /**< Blocks freed by other threads, linked through next. */
+  uint32_t index;                           /**< Position in the heap table, stored in owned blocks. */
+  struct ThreadHeap * nextOrphan;           /**< Next heap waiting for a thread; guarded by the lock. */
+};
+typedef struct ThreadHeap ThreadHeap;
+
 /*
  * @brief Global variables to track heap information.
  */
@@ -55,7 +161,7 @@ typedef struct _heap_info_t heap_info_t;
  * @param list: Pointer to the linked list.
  * @return Boolean indicating whether the list is empty.
  */
-bool isEmptyFreeList (MemoryBlock * head, MemoryBlock * tail);
+bool isEmptyFreeList (FreeList * list);
 
 
 /*
@@ -72,7 +178,7 @@ void initializeMemoryBlock(MemoryBlock * block, size_t dataSize, bool occupied);
  * @param list: Pointer to the linked list.
  * @param toAppend: Pointer to the block to be appended.
  */
-void appendToFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block);
+void appendToFreeList(FreeList * list, MemoryBlock* block);
 
 /*
  * This function searches for the first MemoryBlock in the linked list starting
@@ -86,7 +192,7 @@ void appendToFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block
  * @return      Pointer to the first MemoryBlock that fits the specified size,
  *              or NULL if no suitable block is found.
  */
-MemoryBlock * findFirstFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * curr, size_t size);
+MemoryBlock * findFirstFit(FreeList * list, MemoryBlock * curr, size_t size);
 
 /*
  * This function inserts the specified MemoryBlock into the given FreeList.
@@ -101,7 +207,7 @@ MemoryBlock * findFirstFit(MemoryBlock * head, MemoryBlock * tail, MemoryBlock *
  *              the new block should be inserted. If NULL, the block is inserted
  *              at the beginning.
  */
-void insertIntoFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * toInsert, MemoryBlock * curr);
+void insertIntoFreeList(FreeList * list, MemoryBlock * toInsert, MemoryBlock * curr);
 
 
 /*
@@ -109,7 +215,7 @@ void insertIntoFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * to
  * @param list: Pointer to the linked list.
  * @param toRemove: Pointer to the block to be removed.
  */
-void removeFromFreeList(MemoryBlock * head, MemoryBlock * tail, MemoryBlock * toRemove);
+void removeFromFreeList(FreeList * list, MemoryBlock * toRemove);
 
 /*
  * @brief Allocates memory.
@@ -123,19 +229,19 @@ void* allocateMemory(size_t dataSize, sbrkFuncPtr funcPtr);
  * @param size: Size of the data needed.
  * @return Pointer to the allocated block.
  */
-MemoryBlock* splitMemoryBlock(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block, size_t dataSize);
+MemoryBlock* splitMemoryBlock(FreeList * list, MemoryBlock* block, size_t dataSize);
 
 /*
  * @brief Coalesces with the left adjacent block.
  * @param rightBlock: Pointer to the block to the right.
  */
-void coalesceWithLeft(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block);
+void coalesceWithLeft(FreeList * list, MemoryBlock* block);
 
 /*
  * @brief Coalesces with the right adjacent block.
  * @param leftBlock: Pointer to the block to the left.
  */
-void coalesceWithRight(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block);
+void coalesceWithRight(FreeList * list, MemoryBlock* block);
 
 
 /*
@@ -150,38 +256,63 @@ void coalesceWithRight(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* bloc
  *
  * @param block Pointer to the MemoryBlock to be freed.
  */
-void freeMemoryBlock(MemoryBlock * head, MemoryBlock * tail, MemoryBlock* block);
+void freeMemoryBlock(FreeList * list, MemoryBlock* block);
 
 /*
  * @brief First-fit memory allocation.
  * @param size: Size of the data needed.
  * @return Pointer to the allocated memory.
  */
-void * ff_malloc(MemoryBlock * head, MemoryBlock * tail, sbrkFuncPtr funcPtr, size_t size);
+void * ff_malloc(FreeList * list, sbrkFuncPtr funcPtr, size_t size);
 
 /*
  * @brief First-fit memory deallocation.
  * @param toFree: Pointer to the memory block to be deallocated.
  */
-void ff_free(MemoryBlock * head, MemoryBlock * tail, void* ptr);
+void ff_free(FreeList * list, void* ptr);
 
 /*
  * @brief Best-fit memory allocation.
  * @param size: Size of the data needed.
  * @return Pointer to the allocated memory.
  */
-void* bf_malloc(MemoryBlock * head, MemoryBlock * tail, sbrkFuncPtr funcPtr, size_t size);
+void* bf_malloc(FreeList * list, sbrkFuncPtr funcPtr, size_t size);
 
 /*
  * @brief Best-fit memory deallocation.
  * @param toFree: Pointer to the memory block to be deallocated.
  */
-void bf_free(MemoryBlock * head, MemoryBlock * tail, void* ptr);
+void bf_free(FreeList * list, void* ptr);
 
 
+/*
+ * @brief Thread-safe best-fit allocation from an Arena, through the
+ * calling thread's ThreadCache for sizes up to SIZE_CLASS_MAX.
+ * @param size: Size of the data needed.
+ * @return Pointer to the allocated memory.
+ */
 void * ts_malloc_lock (size_t size);
 
+/*
+ * @brief Thread-safe deallocation of ts_malloc_lock memory, from any thread.
+ * @param ptr: Pointer to the memory to be deallocated.
+ */
 void ts_free_lock(void * ptr);
+
+/*
+ * @brief Thread-safe best-fit allocation from the calling thread's
+ * ThreadHeap.
+ * @param size: Size of the data needed.
+ * @return Pointer to the allocated memory.
+ */
+void * ts_malloc_nolock (size_t size);
+
+/*
+ * @brief Thread-safe deallocation of ts_malloc_nolock memory, from any
+ * thread.
+ * @param ptr: Pointer to the memory to be deallocated.
+ */
+void ts_free_nolock(void * ptr);
 /*
  * @brief Gets the total size of the data segment.
  * @return Total size of the data segment.
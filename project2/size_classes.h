@@ -0,0 +1,42 @@
+/*
+ * Size classes generated by size_class_opt from size_classes.hist:
+ * 16 classes for 29 requests of at most 1024 bytes, 16-byte aligned.
+ * Expected internal fragmentation 2.43% (powers of two: 22.78%).
+ * Regenerate rather than edit.
+ */
+#ifndef SIZE_CLASSES_H
+#define SIZE_CLASSES_H
+#include <stddef.h>
+
+#define SIZE_CLASS_COUNT 16
+#define SIZE_CLASS_ALIGN 16
+#define SIZE_CLASS_MAX   1024
+
+#ifdef __cplusplus
+#define SIZE_CLASS_TABLE constexpr
+#define SIZE_CLASS_FUNC  constexpr inline
+#else
+#define SIZE_CLASS_TABLE static const
+#define SIZE_CLASS_FUNC  static inline
+#endif
+
+SIZE_CLASS_TABLE size_t sizeClasses[SIZE_CLASS_COUNT] = {
+  128, 160, 192, 256, 320, 384, 448, 512,
+  576, 640, 704, 768, 832, 896, 960, 1024
+};
+
+/* sizeClassLookup[(size + SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN] is the class of size. */
+SIZE_CLASS_TABLE unsigned char sizeClassLookup[SIZE_CLASS_MAX / SIZE_CLASS_ALIGN + 1] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 3,
+  3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7,
+  7, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11,
+  11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+  15
+};
+
+/* Index of the smallest class that holds size; size must not exceed SIZE_CLASS_MAX. */
+SIZE_CLASS_FUNC unsigned sizeClassIndex(size_t size) {
+  return sizeClassLookup[(size + SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN];
+}
+
+#endif
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Runs thread_test_measurement against the library built with each
+# TS_LOCK kind, for 1 to 32 threads sharing ITEMS mallocs, and prints
+# throughput and fairness. Rebuilds ../libmymalloc.so as it goes and
+# leaves it built with the default lock.
+#
+# usage: ./lock_bench.sh [LOCK_VERSION|NOLOCK_VERSION] [ITEMS]
+
+MALLOC_VERSION=${1:-LOCK_VERSION}
+ITEMS=${2:-32000}
+WDIR=..
+
+printf "%-8s %8s %10s %10s %10s %10s\n" lock threads seconds Mops/s fairness slow/fast
+for lock in TS_LOCK_MUTEX TS_LOCK_FUTEX TS_LOCK_TICKET TS_LOCK_MCS; do
+  make -s -C $WDIR clean
+  make -s -C $WDIR CFLAGS="-O3 -fPIC -DTS_LOCK=$lock" || exit 1
+  for threads in 1 2 4 8 16 32; do
+    gcc -O3 -I$WDIR -D$MALLOC_VERSION -DNUM_THREADS=$threads -DNUM_ITEMS=$((ITEMS / threads)) \
+        -L$WDIR -Wl,-rpath=$WDIR -o lock_bench_measurement thread_test_measurement.c -lmymalloc -lrt -lpthread || exit 1
+    ./lock_bench_measurement | awk -v lock=${lock#TS_LOCK_} -v threads=$threads '
+      /Test failed/       { failed = 1 }
+      /Execution Time/    { seconds = $4 }
+      /Throughput/        { mops = $3 }
+      /Fairness/          { fairness = $3; ratio = $7 }
+      END {
+        printf "%-8s %8d %10.4f %10.2f %10s %10s%s\n", tolower(lock), threads, seconds, mops, fairness, ratio,
+               failed ? "  FAILED" : ""
+      }'
+  done
+done
+rm -f lock_bench_measurement
+make -s -C $WDIR clean
+make -s -C $WDIR
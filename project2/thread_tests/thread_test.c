@@ -12,8 +12,12 @@
 #define FREE(p)    ts_free_nolock(p)
 #endif
  
+#ifndef NUM_THREADS
 #define NUM_THREADS  4
+#endif
+#ifndef NUM_ITEMS
 #define NUM_ITEMS    10000
+#endif
 
 pthread_t threads[NUM_THREADS];
 int       thread_id[NUM_THREADS];
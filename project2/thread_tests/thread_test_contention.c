@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+#ifdef LOCK_VERSION
+#define MALLOC(sz) ts_malloc_lock(sz)
+#define FREE(p)    ts_free_lock(p)
+#endif
+#ifdef NOLOCK_VERSION
+#define MALLOC(sz) ts_malloc_nolock(sz)
+#define FREE(p)    ts_free_nolock(p)
+#endif
+
+#ifndef NUM_THREADS
+#define NUM_THREADS  4
+#endif
+#ifndef NUM_ITEMS
+#define NUM_ITEMS    4096
+#endif
+#ifndef NUM_ROUNDS
+#define NUM_ROUNDS   50
+#endif
+
+//Contention benchmark for small objects. In every round each thread
+//allocates NUM_ITEMS blocks of 128 to 256 bytes and stamps them with its
+//id; after a barrier it checks and frees the blocks the previous thread
+//allocated. Every block is freed by a thread other than the one that
+//allocated it, so the per-thread caches keep handing batches back to the
+//shared lists and taking them out again.
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+pthread_t threads[NUM_THREADS];
+int       thread_id[NUM_THREADS];
+
+pthread_barrier_t barrier;
+int corrupted = 0;
+
+unsigned char *items[NUM_THREADS][NUM_ITEMS];
+size_t         sizes[NUM_THREADS][NUM_ITEMS];
+
+
+void do_rounds(int thread_id) {
+  int round, i;
+  int previous = (thread_id + NUM_THREADS - 1) % NUM_THREADS;
+
+  pthread_barrier_wait(&barrier);
+
+  for (round=0; round < NUM_ROUNDS; round++) {
+    for (i=0; i < NUM_ITEMS; i++) {
+      items[thread_id][i] = MALLOC(sizes[thread_id][i]);
+      memset(items[thread_id][i], thread_id, sizes[thread_id][i]);
+    } //for i
+
+    pthread_barrier_wait(&barrier);
+
+    for (i=0; i < NUM_ITEMS; i++) {
+      unsigned char *item = items[previous][i];
+      if (item[0] != previous || item[sizes[previous][i] - 1] != previous) {
+	__atomic_store_n(&corrupted, 1, __ATOMIC_RELAXED);
+      } //if
+      FREE(item);
+    } //for i
+
+    pthread_barrier_wait(&barrier);
+  } //for round
+}
+
+
+void *run(void *arg) {
+  int id = *((int *) arg);
+  do_rounds(id);
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int i, j;
+  struct timespec start_time, end_time;
+
+  srand(0);
+  for (i=0; i < NUM_THREADS; i++) {
+    for (j=0; j < NUM_ITEMS; j++) {
+      sizes[i][j] = 128 + (rand() % 129);
+    } //for j
+  } //for i
+
+  pthread_barrier_init(&barrier, NULL, NUM_THREADS);
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < NUM_THREADS; i++) {
+    thread_id[i] = i;
+    pthread_create(&threads[i], NULL, run, (void *)(&thread_id[i]));
+  } //for i
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  } //for i
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  if (corrupted == 0) {
+    printf("No block was changed by another allocation\n");
+    printf("Test passed\n");
+  } else {
+    printf("A block was changed while allocated\n");
+    printf("Test failed\n");
+  } //else
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  double operations = 2.0 * NUM_THREADS * NUM_ITEMS * NUM_ROUNDS;
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %.2f Mops/s\n", operations / elapsed_ns * 1e3);
+
+  return 0;
+}
@@ -12,8 +12,12 @@
 #define FREE(p)    ts_free_nolock(p)
 #endif
  
+#ifndef NUM_THREADS
 #define NUM_THREADS  4
+#endif
+#ifndef NUM_ITEMS
 #define NUM_ITEMS    10000
+#endif
 
 pthread_t threads[NUM_THREADS];
 int       thread_id[NUM_THREADS];
@@ -46,11 +50,12 @@ void do_allocate(int thread_id) {
   for (i=0; i < NUM_ITEMS; i++) {
     index = i + thread_start_index;
     malloc_items[index].address = (int *)MALLOC(malloc_items[index].bytes);
-    malloc_items[index].free = 0;
+    //Publish the address to the freeing threads
+    __atomic_store_n(&malloc_items[index].free, 0, __ATOMIC_RELEASE);
 
     if ((i % 10) == 0) { //Occasionally free some items
       pthread_mutex_lock(&my_mutex);
-      if (malloc_items[counter].free == 0) {
+      if (__atomic_load_n(&malloc_items[counter].free, __ATOMIC_ACQUIRE) == 0) {
 	malloc_items[counter].free = 1;
 	do_free = 1;
       } else {
@@ -13,8 +13,12 @@
 #define FREE(p)    ts_free_nolock(p)
 #endif
    
+#ifndef NUM_THREADS
 #define NUM_THREADS  4
+#endif
+#ifndef NUM_ITEMS
 #define NUM_ITEMS    20000
+#endif
 
 double calc_time(struct timespec start, struct timespec end) {
   double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
@@ -30,6 +34,7 @@ double calc_time(struct timespec start, struct timespec end) {
 
 pthread_t threads[NUM_THREADS];
 int       thread_id[NUM_THREADS];
+double    thread_ns[NUM_THREADS];   //time each thread took for its mallocs
 
 pthread_barrier_t barrier;
 pthread_mutex_t   my_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -56,15 +61,18 @@ void do_allocate(int thread_id) {
   //Want the concurrent malloc calls to be as high as possible
   pthread_barrier_wait(&barrier); 
 
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
   for (i=0; i < NUM_ITEMS; i++) {
     index = i + thread_start_index;
     malloc_items[index].address = (int *)MALLOC(malloc_items[index].bytes);
-    malloc_items[index].free = 0;
+    //Publish the address to the freeing threads
+    __atomic_store_n(&malloc_items[index].free, 0, __ATOMIC_RELEASE);
 
     if ((thread_id % 2) == 0) {
       if ((i % 4) == 0) { //Occasionally free some items
 	pthread_mutex_lock(&my_mutex);
-	if (malloc_items[counter].free == 0) {
+	if (__atomic_load_n(&malloc_items[counter].free, __ATOMIC_ACQUIRE) == 0) {
 	  malloc_items[counter].free = 1;
 	  do_free = 1;
 	} else {
@@ -78,6 +86,8 @@ void do_allocate(int thread_id) {
       } //if
     }
   } //for i
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  thread_ns[thread_id] = calc_time(start_time, end_time);
 
   pthread_barrier_wait(&barrier);
 }
@@ -166,6 +176,20 @@ int main(int argc, char *argv[])
   printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
   printf("Data Segment Size = %lu bytes\n", (unsigned long)(end_segment_addr - start_segment_addr));
 
+  //Fairness: Jain's index of the threads' malloc rates, 1 when every
+  //thread gets the same share and 1/NUM_THREADS when one gets it all.
+  double sum = 0, sum_squares = 0, fastest = thread_ns[0], slowest = thread_ns[0];
+  for (i=0; i < NUM_THREADS; i++) {
+    double rate = NUM_ITEMS / thread_ns[i];
+    sum += rate;
+    sum_squares += rate * rate;
+    if (thread_ns[i] < fastest) fastest = thread_ns[i];
+    if (thread_ns[i] > slowest) slowest = thread_ns[i];
+  } //for i
+  printf("Throughput = %.2f Mops/s\n", NUM_THREADS * NUM_ITEMS / elapsed_ns * 1e3);
+  printf("Fairness = %.3f (slowest thread took %.2fx the fastest)\n",
+	 sum * sum / (NUM_THREADS * sum_squares), slowest / fastest);
+
   return 0;
 }
   
\ No newline at end of file
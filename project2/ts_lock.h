@@ -0,0 +1,235 @@
+/*
+ * Locks for the thread-safe allocator (the global lock around sbrk and
+ * the arena locks), chosen at build time with -DTS_LOCK=<kind>:
+ *
+ *   TS_LOCK_MUTEX   pthread mutex (the default)
+ *   TS_LOCK_FUTEX   spins TS_LOCK_SPINS times, then sleeps on a futex;
+ *                   unlock only makes a system call if someone sleeps
+ *   TS_LOCK_TICKET  ticket lock: waiters are served in arrival order,
+ *                   all spinning on one shared counter
+ *   TS_LOCK_MCS     MCS queue lock: also first come first served, but
+ *                   each waiter spins on its own queue node, so a
+ *                   handoff touches one waiter's cache line, not all
+ *
+ * e.g. "make CFLAGS='-O3 -fPIC -DTS_LOCK=TS_LOCK_MCS'". The ticket and
+ * MCS waiters yield the CPU after TS_LOCK_SPINS spins instead of
+ * spinning on: with more threads than CPUs, the thread next in line may
+ * not be running, and pure spinning would burn whole time slices waiting
+ * for it.
+ *
+ * All four lock, try-lock and unlock with tsLock, tsTryLock and tsUnlock,
+ * which return 0 on success like their pthread counterparts. A thread
+ * may hold up to TS_LOCK_MAX_NESTING locks at once, and MCS locks must be
+ * released in the reverse order they were taken (queue nodes are kept in
+ * a per-thread stack).
+ */
+#ifndef TS_LOCK_H
+#define TS_LOCK_H
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TS_LOCK_MUTEX  0
+#define TS_LOCK_FUTEX  1
+#define TS_LOCK_TICKET 2
+#define TS_LOCK_MCS    3
+
+#ifndef TS_LOCK
+#define TS_LOCK TS_LOCK_MUTEX
+#endif
+#ifndef TS_LOCK_SPINS
+#define TS_LOCK_SPINS 100        /* spins before a waiter sleeps or yields */
+#endif
+#define TS_LOCK_MAX_NESTING 4    /* locks one thread may hold at once */
+
+static inline void tsLockPause() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * @brief Waits a little longer for a lock: a pause instruction for the
+ * first TS_LOCK_SPINS rounds, then a yield of the CPU.
+ */
+static inline void tsLockBackOff(unsigned * spins) {
+  if (*spins < TS_LOCK_SPINS) {
+    (*spins)++;
+    tsLockPause();
+  } else {
+    sched_yield();
+  }
+}
+
+#if TS_LOCK == TS_LOCK_MUTEX
+
+typedef pthread_mutex_t TsLock;
+#define TS_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define TS_LOCK_NAME "mutex"
+
+static inline void tsLockInit(TsLock * lock) { pthread_mutex_init(lock, NULL); }
+static inline int tsLock(TsLock * lock) { return pthread_mutex_lock(lock); }
+static inline int tsTryLock(TsLock * lock) { return pthread_mutex_trylock(lock); }
+static inline int tsUnlock(TsLock * lock) { return pthread_mutex_unlock(lock); }
+
+#elif TS_LOCK == TS_LOCK_FUTEX
+
+typedef struct {
+  atomic_int state;              /* 0 free, 1 held, 2 held with sleepers */
+} TsLock;
+#define TS_LOCK_INITIALIZER { 0 }
+#define TS_LOCK_NAME "futex"
+
+static inline void tsLockInit(TsLock * lock) { atomic_init(&lock->state, 0); }
+
+static inline int tsTryLock(TsLock * lock) {
+  int expected = 0;
+  return atomic_compare_exchange_strong_explicit(&lock->state, &expected, 1,
+                                                 memory_order_acquire, memory_order_relaxed) ? 0 : EBUSY;
+}
+
+static inline int tsLock(TsLock * lock) {
+  for (unsigned spins = 0; spins < TS_LOCK_SPINS; spins++) {
+    if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0 && tsTryLock(lock) == 0) {
+      return 0;
+    }
+    tsLockPause();
+  }
+  /* Mark the lock contended before sleeping so the holder wakes us. */
+  while (atomic_exchange_explicit(&lock->state, 2, memory_order_acquire) != 0) {
+    syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+  }
+  return 0;
+}
+
+static inline int tsUnlock(TsLock * lock) {
+  if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2) {
+    syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+  return 0;
+}
+
+#elif TS_LOCK == TS_LOCK_TICKET
+
+typedef struct {
+  atomic_uint next;              /* ticket the next arrival takes */
+  atomic_uint serving;           /* ticket holding the lock */
+} TsLock;
+#define TS_LOCK_INITIALIZER { 0, 0 }
+#define TS_LOCK_NAME "ticket"
+
+static inline void tsLockInit(TsLock * lock) {
+  atomic_init(&lock->next, 0);
+  atomic_init(&lock->serving, 0);
+}
+
+static inline int tsLock(TsLock * lock) {
+  unsigned ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+  unsigned spins = 0;
+  while (atomic_load_explicit(&lock->serving, memory_order_acquire) != ticket) {
+    tsLockBackOff(&spins);
+  }
+  return 0;
+}
+
+static inline int tsTryLock(TsLock * lock) {
+  unsigned serving = atomic_load_explicit(&lock->serving, memory_order_relaxed);
+  unsigned expected = serving;   /* free only if nobody holds or waits for a ticket */
+  return atomic_compare_exchange_strong_explicit(&lock->next, &expected, serving + 1,
+                                                 memory_order_acquire, memory_order_relaxed) ? 0 : EBUSY;
+}
+
+static inline int tsUnlock(TsLock * lock) {
+  unsigned serving = atomic_load_explicit(&lock->serving, memory_order_relaxed);
+  atomic_store_explicit(&lock->serving, serving + 1, memory_order_release);
+  return 0;
+}
+
+#elif TS_LOCK == TS_LOCK_MCS
+
+struct TsLockNode {
+  _Atomic(struct TsLockNode *) next;   /* the waiter queued behind this one */
+  atomic_bool waiting;
+};
+
+typedef struct {
+  _Atomic(struct TsLockNode *) tail;   /* last in the queue, NULL if free */
+  struct TsLockNode * holder;          /* written and read by the holder only */
+} TsLock;
+#define TS_LOCK_INITIALIZER { NULL, NULL }
+#define TS_LOCK_NAME "mcs"
+
+static __thread struct TsLockNode tsLockNodes[TS_LOCK_MAX_NESTING];
+static __thread unsigned tsLockDepth = 0;
+
+static inline void tsLockInit(TsLock * lock) {
+  atomic_init(&lock->tail, NULL);
+  lock->holder = NULL;
+}
+
+static inline struct TsLockNode * tsLockPushNode() {
+  struct TsLockNode * node = &tsLockNodes[tsLockDepth++];
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&node->waiting, true, memory_order_relaxed);
+  return node;
+}
+
+static inline int tsLock(TsLock * lock) {
+  struct TsLockNode * node = tsLockPushNode();
+  struct TsLockNode * prev = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+  if (prev != NULL) {
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+    unsigned spins = 0;
+    while (atomic_load_explicit(&node->waiting, memory_order_acquire)) {
+      tsLockBackOff(&spins);
+    }
+  }
+  lock->holder = node;
+  return 0;
+}
+
+static inline int tsTryLock(TsLock * lock) {
+  struct TsLockNode * node = tsLockPushNode();
+  struct TsLockNode * expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&lock->tail, &expected, node,
+                                               memory_order_acquire, memory_order_relaxed)) {
+    tsLockDepth--;
+    return EBUSY;
+  }
+  lock->holder = node;
+  return 0;
+}
+
+static inline int tsUnlock(TsLock * lock) {
+  struct TsLockNode * node = lock->holder;
+  struct TsLockNode * next = atomic_load_explicit(&node->next, memory_order_acquire);
+  if (next == NULL) {
+    struct TsLockNode * expected = node;
+    if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL,
+                                                memory_order_release, memory_order_relaxed)) {
+      tsLockDepth--;
+      return 0;
+    }
+    /* Someone swapped in behind us but has not linked up yet. */
+    unsigned spins = 0;
+    while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+      tsLockBackOff(&spins);
+    }
+  }
+  atomic_store_explicit(&next->waiting, false, memory_order_release);
+  tsLockDepth--;
+  return 0;
+}
+
+#else
+#error "TS_LOCK must be TS_LOCK_MUTEX, TS_LOCK_FUTEX, TS_LOCK_TICKET or TS_LOCK_MCS"
+#endif
+
+#endif